@@ -5,6 +5,7 @@
  */
 
 #include <stddef.h>
+#include <stdbool.h>
 #include <string.h>
 #include <errno.h>
 
@@ -105,9 +106,59 @@ enum verb_descriptor_request {
     VERB_DESCRIPTOR_DOC = 2,
     VERB_DESCRIPTOR_OUT_PARAM_NAMES = 3,
     VERB_DESCRIPTOR_IN_PARAM_NAMES = 4,
-    VERB_DESCRIPTOR_COUNT = 5,
+    VERB_DESCRIPTOR_FLAGS = 5,
+    VERB_DESCRIPTOR_COUNT = 6,
+};
+
+
+/**
+ * Names for each of the verb flags, as reported to the host; indexed by bit position.
+ * See enum comms_verb_flags.
+ */
+static char const *const verb_flag_names[] = {
+	"cacheable",
 };
 
+/**
+ * Maximum length of a verb's flags, as reported to the host -- long enough to hold every flag name.
+ */
+#define VERB_FLAGS_STRING_MAX_LENGTH (64)
+
+
+/**
+ * Converts a verb's flags into the comma-delimited list of flag names reported to the host; e.g. "cacheable".
+ * Verbs with no flags are described by an empty string. If the names don't all fit, the list is truncated.
+ */
+static void verb_flags_to_string(uint32_t flags, char *buffer, size_t buffer_size)
+{
+	size_t position = 0;
+
+	buffer[0] = '\0';
+
+	for (size_t i = 0; i < sizeof(verb_flag_names) / sizeof(*verb_flag_names); ++i) {
+		if (!(flags & (1UL << i))) {
+			continue;
+		}
+
+		// Once the buffer's full, there's no room for any more names.
+		if (position >= buffer_size - 1) {
+			break;
+		}
+
+		if (position) {
+			position += strlcpy(&buffer[position], ",", buffer_size - position);
+		}
+		position += strlcpy(&buffer[position], verb_flag_names[i], buffer_size - position);
+
+		// strlcpy() returns the length of the name, not what it copied; so don't let a truncated name
+		// carry us past the terminator.
+		if (position > buffer_size - 1) {
+			position = buffer_size - 1;
+		}
+	}
+}
+
+
 /**
  * Internal introspection command that returns information about a verb.
  */
@@ -117,6 +168,8 @@ static int verb_get_verb_descriptor(struct command_transaction *trans)
 	uint32_t verb_number = comms_argument_parse_uint32_t(trans);
     uint8_t descriptor = comms_argument_parse_uint8_t(trans);
 
+	char flags[VERB_FLAGS_STRING_MAX_LENGTH];
+
 	// Fetch the relevant class.
 	struct comms_verb *verb = comms_get_object_for_verb(class_number, verb_number);
 
@@ -131,12 +184,14 @@ static int verb_get_verb_descriptor(struct command_transaction *trans)
     }
 
     // Generate a look-up-table for the relevant strings we might want.
+    verb_flags_to_string(verb->flags, flags, sizeof(flags));
     const char *const signature_string[] = {
         verb->out_signature,
         verb->in_signature,
         verb->doc,
         verb->out_param_names,
         verb->in_param_names,
+        flags,
     };
 
     // If the signature string is provided, use it.
@@ -223,20 +278,310 @@ static int verb_get_class_docs(struct command_transaction *trans)
 
 
 
+/**
+ * Internal introspection command that returns the list of pipes owned by a given class.
+ */
+static int verb_get_available_pipes(struct command_transaction *trans)
+{
+	uint32_t class_number = comms_argument_parse_uint32_t(trans);
+	uint32_t pipe_number;
+
+	// Ensure we have a matching class.
+	if (!comms_get_class_by_number(class_number)) {
+		return EINVAL;
+	}
+
+	// Add the number of each of the class's pipes to our response.
+	for (pipe_number = 0; pipe_number < comms_get_pipe_count(); ++pipe_number) {
+		struct comms_pipe *pipe = comms_get_pipe_by_number(pipe_number);
+
+		if (pipe->owning_class->class_number == class_number) {
+			comms_response_add_uint32_t(trans, pipe_number);
+		}
+	}
+
+	return 0;
+}
+
+
+/**
+ * Internal introspection command that returns information about how to reach a given pipe.
+ */
+static int verb_get_pipe_info(struct command_transaction *trans)
+{
+	uint32_t pipe_number = comms_argument_parse_uint32_t(trans);
+	struct comms_pipe *pipe = comms_get_pipe_by_number(pipe_number);
+
+	// Ensure we have a matching pipe.
+	if (!pipe) {
+		return EINVAL;
+	}
+
+	// If the pipe isn't attached to a transport, there's no way to reach it.
+	if (!pipe->transport) {
+		return ENODEV;
+	}
+
+	comms_response_add_uint32_t(trans, pipe->owning_class->class_number);
+	comms_response_add_uint32_t(trans, pipe->flags);
+	comms_response_add_uint32_t(trans, pipe->transport->get_address(pipe));
+	return 0;
+}
+
+
+
+/**
+ * Special class number for verb_get_class_description, which requests a description of every class.
+ */
+#define CORE_DESCRIBE_ALL_CLASSES (0xFFFFFFFF)
+
+
+/**
+ * State for generating a class description a page at a time. The full description is regenerated
+ * on each request; but only the bytes that fall within the requested page are added to the response.
+ */
+struct class_description_writer {
+	struct command_transaction *trans;
+
+	/** Our position in the full description. */
+	uint32_t position;
+
+	/** The section of the full description that should be included in the response. */
+	uint32_t page_start;
+	uint32_t page_end;
+
+	/** If non-NULL, accumulates a hash of the full description; see verb_get_api_hash. */
+	uint64_t *hash;
+};
+
+
+/**
+ * Parameters for the 64-bit FNV-1a hash used to summarize our API.
+ */
+#define CORE_API_HASH_OFFSET_BASIS (0xcbf29ce484222325ULL)
+#define CORE_API_HASH_PRIME        (0x100000001b3ULL)
+
+
+/**
+ * Adds a chunk of data to a class description; including whichever part of it falls in the current page.
+ */
+static void class_description_add(struct class_description_writer *writer, void const *data, uint32_t length)
+{
+	uint8_t const *bytes = data;
+
+	uint32_t start = writer->position;
+	uint32_t end = writer->position + length;
+
+	// Figure out which portion of the data overlaps with our page.
+	uint32_t copy_start = (start > writer->page_start) ? start : writer->page_start;
+	uint32_t copy_end = (end < writer->page_end) ? end : writer->page_end;
+
+	if (copy_start < copy_end) {
+		comms_response_add_raw(writer->trans, (void *)&bytes[copy_start - start], copy_end - copy_start);
+	}
+
+	if (writer->hash) {
+		for (uint32_t i = 0; i < length; ++i) {
+			*writer->hash = (*writer->hash ^ bytes[i]) * CORE_API_HASH_PRIME;
+		}
+	}
+
+	writer->position = end;
+}
+
+
+static void class_description_add_uint32(struct class_description_writer *writer, uint32_t value)
+{
+	class_description_add(writer, &value, sizeof(value));
+}
+
+
+/**
+ * Adds a NUL-terminated string to a class description; or the fallback string, if the string is NULL.
+ */
+static void class_description_add_string(struct class_description_writer *writer, char const *string,
+	char const *fallback)
+{
+	if (!string) {
+		string = fallback;
+	}
+
+	class_description_add(writer, string, strlen(string) + 1);
+}
+
+
+/**
+ * Adds the description of a single class, and each of its verbs, to a class description.
+ */
+static void class_description_add_class(struct class_description_writer *writer, struct comms_class *cls)
+{
+	struct comms_verb *verb;
+	uint32_t verb_count = 0;
+
+	char flags[VERB_FLAGS_STRING_MAX_LENGTH];
+
+	// Count the class's verbs. Classes with only a command handler have none we can describe.
+	if (cls->command_verbs) {
+		for (verb = cls->command_verbs; verb->handler; ++verb) {
+			++verb_count;
+		}
+	}
+
+	class_description_add_uint32(writer, cls->class_number);
+	class_description_add_string(writer, cls->name, "");
+	class_description_add_string(writer, cls->doc, "");
+	class_description_add_uint32(writer, verb_count);
+
+	// Describe each verb. As with get_verb_descriptor, missing descriptors are represented as "*".
+	for (verb = cls->command_verbs; verb_count; ++verb, --verb_count) {
+		class_description_add_uint32(writer, verb->verb_number);
+		class_description_add_string(writer, verb->name, "");
+		class_description_add_string(writer, verb->in_signature, "*");
+		class_description_add_string(writer, verb->out_signature, "*");
+		class_description_add_string(writer, verb->in_param_names, "*");
+		class_description_add_string(writer, verb->out_param_names, "*");
+		class_description_add_string(writer, verb->doc, "*");
+
+		verb_flags_to_string(verb->flags, flags, sizeof(flags));
+		class_description_add_string(writer, flags, "");
+	}
+}
+
+
+/**
+ * Adds the description of every class to a class description.
+ */
+static void class_description_add_all_classes(struct class_description_writer *writer)
+{
+	struct comms_class *cls;
+	uint32_t class_count = 0;
+
+	for (cls = class_head; cls; cls = cls->next) {
+		++class_count;
+	}
+
+	class_description_add_uint32(writer, class_count);
+	for (cls = class_head; cls; cls = cls->next) {
+		class_description_add_class(writer, cls);
+	}
+}
+
+
+/**
+ * Internal introspection command that describes a class -- or every class -- in a single blob,
+ * which allows the host to enumerate our API in a handful of requests rather than several per verb.
+ *
+ * The description consists of a uint32 class count; followed by, for each class: its uint32 number,
+ * its NUL-terminated name and documentation, and a uint32 verb count. Each verb is then described by
+ * its uint32 number, followed by its NUL-terminated name, in-signature, out-signature, in-parameter names,
+ * out-parameter names, documentation, and flags.
+ *
+ * Descriptions can be longer than a single response; so the response consists of the uint32 total
+ * length of the description, followed by as much of the description as fits, starting at the
+ * requested offset.
+ */
+static int verb_get_class_description(struct command_transaction *trans)
+{
+	uint32_t total_length;
+	uint32_t *total_length_position;
+	struct comms_class *cls;
+	struct class_description_writer writer;
+
+	uint32_t class_number = comms_argument_parse_uint32_t(trans);
+	uint32_t offset = comms_argument_parse_uint32_t(trans);
+
+	// Make room for the description's length; which we'll only know once we've generated it.
+	total_length_position = comms_response_reserve_space(trans, sizeof(uint32_t));
+	if (!total_length_position) {
+		return EINVAL;
+	}
+
+	writer.trans = trans;
+	writer.position = 0;
+	writer.page_start = offset;
+	writer.page_end = offset + (trans->data_out_max_length - trans->data_out_length);
+	writer.hash = NULL;
+
+	if (class_number == CORE_DESCRIBE_ALL_CLASSES) {
+		class_description_add_all_classes(&writer);
+	} else {
+		cls = comms_get_class_by_number(class_number);
+
+		if (!cls) {
+			return EINVAL;
+		}
+
+		class_description_add_uint32(&writer, 1);
+		class_description_add_class(&writer, cls);
+	}
+
+	total_length = writer.position;
+	memcpy(total_length_position, &total_length, sizeof(total_length));
+
+	return 0;
+}
+
+
+/**
+ * Internal introspection command that returns a 64-bit hash of our API: the FNV-1a hash of the description
+ * of every class, as returned by get_class_description. Hosts can compare this against the hash of an API
+ * they've previously enumerated to tell -- in a single round trip -- whether their RPC stubs are still valid.
+ */
+static int verb_get_api_hash(struct command_transaction *trans)
+{
+	static uint64_t api_hash;
+	static bool api_hash_valid = false;
+
+	// Classes are registered during initialization, in no particular order; so we compute our hash on its
+	// first request, once every class is present. Classes are never removed, so it then never changes.
+	if (!api_hash_valid) {
+		struct class_description_writer writer = {
+			.trans = trans,
+			.hash = &api_hash,
+		};
+
+		api_hash = CORE_API_HASH_OFFSET_BASIS;
+		class_description_add_all_classes(&writer);
+
+		api_hash_valid = true;
+	}
+
+	comms_response_add_raw(trans, &api_hash, sizeof(api_hash));
+	return 0;
+}
+
+
+
 /**
  * Verbs for the core API.
  */
 static struct comms_verb core_verbs[] = {
-		{ .verb_number = 0x0, .name = "read_board_id", .handler = core_verb_read_board_id },
-		{ .verb_number = 0x1, .name = "read_version_string", .handler = core_verb_read_version_string },
-		{ .verb_number = 0x2, .name = "read_part_id", .handler = core_verb_read_part_id },
-		{ .verb_number = 0x3, .name = "read_serial_number", .handler = core_verb_read_serial_number },
-		{ .verb_number = 0x4, .name = "get_available_classes", .handler = verb_get_available_classes },
-		{ .verb_number = 0x5, .name = "get_avaiable_verbs", .handler = verb_get_available_verbs },
-		{ .verb_number = 0x6, .name = "get_verb_name", .handler = verb_get_verb_name },
-		{ .verb_number = 0x7, .name = "get_verb_descriptor", .handler = verb_get_verb_descriptor },
-		{ .verb_number = 0x8, .name = "get_class_name", .handler = verb_get_class_name },
-		{ .verb_number = 0x9, .name = "get_class_docs", .handler = verb_get_class_docs },
+		{ .verb_number = 0x0, .name = "read_board_id", .handler = core_verb_read_board_id,
+			.flags = COMMS_VERB_FLAG_CACHEABLE },
+		{ .verb_number = 0x1, .name = "read_version_string", .handler = core_verb_read_version_string,
+			.flags = COMMS_VERB_FLAG_CACHEABLE },
+		{ .verb_number = 0x2, .name = "read_part_id", .handler = core_verb_read_part_id,
+			.flags = COMMS_VERB_FLAG_CACHEABLE },
+		{ .verb_number = 0x3, .name = "read_serial_number", .handler = core_verb_read_serial_number,
+			.flags = COMMS_VERB_FLAG_CACHEABLE },
+		{ .verb_number = 0x4, .name = "get_available_classes", .handler = verb_get_available_classes,
+			.flags = COMMS_VERB_FLAG_CACHEABLE },
+		{ .verb_number = 0x5, .name = "get_avaiable_verbs", .handler = verb_get_available_verbs,
+			.flags = COMMS_VERB_FLAG_CACHEABLE },
+		{ .verb_number = 0x6, .name = "get_verb_name", .handler = verb_get_verb_name,
+			.flags = COMMS_VERB_FLAG_CACHEABLE },
+		{ .verb_number = 0x7, .name = "get_verb_descriptor", .handler = verb_get_verb_descriptor,
+			.flags = COMMS_VERB_FLAG_CACHEABLE },
+		{ .verb_number = 0x8, .name = "get_class_name", .handler = verb_get_class_name,
+			.flags = COMMS_VERB_FLAG_CACHEABLE },
+		{ .verb_number = 0x9, .name = "get_class_docs", .handler = verb_get_class_docs,
+			.flags = COMMS_VERB_FLAG_CACHEABLE },
+		{ .verb_number = 0xa, .name = "get_available_pipes", .handler = verb_get_available_pipes },
+		{ .verb_number = 0xb, .name = "get_pipe_info", .handler = verb_get_pipe_info },
+		{ .verb_number = 0xc, .name = "get_class_description", .handler = verb_get_class_description,
+			.flags = COMMS_VERB_FLAG_CACHEABLE },
+		{ .verb_number = 0xd, .name = "get_api_hash", .handler = verb_get_api_hash,
+			.flags = COMMS_VERB_FLAG_CACHEABLE },
 
 		// TODO: move this out of core!
 		{ .verb_number = 0x20, .handler = core_verb_request_reset },
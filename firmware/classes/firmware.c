@@ -9,6 +9,7 @@
 #include <debug.h>
 
 #include <stddef.h>
+#include <string.h>
 #include <errno.h>
 
 
@@ -20,6 +21,13 @@
 
 #define CLASS_NUMBER_FIRMWARE (0x1)
 
+/**
+ * The largest flash page that can be programmed via the streaming update verbs.
+ */
+#ifndef FIRMWARE_STREAM_MAX_PAGE_SIZE
+#define FIRMWARE_STREAM_MAX_PAGE_SIZE (512)
+#endif
+
 /**
  * Initializes the firmware update subsystem of the target device.
  * Accepts no arguments.
@@ -75,6 +83,9 @@ ATTR_WEAK int firmware_verb_write_page(struct command_transaction *trans)
  *
  * Accepts a uint32_t that is the address.
  * Returns the relevant page.
+ *
+ * Implementations that read the page into a buffer of their own can respond with it directly
+ * via comms_response_use_external_buffer(), avoiding a copy into the response.
  */
 ATTR_WEAK int firmware_verb_read_page(struct command_transaction *trans)
 {
@@ -83,6 +94,452 @@ ATTR_WEAK int firmware_verb_read_page(struct command_transaction *trans)
 }
 
 
+
+/**
+ * Flash-access hooks used by the streaming update verbs.
+ *
+ * Devices that implement these get streaming updates -- in which the host sends an image in large chunks,
+ * and the device erases, programs and verifies it on its own -- without implementing the stream verbs themselves.
+ */
+
+/**
+ * Describes the layout of the firmware flash.
+ *
+ * @param page_size Out argument; accepts the size of a programming page, in bytes.
+ * @param erase_size Out argument; accepts the size of the smallest erasable block, in bytes.
+ *		Must be a multiple of the page size.
+ * @param total_size Out argument; accepts the total size of the flash, in bytes.
+ *
+ * @return 0 on success, or an error number on failure
+ */
+ATTR_WEAK int firmware_flash_get_geometry(uint32_t *page_size, uint32_t *erase_size, uint32_t *total_size)
+{
+	(void)page_size;
+	(void)erase_size;
+	(void)total_size;
+	return ENOSYS;
+}
+
+
+/**
+ * Starts erasing the erase block that begins at the given address. May return before the erase
+ * completes; in which case firmware_flash_wait() must wait for it.
+ *
+ * @return 0 on success, or an error number on failure
+ */
+ATTR_WEAK int firmware_flash_start_erase(uint32_t address)
+{
+	(void)address;
+	return ENOSYS;
+}
+
+
+/**
+ * Waits for any erase started by firmware_flash_start_erase() to complete. Devices whose erases
+ * complete before firmware_flash_start_erase() returns don't need to provide this.
+ *
+ * @return 0 on success, or an error number on failure
+ */
+ATTR_WEAK int firmware_flash_wait(void)
+{
+	return 0;
+}
+
+
+/**
+ * Checks, without waiting, whether an erase started by firmware_flash_start_erase() may still be running.
+ * Devices that don't provide this are always treated as busy; so streaming updates only erase blocks
+ * as they're needed, rather than ahead of time.
+ *
+ * @return True iff the flash may still be busy erasing.
+ */
+ATTR_WEAK bool firmware_flash_busy(void)
+{
+	return true;
+}
+
+
+/**
+ * Programs a single, previously-erased flash page; returning once the data has been written.
+ *
+ * @param address The address of the page; aligned to the page size.
+ * @param data The data to be written; exactly one page long.
+ *
+ * @return 0 on success, or an error number on failure
+ */
+ATTR_WEAK int firmware_flash_write_page(uint32_t address, void const *data, uint32_t length)
+{
+	(void)address;
+	(void)data;
+	(void)length;
+	return ENOSYS;
+}
+
+
+/**
+ * Reads back the contents of the flash.
+ *
+ * @return 0 on success, or an error number on failure
+ */
+ATTR_WEAK int firmware_flash_read(uint32_t address, void *buffer, uint32_t length)
+{
+	(void)address;
+	(void)buffer;
+	(void)length;
+	return ENOSYS;
+}
+
+
+/**
+ * State for a streaming update; see firmware_verb_stream_begin().
+ */
+struct firmware_stream {
+
+	/** True iff a stream has been started, and hasn't failed. */
+	bool active;
+
+	/** The error that ended the stream, if it failed; reported for each later stream request. */
+	int error;
+
+	/** The flash's layout. */
+	uint32_t page_size;
+	uint32_t erase_size;
+
+	/** The region of flash being programmed. */
+	uint32_t start_address;
+	uint32_t end_address;
+
+	/** The address of the next page to be programmed. */
+	uint32_t write_address;
+
+	/** The address up to which the flash has been erased -- or is being erased. */
+	uint32_t erased_until;
+
+	/** The number of image bytes received so far. */
+	uint32_t received;
+
+	/** The running CRC32 of the image, as read back from the flash. */
+	uint32_t crc;
+
+	/** The part of the next page that's been received so far; and a buffer for reading pages back. */
+	uint32_t page_fill;
+	uint8_t page[FIRMWARE_STREAM_MAX_PAGE_SIZE] ATTR_ALIGNED(4);
+	uint8_t readback[FIRMWARE_STREAM_MAX_PAGE_SIZE] ATTR_ALIGNED(4);
+};
+
+static struct firmware_stream stream;
+
+
+/**
+ * Adds data to a running CRC32 (as used by zlib, and so easily computed by the host).
+ * The CRC should start at, and be finalized by XOR'ing with, 0xFFFFFFFF.
+ */
+static uint32_t firmware_crc32_update(uint32_t crc, uint8_t const *data, uint32_t length)
+{
+	static const uint32_t nibble_table[] = {
+		0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+		0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c, 0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c,
+	};
+
+	for (uint32_t i = 0; i < length; ++i) {
+		crc ^= data[i];
+		crc = (crc >> 4) ^ nibble_table[crc & 0xF];
+		crc = (crc >> 4) ^ nibble_table[crc & 0xF];
+	}
+
+	return crc;
+}
+
+
+/**
+ * Starts erasing the next block of the stream's region; waiting for any erase already underway to finish first.
+ */
+static int firmware_stream_erase_next_block(void)
+{
+	int rc;
+
+	// Only one erase can be underway at once; ensure the last has finished.
+	rc = firmware_flash_wait();
+	if (rc) {
+		return rc;
+	}
+
+	rc = firmware_flash_start_erase(stream.erased_until);
+	if (rc) {
+		return rc;
+	}
+
+	stream.erased_until += stream.erase_size;
+	return 0;
+}
+
+
+/**
+ * Starts erasing the next block of the stream's region ahead of time, if we'll soon need it; so the erase
+ * can run while the host is sending us the data to be written to it.
+ *
+ * Commands are often run from the USB interrupt, and block erases can take far longer than the host will
+ * wait for a command; so this never waits for the flash. If an earlier erase is still running, we try again
+ * with the next chunk, or erase the block when we first need it.
+ */
+static int firmware_stream_erase_ahead(void)
+{
+	if (stream.erased_until >= stream.end_address) {
+		return 0;
+	}
+
+	// Only erase the next block once we're writing into the last block we've erased.
+	if (stream.erased_until - stream.write_address > stream.erase_size) {
+		return 0;
+	}
+
+	if (firmware_flash_busy()) {
+		return 0;
+	}
+
+	return firmware_stream_erase_next_block();
+}
+
+
+/**
+ * Programs the stream's buffered page, and verifies it by reading it back; erasing ahead as necessary.
+ *
+ * @return 0 on success, or an error number on failure
+ */
+static int firmware_stream_program_page(void)
+{
+	int rc;
+	uint32_t address = stream.write_address;
+
+	// If we've caught up with our erases, erase the block we're about to program.
+	if (address >= stream.erased_until) {
+		rc = firmware_stream_erase_next_block();
+		if (rc) {
+			return rc;
+		}
+	}
+
+	// Wait for the erase of the block to complete -- which it likely already has, if we erased it ahead of time.
+	rc = firmware_flash_wait();
+	if (rc) {
+		return rc;
+	}
+
+	rc = firmware_flash_write_page(address, stream.page, stream.page_size);
+	if (rc) {
+		return rc;
+	}
+
+	// Verify the page; and add what's actually in the flash to our digest of the image.
+	rc = firmware_flash_read(address, stream.readback, stream.page_size);
+	if (rc) {
+		return rc;
+	}
+	if (memcmp(stream.page, stream.readback, stream.page_size)) {
+		pr_error("firmware: verification failed for page at %08" PRIx32 "!\n", address);
+		return EIO;
+	}
+
+	stream.crc = firmware_crc32_update(stream.crc, stream.readback, stream.page_size);
+	stream.write_address += stream.page_size;
+	stream.page_fill = 0;
+
+	return 0;
+}
+
+
+/**
+ * Starts a streaming firmware update: which programs an image into the flash, a chunk at a time.
+ * The device erases the flash ahead of the data it's given, and programs and verifies each page
+ * on its own; so the host only needs to send each chunk, and check the final digest.
+ *
+ * Accepts a uint32_t that is the address at which the image should be written, which must be
+ * aligned to the flash's erase size; and a uint32_t that is the image's length.
+ *
+ * Returns:
+ *  - a uint32_t that indicates the device's page size in bytes.
+ *  - a uint32_t that indicates the device's erase block size in bytes.
+ */
+static int firmware_verb_stream_begin(struct command_transaction *trans)
+{
+	int rc;
+	uint32_t total_size;
+
+	uint32_t address = comms_argument_parse_uint32_t(trans);
+	uint32_t length = comms_argument_parse_uint32_t(trans);
+
+	if (!comms_argument_parse_okay(trans)) {
+		return EINVAL;
+	}
+
+	stream.active = false;
+	stream.error = 0;
+
+	rc = firmware_flash_get_geometry(&stream.page_size, &stream.erase_size, &total_size);
+	if (rc) {
+		return rc;
+	}
+
+	// Ensure we can handle the flash's layout, and that the image will fit.
+	if (!stream.page_size || (stream.page_size > sizeof(stream.page)) || (stream.erase_size % stream.page_size)) {
+		return ENOTSUP;
+	}
+	if ((address % stream.erase_size) || (address > total_size) || (length > total_size - address)) {
+		return EINVAL;
+	}
+
+	stream.start_address = address;
+	stream.end_address = address + length;
+	stream.write_address = address;
+	stream.erased_until = address;
+	stream.received = 0;
+	stream.page_fill = 0;
+	stream.crc = 0xFFFFFFFF;
+
+	// Get started erasing the first block, while the host prepares its first chunk.
+	rc = length ? firmware_stream_erase_next_block() : 0;
+	if (rc) {
+		return rc;
+	}
+
+	stream.active = true;
+
+	comms_response_add_uint32_t(trans, stream.page_size);
+	comms_response_add_uint32_t(trans, stream.erase_size);
+	return 0;
+}
+
+
+/**
+ * Adds a chunk of data to a streaming firmware update; programming each page once it's complete.
+ *
+ * Accepts a uint32_t that is the chunk's offset into the image, which must directly follow the last chunk
+ * sent; followed by the chunk's data. Chunks can be of any length.
+ */
+static int firmware_verb_stream_write(struct command_transaction *trans)
+{
+	int rc;
+	uint32_t length;
+	uint8_t const *data;
+
+	uint32_t offset = comms_argument_parse_uint32_t(trans);
+
+	// Hosts typically send chunks without waiting for their results; so if an earlier chunk failed,
+	// keep reporting why.
+	if (!stream.active) {
+		return stream.error ? stream.error : EINVAL;
+	}
+	if (!comms_argument_parse_okay(trans)) {
+		stream.active = false;
+		stream.error = EINVAL;
+		return EINVAL;
+	}
+
+	// Ensure we haven't lost -- or been re-sent -- a chunk.
+	if (offset != stream.received) {
+		pr_error("firmware: expected image data at offset %" PRIu32 ", but got offset %" PRIu32 "\n",
+				stream.received, offset);
+		stream.active = false;
+		stream.error = EINVAL;
+		return EINVAL;
+	}
+
+	length = comms_argument_data_remaining(trans);
+	if (length > (stream.end_address - stream.start_address) - stream.received) {
+		stream.active = false;
+		stream.error = EINVAL;
+		return EINVAL;
+	}
+
+	data = comms_argument_read_buffer(trans, length, NULL);
+	stream.received += length;
+
+	// Program each page as soon as we have all of it.
+	while (length) {
+		uint32_t to_copy = stream.page_size - stream.page_fill;
+		if (to_copy > length) {
+			to_copy = length;
+		}
+
+		memcpy(&stream.page[stream.page_fill], data, to_copy);
+		stream.page_fill += to_copy;
+		data += to_copy;
+		length -= to_copy;
+
+		if (stream.page_fill == stream.page_size) {
+			rc = firmware_stream_program_page();
+			if (rc) {
+				stream.active = false;
+				stream.error = rc;
+				return rc;
+			}
+		}
+	}
+
+	// Start erasing the next block before the host sends its data.
+	rc = firmware_stream_erase_ahead();
+	if (rc) {
+		stream.active = false;
+		stream.error = rc;
+	}
+
+	return rc;
+}
+
+
+/**
+ * Completes a streaming firmware update, programming any partial final page (padded with 0xFF).
+ * Accepts no arguments.
+ *
+ * Returns:
+ *  - a uint32_t that indicates the number of image bytes programmed.
+ *  - a uint32_t that is the CRC32 of the image, as read back from the flash; which the host should
+ *    compare against its own.
+ */
+static int firmware_verb_stream_finish(struct command_transaction *trans)
+{
+	int rc;
+	uint32_t image_length, padding;
+	uint32_t crc;
+
+	if (!stream.active) {
+		return stream.error ? stream.error : EINVAL;
+	}
+	stream.active = false;
+
+	// The whole image must have been sent.
+	image_length = stream.end_address - stream.start_address;
+	if (stream.received != image_length) {
+		return EINVAL;
+	}
+
+	// Program the final partial page, if there is one. Our digest covers only the image itself,
+	// so leave the padding out of it.
+	if (stream.page_fill) {
+		padding = stream.page_size - stream.page_fill;
+		memset(&stream.page[stream.page_fill], 0xFF, padding);
+
+		crc = stream.crc;
+		rc = firmware_stream_program_page();
+		if (rc) {
+			return rc;
+		}
+
+		stream.crc = firmware_crc32_update(crc, stream.readback, stream.page_size - padding);
+	}
+
+	// Ensure any erase we started ahead of time is complete before we report success.
+	rc = firmware_flash_wait();
+	if (rc) {
+		return rc;
+	}
+
+	comms_response_add_uint32_t(trans, stream.received);
+	comms_response_add_uint32_t(trans, stream.crc ^ 0xFFFFFFFF);
+	return 0;
+}
+
+
 /**
  * Verbs for the firmware API.
  */
@@ -101,6 +558,16 @@ static struct comms_verb firmware_verbs[] = {
 		{ .verb_number = 0x4, .name = "read_page",	.handler = firmware_verb_read_page,
             .in_signature = "<I", .out_signature = "<*X", .in_param_names = "address", .out_param_names = "data",
             .doc = "Returns the contents of the flash page at the given address." },
+		{ .verb_number = 0x5, .name = "stream_begin", .handler = firmware_verb_stream_begin,
+            .in_signature = "<II", .out_signature = "<II", .in_param_names = "address, length",
+            .out_param_names = "page_size, erase_size",
+            .doc = "Starts a streaming update, which programs an image of the given length at the given address." },
+		{ .verb_number = 0x6, .name = "stream_write", .handler = firmware_verb_stream_write,
+            .in_signature = "<I*X", .out_signature = "", .in_param_names = "offset, data",
+            .doc = "Adds a chunk of image data, at the given offset, to a streaming update." },
+		{ .verb_number = 0x7, .name = "stream_finish", .handler = firmware_verb_stream_finish,
+            .in_signature = "", .out_signature = "<II", .out_param_names = "length, crc32",
+            .doc = "Completes a streaming update; returns the length and CRC32 of the image programmed." },
 		{} // Sentinel
 };
 COMMS_DEFINE_SIMPLE_CLASS(firmware_api, CLASS_NUMBER_FIRMWARE, "firmware", firmware_verbs,
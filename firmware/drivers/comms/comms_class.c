@@ -8,6 +8,7 @@
 
 #include <debug.h>
 #include <errno.h>
+#include <string.h>
 #include <stdbool.h>
 
 #include <drivers/comms.h>
@@ -17,6 +18,54 @@
 struct comms_class *class_head = NULL;
 
 
+/** Size of the class dispatch table; see COMMS_CLASS_TABLE_ORDER. */
+#define COMMS_CLASS_TABLE_SIZE  (1 << COMMS_CLASS_TABLE_ORDER)
+
+/**
+ * Open-addressed hash table mapping class numbers to their comms_class objects.
+ * This allows us to find the class for a command in constant time, rather than walking
+ * the class list on every command. Every registered class is in both the table and the list.
+ */
+static struct comms_class *class_table[COMMS_CLASS_TABLE_SIZE];
+
+
+/**
+ * @return The index in the class table at which a search for the given class number should start.
+ */
+static inline uint32_t comms_class_table_hash(uint32_t class_number)
+{
+	// Use a simple multiplicative (Fibonacci) hash; class numbers tend to be clustered,
+	// so we want their low bits to be well spread across the table.
+	return (uint32_t)(class_number * 2654435761U) >> (32 - COMMS_CLASS_TABLE_ORDER);
+}
+
+
+/**
+ * Adds a class to our class dispatch table.
+ *
+ * @return 0 on success, or ENOSPC if the table is full.
+ */
+static int comms_class_table_insert(struct comms_class *comms_class)
+{
+	uint32_t index = comms_class_table_hash(comms_class->class_number);
+
+	for (int i = 0; i < COMMS_CLASS_TABLE_SIZE; ++i) {
+		struct comms_class **slot = &class_table[index];
+
+		// If we've found an empty slot, or a slot that holds an earlier registration
+		// of the same class, claim it. Later registrations take precedence, as with the class list.
+		if (!*slot || ((*slot)->class_number == comms_class->class_number)) {
+			*slot = comms_class;
+			return 0;
+		}
+
+		index = (index + 1) & (COMMS_CLASS_TABLE_SIZE - 1);
+	}
+
+	return ENOSPC;
+}
+
+
 /**
  * Determines whether a provided comms class requires verb-number auto-assignments.
  * A class with every verb with a verb number of zero will have all verbs auto-assigned
@@ -26,6 +75,11 @@ static bool comms_class_requires_verb_assignment(struct comms_class *comms_class
 {
 	struct comms_verb *verb;
 
+	// If we don't have any verbs, there's nothing to assign.
+	if (!comms_class->command_verbs) {
+		return false;
+	}
+
 	// Iterate through the array of command verbs.
 	for (verb = comms_class->command_verbs; verb->handler; ++verb) {
 
@@ -54,11 +108,36 @@ static void comms_auto_assign_verb_numbers(struct comms_class *comms_class)
 }
 
 
+/**
+ * Computes the number of leading verbs that can be dispatched by index;
+ * that is, the length of the prefix of the class's verbs whose verb numbers match their position.
+ */
+static uint32_t comms_count_dense_verbs(struct comms_class *comms_class)
+{
+	uint32_t count = 0;
+
+	// If we don't have any verbs, we can't index any.
+	if (!comms_class->command_verbs) {
+		return 0;
+	}
+
+	// Count verbs until we hit the sentinel, or a verb that's out of place.
+	while (comms_class->command_verbs[count].handler && (comms_class->command_verbs[count].verb_number == count)) {
+		++count;
+	}
+
+	return count;
+}
+
+
 
 /**
  * Registers a given class for use with libgreat; which implicitly provides it
  * with an ability to handle commands.
  *
+ * Each board can register at most (1 << COMMS_CLASS_TABLE_ORDER) classes; any more are rejected,
+ * with an error.
+ *
  * @param comms_class The comms class to be registered. This object will continue
  *	to be held indefinition, so it must be permanently allocated.
  */
@@ -75,7 +154,17 @@ void comms_register_class(struct comms_class *comms_class)
 		comms_auto_assign_verb_numbers(comms_class);
 	}
 
-	// Link the comms class into our linked list.
+	// Figure out how many of the class's verbs we can look up directly.
+	comms_class->dense_verb_count = comms_count_dense_verbs(comms_class);
+
+	// Add the comms class to our dispatch table; if it doesn't fit, the board needs a bigger table.
+	if (comms_class_table_insert(comms_class)) {
+		pr_error("ERROR: comms: class dispatch table is full; can't register class %s! "
+			"(increase COMMS_CLASS_TABLE_ORDER)\n", comms_class->name);
+		return;
+	}
+
+	// ... and link it into our class list.
 	comms_class->next = class_head;
 	class_head = comms_class;
 }
@@ -88,12 +177,51 @@ void comms_register_class(struct comms_class *comms_class)
 struct comms_class *comms_get_class_by_number(uint32_t class_number)
 {
 	struct comms_class *cls;
+	uint32_t index = comms_class_table_hash(class_number);
+
+	// Search our dispatch table for the relevant class. Since we never remove classes,
+	// hitting an empty slot means the class was never registered.
+	for (int i = 0; i < COMMS_CLASS_TABLE_SIZE; ++i) {
+		cls = class_table[index];
 
-	// Search the linked list for a class with the given number.
-	for (cls = class_head; cls; cls = cls->next) {
+		if (!cls) {
+			break;
+		}
 		if (cls->class_number == class_number) {
 			return cls;
 		}
+
+		index = (index + 1) & (COMMS_CLASS_TABLE_SIZE - 1);
+	}
+
+	return NULL;
+}
+
+
+/**
+ * @returns The verb object in the given class with the provided number, or
+ *		NULL if none exists.
+ */
+static struct comms_verb *comms_find_verb_in_class(struct comms_class *cls, uint32_t verb_number)
+{
+	struct comms_verb *verb;
+
+	// If the class has no verb descriptors, there's nothing to find.
+	if (!cls->command_verbs) {
+		return NULL;
+	}
+
+	// If the verb falls within the class's dense prefix, we can index it directly.
+	if (verb_number < cls->dense_verb_count) {
+		return &cls->command_verbs[verb_number];
+	}
+
+	// Otherwise, search the remainder of the array of command verbs until we
+	// find a verb with a NULL handler.
+	for (verb = &cls->command_verbs[cls->dense_verb_count]; verb->handler; ++verb) {
+		if (verb->verb_number == verb_number) {
+			return verb;
+		}
 	}
 
 	return NULL;
@@ -146,20 +274,17 @@ int comms_backend_submit_command(struct comm_backend_driver *backend,
 	// Error out.
 	if (!handling_class->command_verbs && !handling_class->command_handler) {
 		pr_warning(
-				"comms: backend %s submttied a command for class %d, which has neither\n"
+				"comms: backend %s submttied a command for class %s, which has neither\n"
 				"a command handler nor verb handlers!\n",
 				backend->name, handling_class->name);
 		return EINVAL;
 	}
 
-	// Iterate through the array of command verbs until we find a verb that handles
-	// our command.
-	for (verb = handling_class->command_verbs; verb->handler; ++verb) {
-		if (verb->verb_number == trans->verb) {
-			found_handler = true;
-			rc = verb->handler(trans);
-			break;
-		}
+	// Find the verb that handles our command, if we have one.
+	verb = comms_find_verb_in_class(handling_class, trans->verb);
+	if (verb) {
+		found_handler = true;
+		rc = verb->handler(trans);
 	}
 
 	// If we haven't found a handler, but we have a class command handler, delegate
@@ -186,12 +311,115 @@ int comms_backend_submit_command(struct comm_backend_driver *backend,
 }
 
 
+/**
+ * Submits a batch of commands for execution. Used by command backends.
+ * See comms_backend.h for a description of the batch format.
+ *
+ * @param backend The command backend driver submitting the given batch.
+ * @param trans An object representing the batch to be submitted, and its response.
+ */
+int comms_backend_submit_batch(struct comm_backend_driver *backend,
+	struct command_transaction *trans)
+{
+	int rc;
+	uint32_t padded_length;
+
+	uint8_t *in_position = trans->data_in;
+	uint32_t in_remaining = trans->data_in_length;
+
+	uint8_t *out_position = trans->data_out;
+	uint32_t out_remaining = trans->data_out_max_length;
+
+	trans->data_out_length = 0;
+
+	// Execute each command in the batch, in order.
+	while (in_remaining) {
+		struct libgreat_batch_command_header *header = (void *)in_position;
+		struct libgreat_batch_response_header *response = (void *)out_position;
+		struct command_transaction command = {};
+
+		// Ensure that we have a full command header, and all of the arguments it describes.
+		if (in_remaining < sizeof(*header)) {
+			pr_warning("comms: backend %s submitted a batch with a truncated command header\n", backend->name);
+			return EBADMSG;
+		}
+		in_position  += sizeof(*header);
+		in_remaining -= sizeof(*header);
+
+		if (header->length > in_remaining) {
+			pr_warning("comms: backend %s submitted a batch with truncated arguments\n", backend->name);
+			return EBADMSG;
+		}
+
+		// If we don't have room to report this command's result, we can't execute it.
+		// Stop here; the host will see that the remaining commands have no responses.
+		if (out_remaining < sizeof(*response)) {
+			break;
+		}
+		out_position  += sizeof(*response);
+		out_remaining -= sizeof(*response);
+
+		// Build a transaction for the individual command, which reads its arguments directly
+		// from the batch, and writes its response directly into our response.
+		command.class_number = header->class_number;
+		command.verb = header->verb;
+		command.data_in = in_position;
+		command.data_in_length = header->length;
+		command.data_in_position = in_position;
+		command.data_in_remaining = header->length;
+		command.data_out = out_position;
+		command.data_out_position = out_position;
+		command.data_out_max_length = out_remaining;
+
+		if (header->max_response_length < out_remaining) {
+			command.data_out_max_length = header->max_response_length;
+		}
+
+		// Execute the command, and report its result.
+		rc = comms_backend_submit_command(backend, &command);
+		response->status = rc;
+		response->length = command.data_out_length;
+
+		// Responses in a batch have to be contiguous; so if the handler provided its response
+		// in an external buffer, we'll need to copy it in after all.
+		if (command.data_out_external) {
+			memcpy(out_position, command.data_out_external, command.data_out_length);
+			comms_backend_release_external_response(&command);
+		}
+
+		// Move past the command's arguments and response.
+		padded_length = LIBGREAT_BATCH_PADDED_LENGTH(header->length);
+		if (padded_length > in_remaining) {
+			padded_length = in_remaining;
+		}
+		in_position  += padded_length;
+		in_remaining -= padded_length;
+
+		padded_length = LIBGREAT_BATCH_PADDED_LENGTH(command.data_out_length);
+		if (padded_length > out_remaining) {
+			padded_length = out_remaining;
+		}
+		out_position  += padded_length;
+		out_remaining -= padded_length;
+
+		trans->data_out_length = trans->data_out_max_length - out_remaining;
+
+		// If the command failed, don't run any of the commands that follow it,
+		// as they likely depend on its effects.
+		if (rc) {
+			break;
+		}
+	}
+
+	return 0;
+}
+
+
 /**
  * @returns the verb description for the given class and verb number
  */
 struct comms_verb *comms_get_object_for_verb(uint32_t class_number, uint32_t verb_number)
 {
-	struct comms_verb *verb;
 	struct comms_class *handling_class = comms_get_class_by_number(class_number);
 
 	// If we couldn't find a handling class, return NULL.
@@ -199,21 +427,7 @@ struct comms_verb *comms_get_object_for_verb(uint32_t class_number, uint32_t ver
 		return NULL;
 	}
 
-	// If the class has no verb descriptors, return NULL.
-	if (!handling_class->command_verbs) {
-		return NULL;
-	}
-
-	// Iterate through the array of command verbs until we find a verb
-	// with a NULL handler.
-	for (verb = handling_class->command_verbs; verb->handler; ++verb) {
-		if (verb->verb_number == verb_number) {
-			return verb;
-		}
-	}
-
-	// If we couldn't find the relevant verb, return NULL.
-	return NULL;
+	return comms_find_verb_in_class(handling_class, verb_number);
 }
 
 
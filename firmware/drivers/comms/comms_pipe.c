@@ -0,0 +1,127 @@
+/*
+ * This file is part of libgreat
+ *
+ * High-level communications API -- pipes, which provide bulk streams of data
+ * to and from the host, outside of the command/response protocol.
+ */
+
+
+#include <debug.h>
+#include <errno.h>
+#include <stdbool.h>
+
+#include <drivers/comms.h>
+#include <drivers/comms_backend.h>
+
+/** Storage for each of our pipes. Pipes are never unregistered, so we allocate them in order. */
+static struct comms_pipe pipes[COMMS_MAX_PIPES];
+static uint32_t pipe_count = 0;
+
+
+/**
+ * Registers a pipe to be provided for a given class, which allows
+ * bulk bidirectional communications.
+ */
+struct comms_pipe *comms_register_pipe(struct comms_class *owning_class,
+        uint32_t flags, struct comms_pipe_ops ops)
+{
+	struct comms_pipe *pipe;
+
+	if (!owning_class) {
+		pr_error("comms: cannot register a pipe without an owning class!\n");
+		return NULL;
+	}
+
+	if (pipe_count >= COMMS_MAX_PIPES) {
+		pr_error("comms: cannot register a pipe for %s; all %d pipes are in use\n",
+				owning_class->name, COMMS_MAX_PIPES);
+		return NULL;
+	}
+
+	pipe = &pipes[pipe_count];
+
+	pipe->pipe_number = pipe_count;
+	pipe->owning_class = owning_class;
+	pipe->flags = flags;
+	pipe->ops = ops;
+	pipe->transport = NULL;
+	pipe->transport_data = NULL;
+
+	++pipe_count;
+	return pipe;
+}
+
+
+/**
+ * Attaches a transport to a registered pipe, making the pipe usable.
+ */
+int comms_backend_attach_pipe(struct comms_pipe *pipe, struct comms_pipe_transport *transport,
+	void *transport_data)
+{
+	if (!pipe || !transport) {
+		return EINVAL;
+	}
+
+	if (pipe->transport) {
+		pr_error("comms: cannot attach pipe %d to %s; it's already attached to %s\n",
+				pipe->pipe_number, transport->name, pipe->transport->name);
+		return EBUSY;
+	}
+
+	pipe->transport_data = transport_data;
+	pipe->transport = transport;
+	return 0;
+}
+
+
+/**
+ * @returns The pipe with the given number, or NULL if none exists.
+ */
+struct comms_pipe *comms_get_pipe_by_number(uint32_t pipe_number)
+{
+	if (pipe_number >= pipe_count) {
+		return NULL;
+	}
+
+	return &pipes[pipe_number];
+}
+
+
+/**
+ * @returns The number of pipes that have been registered.
+ */
+uint32_t comms_get_pipe_count(void)
+{
+	return pipe_count;
+}
+
+
+/**
+ * Transmits data on a given communications pipe.
+ */
+int comms_send_on_pipe(struct comms_pipe *pipe, void *data, uint32_t length)
+{
+	if (!pipe) {
+		return EINVAL;
+	}
+
+	// If we don't yet have a way to reach the host, we can't send anything.
+	if (!pipe->transport) {
+		return ENODEV;
+	}
+
+	return pipe->transport->transmit(pipe, data, length);
+}
+
+
+/**
+ * @return True iff the given comms pipe is ready for data transmission.
+ */
+bool comms_pipe_ready(struct comms_pipe *pipe)
+{
+	if (!pipe || !pipe->transport) {
+		return false;
+	}
+
+	return pipe->transport->ready(pipe);
+}
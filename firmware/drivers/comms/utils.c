@@ -7,7 +7,9 @@
 #include <string.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <errno.h>
 #include <drivers/comms.h>
+#include <drivers/comms_backend.h>
 #include <debug.h>
 
 /**
@@ -185,3 +187,57 @@ void *comms_response_add_raw(struct command_transaction *trans, void *data, uint
 	memcpy(buffer, data, length);
 	return buffer;
 }
+
+
+/**
+ * Provides the response to a command directly from a buffer owned by the handler.
+ * See the header for details.
+ */
+int comms_response_use_external_buffer(struct command_transaction *trans, void *data, uint32_t length,
+		comms_buffer_complete_callback complete)
+{
+	// The response is transmitted as a single block, so the external buffer has to be all of it.
+	if (trans->data_out_length || trans->data_out_external) {
+		pr_comms_error(trans, "cannot use an external buffer for a response that already has data\n");
+		return EBUSY;
+	}
+
+	if (length > trans->data_out_max_length) {
+		pr_comms_error(trans, "external response of %d bytes exceeds the maximum length of %d\n",
+				length, trans->data_out_max_length);
+		trans->data_out_status |= COMMS_PARSE_OVERRUN;
+		return EMSGSIZE;
+	}
+
+	trans->data_out_external = data;
+	trans->data_out_external_complete = complete;
+	trans->data_out_length = length;
+
+	// Ensure nothing else can be added to the response.
+	trans->data_out_max_length = length;
+
+	return 0;
+}
+
+
+/**
+ * Releases any external response buffer provided by the transaction's handler.
+ */
+void comms_backend_release_external_response(struct command_transaction *trans)
+{
+	void *data = trans->data_out_external;
+	comms_buffer_complete_callback complete = trans->data_out_external_complete;
+
+	if (!data) {
+		return;
+	}
+
+	// Clear the buffer out of the transaction before notifying the handler, so it
+	// can't be released twice.
+	trans->data_out_external = NULL;
+	trans->data_out_external_complete = NULL;
+
+	if (complete) {
+		complete(data, trans->data_out_length);
+	}
+}
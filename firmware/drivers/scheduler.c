@@ -3,15 +3,47 @@
  * This file is part of libgreat
  */
 
+#include <stddef.h>
+#include <stdbool.h>
+
 #include <toolchain.h>
+#include <scheduler.h>
 
-// TODO: implement task state, yielding, and magic?
+// TODO: implement task state, and magic?
 
 // Definitions that let us get at our list of tasks.
 typedef void (*task_implementation_t) (void);
 extern task_implementation_t __task_array_start, __task_array_end;
 
 
+/**
+ * Record of a task that's currently executing. Each lives on the stack of the scheduler round that's
+ * running the task; so, when tasks yield, these form a chain of every task that's yet to return.
+ */
+struct running_task {
+	task_implementation_t *task;
+	struct running_task *outer;
+};
+
+// The innermost running task, or NULL if no task is running.
+static struct running_task *running_tasks = NULL;
+
+
+/**
+ * @return True iff the given task is currently executing; i.e. it's yielded, or called something that yielded.
+ */
+static bool task_is_running(task_implementation_t *task)
+{
+	for (struct running_task *entry = running_tasks; entry; entry = entry->outer) {
+		if (entry->task == task) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
 
 /**
  * Runs a single iteration of each defined task (a single scheduler "round")
@@ -21,12 +53,30 @@ void scheduler_run_tasks(void)
 {
 	task_implementation_t *task;
 
-	// Execute each task in our list, once.
+	// Execute each task in our list, once. Tasks that are waiting on a yield are skipped; tasks aren't re-entrant.
 	for (task = &__task_array_start; task < &__task_array_end; task++) {
+		struct running_task entry = { .task = task, .outer = running_tasks };
+
+		if (task_is_running(task)) {
+			continue;
+		}
+
+		running_tasks = &entry;
 		(*task)();
+		running_tasks = entry.outer;
 	}
 }
 
+
+/**
+ * Lets the other tasks run while the current task waits on something; runs a single round of every task
+ * that isn't already running, and then returns. Must only be called from thread context.
+ */
+void scheduler_yield(void)
+{
+	scheduler_run_tasks();
+}
+
 /**
  * Runs our round-robin scheduler for as long as the device is alive; never returns.
  */
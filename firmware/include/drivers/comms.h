@@ -26,6 +26,16 @@ enum comms_parse_status {
     COMMS_PARSE_UNDERRUN = (1 << 0),
 };
 
+/**
+ * Callback used to let a command handler know that the backend is done with a buffer the
+ * handler provided; e.g. via comms_response_use_external_buffer().
+ *
+ * @param data The buffer that's no longer in use.
+ * @param length The length of the data in the buffer.
+ */
+typedef void (*comms_buffer_complete_callback)(void *data, uint32_t length);
+
+
 /**
  * Structure composing the objects for a given communication.
  */
@@ -71,6 +81,19 @@ struct command_transaction {
 	 */
 	uint32_t data_out_length;
 
+	/*
+	 * If non-NULL, the response is transmitted directly from this buffer, rather than
+	 * being copied into data_out; data_out_length holds its length.
+	 * Set by comms_response_use_external_buffer().
+	 */
+	void *data_out_external;
+
+	/*
+	 * Called once the backend no longer needs data_out_external, or NULL if the
+	 * handler doesn't need to know.
+	 */
+	comms_buffer_complete_callback data_out_external_complete;
+
 
     /**
      * State tracking for parsing of command responses.
@@ -144,6 +167,19 @@ struct comms_pipe_ops {
 };
 
 
+/**
+ * Flags that describe a verb's behavior to the host; see struct comms_verb.
+ */
+enum comms_verb_flags {
+
+	/**
+	 * The verb has no side effects, and its response depends only on its arguments -- and never changes
+	 * until the device is reset. Hosts may answer repeated calls from a cache, without contacting the device.
+	 */
+	COMMS_VERB_FLAG_CACHEABLE = (1 << 0),
+};
+
+
 /**
  * Data structure that describes a standard communication verb.
  */
@@ -170,6 +206,10 @@ struct comms_verb {
     char *in_param_names;
     char *out_param_names;
 
+    /* Flags describing the verb's behavior to the host; a bitwise OR of
+     * enum comms_verb_flags values. Optional; zero if not provided. */
+    uint32_t flags;
+
 	/* The command handler -- must be non-NULL for
 	 * any non-sentinel (termianator) verb. */
 	command_handler_function handler;
@@ -225,15 +265,73 @@ struct comms_class {
 	 */
 	struct comms_class *next;
 
+	/**
+	 * The number of leading entries in command_verbs whose verb number matches
+	 * their index in the array. Verbs in this range can be dispatched by index,
+	 * rather than by searching. Populated by comms_register_class(); essentially private.
+	 */
+	uint32_t dense_verb_count;
+
 	/** TODO: pipe objects */
 };
 
 
+/**
+ * The maximum number of pipes that can be registered. Pipes are allocated statically,
+ * so this can be overridden by the board if more (or fewer) are needed.
+ */
+#ifndef COMMS_MAX_PIPES
+#define COMMS_MAX_PIPES 4
+#endif
+
+/**
+ * Size of the class dispatch table, as a power of two. This bounds the number of classes that can be
+ * registered; and should comfortably exceed it, so lookups stay short. The table is allocated statically,
+ * so this can be overridden by the board if more classes are needed.
+ */
+#ifndef COMMS_CLASS_TABLE_ORDER
+#define COMMS_CLASS_TABLE_ORDER 6
+#endif
+
+struct comms_pipe_transport;
+
 /**
  * Object describing a communications pipe.
  */
 struct comms_pipe {
 
+	/**
+	 * The number of the given pipe, which is used by the host to locate it.
+	 * Assigned in registration order.
+	 */
+	uint32_t pipe_number;
+
+	/**
+	 * The class that owns this pipe.
+	 */
+	struct comms_class *owning_class;
+
+	/**
+	 * Flags describing how this pipe is to operate; as passed to comms_register_pipe().
+	 */
+	uint32_t flags;
+
+	/**
+	 * The operations supported by this pipe; used to notify the pipe's owner of
+	 * events on the pipe. Any operation can be NULL if its event isn't of interest.
+	 */
+	struct comms_pipe_ops ops;
+
+	/**
+	 * The transport (e.g. a pair of USB bulk endpoints) that carries this pipe's data,
+	 * or NULL if the pipe hasn't yet been attached to one. See comms_backend_attach_pipe().
+	 */
+	struct comms_pipe_transport *transport;
+
+	/**
+	 * Transport-specific state for the given pipe.
+	 */
+	void *transport_data;
 };
 
 
@@ -242,6 +340,9 @@ struct comms_pipe {
  * Registers a given class for use with libgreat; which implicitly provides it
  * with an ability to handle commands.
  *
+ * Each board can register at most (1 << COMMS_CLASS_TABLE_ORDER) classes; any more are rejected,
+ * with an error.
+ *
  * @param comms_class The comms class to be registered. This object will continue
  *	to be held indefinition, so it must be permanently allocated.
  */
@@ -280,6 +381,9 @@ const char *comms_get_handler_name(uint32_t class_number, uint32_t verb_number,
  * @param ops -- A structure defining the operations this pipe supports.
  *
  * @returns a comms_pipe object on success; or NULL on failure
+ *
+ * The pipe can be used once the platform has attached a transport to it;
+ * until then, comms_pipe_ready() will return false.
  */
 struct comms_pipe *comms_register_pipe(struct comms_class *owning_class,
         uint32_t flags, struct comms_pipe_ops ops);
@@ -291,6 +395,10 @@ struct comms_pipe *comms_register_pipe(struct comms_class *owning_class,
  * @param pipe The pipe on which to transmit.
  * @param data Buffer storing the data to be transmitted.
  * @param length The length of the data to be transmitted.
+ *
+ * @return 0 if the data was queued for transmission, or an error number on failure.
+ *      The data must remain valid until the pipe's handle_data_out_complete operation
+ *      is called for it.
  */
 int comms_send_on_pipe(struct comms_pipe *pipe, void *data, uint32_t length);
 
@@ -406,6 +514,25 @@ void *comms_response_reserve_space(struct command_transaction *trans, uint32_t s
 void *comms_response_add_raw(struct command_transaction *trans, void *data, uint32_t length);
 
 
+/**
+ * Provides the response to a command directly from a buffer owned by the handler, rather than
+ * copying it into the response; which lets backends (e.g. USB) transmit straight from the source memory.
+ * The buffer must hold the entire response: no other response data can be added before or after it.
+ *
+ * @param trans The associated transaction.
+ * @param data The buffer containing the response. Must remain valid and unchanged until the
+ *      complete callback is called.
+ * @param length The length of the response.
+ * @param complete Called once the backend no longer needs the buffer; whether or not the response was
+ *      sent. May be called from interrupt context. Can be NULL if the buffer is never reused.
+ *
+ * @return 0 on success, or an error number if the buffer can't be used; in which case the
+ *      complete callback will not be called.
+ */
+int comms_response_use_external_buffer(struct command_transaction *trans, void *data, uint32_t length,
+		comms_buffer_complete_callback complete);
+
+
 /**
  * @return the total amount of space remaining for response arguments
  */
@@ -5,10 +5,15 @@
  * the standard communications protocol.
  */
 
-#include <drivers/usb/usb_type.h>
-#include <drivers/usb/usb_request.h>
+#ifndef __LIBGREAT_COMMS_BACKEND_DRIVER_H__
+#define __LIBGREAT_COMMS_BACKEND_DRIVER_H__
+
+#include <stdint.h>
+#include <stdbool.h>
 #include <toolchain.h>
 
+#include <drivers/comms.h>
+
 /**
  * Core communications driver for libgreat.
  */
@@ -28,6 +33,40 @@ struct ATTR_PACKED libgreat_command_prelude {
 };
 
 
+/**
+ * Structure that precedes each command in a batch of commands. See comms_backend_submit_batch().
+ */
+struct ATTR_PACKED libgreat_batch_command_header {
+	uint32_t class_number;
+	uint32_t verb;
+
+	/* The length of the arguments that follow this header. */
+	uint32_t length;
+
+	/* The maximum amount of response data the host will accept for this command. */
+	uint32_t max_response_length;
+};
+
+
+/**
+ * Structure that precedes each command's response in the response to a batch of commands.
+ */
+struct ATTR_PACKED libgreat_batch_response_header {
+
+	/* The result of executing the command; zero on success, or an error number. */
+	uint32_t status;
+
+	/* The length of the response data that follows this header. */
+	uint32_t length;
+};
+
+/**
+ * Each entry in a batch -- command or response -- is padded so the next header starts on a four-byte boundary.
+ * This keeps each command's arguments and responses aligned, as they would be for individual commands.
+ */
+#define LIBGREAT_BATCH_PADDED_LENGTH(length) (((length) + 3) & ~3UL)
+
+
 /**
  * Submits a command for execution. Used by command backends.
  *
@@ -39,6 +78,36 @@ int comms_backend_submit_command(struct comm_backend_driver *backend,
 	struct command_transaction *trans);
 
 
+/**
+ * Submits a batch of commands for execution. Used by command backends that allow
+ * the host to issue several commands in a single exchange.
+ *
+ * The transaction's input should contain a sequence of libgreat_batch_command_header
+ * structures, each followed by its (padded) arguments. Commands are executed in order; the
+ * transaction's output is populated with a libgreat_batch_response_header and (padded) response
+ * for each command executed. Execution stops after the first command that fails, or once
+ * there's no more room in the response for another result.
+ *
+ * @param backend The command backend driver submitting the given batch.
+ * @param trans An object representing the batch to be submitted, and its response.
+ *
+ * @return 0 if the batch was well-formed, or an error code if it couldn't be parsed. Errors
+ *		from individual commands are reported in their response headers.
+ */
+int comms_backend_submit_batch(struct comm_backend_driver *backend,
+	struct command_transaction *trans);
+
+
+/**
+ * Releases any external response buffer provided by the transaction's handler, notifying the handler
+ * that it's no longer in use. Backends must call this once they've finished transmitting a transaction's
+ * response, or once they know it won't be transmitted. Safe to call on any transaction.
+ *
+ * @param trans The transaction whose response is no longer needed.
+ */
+void comms_backend_release_external_response(struct command_transaction *trans);
+
+
 /**
  * @returns The comms_class object with the given number, or
  *		NULL if none exists.
@@ -50,3 +119,59 @@ struct comms_class *comms_get_class_by_number(uint32_t class_number);
  * @returns the verb description for the given class and verb number
  */
 struct comms_verb *comms_get_object_for_verb(uint32_t class_number, uint32_t verb_number);
+
+
+/**
+ * Structure describing a transport that can carry the data for comms pipes;
+ * e.g. a pair of USB bulk endpoints. Provided by platform backends.
+ */
+struct comms_pipe_transport {
+
+	/** The name of the transport, for e.g. logging. */
+	char *name;
+
+	/**
+	 * Queues data for transmission to the host. See comms_send_on_pipe().
+	 *
+	 * @return 0 on success, or an error number on failure
+	 */
+	int (*transmit)(struct comms_pipe *pipe, void *data, uint32_t length);
+
+	/**
+	 * @return True iff the given pipe can accept data for transmission.
+	 */
+	bool (*ready)(struct comms_pipe *pipe);
+
+	/**
+	 * @return A transport-specific value that tells the host how to reach the given pipe;
+	 *		e.g. the addresses of the pipe's USB endpoints.
+	 */
+	uint32_t (*get_address)(struct comms_pipe *pipe);
+};
+
+
+/**
+ * Attaches a transport to a registered pipe, making the pipe usable.
+ *
+ * @param pipe The pipe to be attached.
+ * @param transport The transport that will carry the pipe's data. Must be permanently allocated.
+ * @param transport_data Transport-specific state for the pipe, which will be stored in the pipe.
+ *
+ * @return 0 on success, or an error number on failure
+ */
+int comms_backend_attach_pipe(struct comms_pipe *pipe, struct comms_pipe_transport *transport,
+	void *transport_data);
+
+
+/**
+ * @returns The pipe with the given number, or NULL if none exists.
+ */
+struct comms_pipe *comms_get_pipe_by_number(uint32_t pipe_number);
+
+
+/**
+ * @returns The number of pipes that have been registered.
+ */
+uint32_t comms_get_pipe_count(void);
+
+#endif
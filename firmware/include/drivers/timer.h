@@ -63,6 +63,16 @@ uint32_t get_time(void);
 uint32_t get_time_since(uint32_t base);
 
 
+/**
+ * Arranges for the core to be woken -- e.g. from a WFE -- once get_time() reaches the given deadline, even if
+ * nothing else happens first. Code that sleeps while waiting with a timeout should arm this before sleeping.
+ *
+ * @return True iff a wakeup was scheduled. No wakeup occurs if the deadline has already passed, or if the
+ *		platform timer isn't running; so callers should poll rather than sleep.
+ */
+bool schedule_wakeup(uint32_t deadline);
+
+
 /**
  * Function that should be called whenever the platform timer's basis changes.
  * FIXME: remove this!
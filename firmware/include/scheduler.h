@@ -17,6 +17,12 @@
  */
 void scheduler_run_tasks(void);
 
+/**
+ * Lets the other tasks run while the current task waits on something; runs a single round of every task
+ * that isn't already running, and then returns. Must only be called from thread context.
+ */
+void scheduler_yield(void);
+
 /**
  * Runs our round-robin scheduler for as long as the device is alive; never returns.
  */
@@ -0,0 +1,456 @@
+/*
+ * This file is part of libgreat
+ *
+ * Host benchmark driver for libgreat's portable core -- times command dispatch, argument parsing
+ * and response generation, batches, the allocator and the scheduler, so performance can be measured
+ * (and regressions caught) on a workstation. Dispatch is also timed as the number of registered classes
+ * grows towards the capacity of the class dispatch table.
+ *
+ * Usage: libgreat_benchmark [iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include <debug.h>
+#include <errno.h>
+#include <toolchain.h>
+#include <scheduler.h>
+
+#include <drivers/comms.h>
+#include <drivers/comms_backend.h>
+#include <drivers/memory/allocator.h>
+
+/** A class number well clear of any real class; used for our benchmark verbs. */
+#define CLASS_NUMBER_BENCHMARK 0xFFFE
+
+/** The first class number used by the classes registered to benchmark class lookup. */
+#define CLASS_NUMBER_DISPATCH_BASE 0x8000
+
+#define BENCHMARK_DEFAULT_ITERATIONS (1000000)
+#define BENCHMARK_BUFFER_SIZE        (4096)
+
+/**
+ * The most classes we register to benchmark class lookup; enough to fill three quarters of the class
+ * dispatch table, leaving room for the core's own classes.
+ */
+#define DISPATCH_BENCHMARK_MAX_CLASSES ((1 << COMMS_CLASS_TABLE_ORDER) * 3 / 4)
+
+/** The number of verbs in each of the dense and sparse halves of the dispatch benchmark's classes. */
+#define DISPATCH_BENCHMARK_VERBS       (8)
+
+static struct comm_backend_driver host_backend = {
+	.name = "host",
+};
+
+/** Buffers that stand in for a backend's command and response buffers. */
+static uint8_t data_in_buffer[BENCHMARK_BUFFER_SIZE] ATTR_ALIGNED(4);
+static uint8_t data_out_buffer[BENCHMARK_BUFFER_SIZE] ATTR_ALIGNED(4);
+
+/** Count of scheduler task executions, so the task's work can't be optimized away. */
+static volatile uint32_t task_runs;
+
+
+static int verb_noop(struct command_transaction *trans)
+{
+	(void)trans;
+	return 0;
+}
+
+
+static int verb_echo(struct command_transaction *trans)
+{
+	uint32_t value = comms_argument_parse_uint32_t(trans);
+
+	comms_response_add_uint32_t(trans, value);
+	return 0;
+}
+
+
+static int verb_sum(struct command_transaction *trans)
+{
+	uint32_t sum = 0;
+
+	while (trans->data_in_remaining >= sizeof(uint32_t)) {
+		sum += comms_argument_parse_uint32_t(trans);
+	}
+
+	comms_response_add_uint32_t(trans, sum);
+	return 0;
+}
+
+
+static int verb_fill(struct command_transaction *trans)
+{
+	uint32_t length = comms_argument_parse_uint32_t(trans);
+	void *response = comms_response_reserve_space(trans, length);
+
+	if (!response) {
+		return EINVAL;
+	}
+
+	memset(response, 0xAA, length);
+	return 0;
+}
+
+
+static struct comms_verb _verbs[] = {
+		{ .name = "noop", .handler = verb_noop, .in_signature = "", .out_signature = "",
+          .doc = "Does nothing; measures dispatch overhead." },
+		{ .name = "echo", .handler = verb_echo, .in_signature = "<I", .out_signature = "<I",
+          .doc = "Returns its argument." },
+		{ .name = "sum", .handler = verb_sum, .in_signature = "<*I", .out_signature = "<I",
+          .doc = "Returns the sum of its arguments." },
+		{ .name = "fill", .handler = verb_fill, .in_signature = "<I", .out_signature = "<*B",
+          .doc = "Returns a response of the given length." },
+		{} // Sentinel
+};
+COMMS_DEFINE_SIMPLE_CLASS(benchmark, CLASS_NUMBER_BENCHMARK, "benchmark", _verbs,
+        "Verbs used to benchmark the host build of libgreat.");
+
+
+/**
+ * Verbs shared by the classes registered to benchmark class lookup. The first half are numbered
+ * densely, so they can be dispatched by index; the second half are numbered sparsely, and must be searched for.
+ */
+#define DENSE_VERB(n)  { .verb_number = (n), .name = "dense", .handler = verb_noop, \
+	.in_signature = "", .out_signature = "" }
+#define SPARSE_VERB(n) { .verb_number = ((n) + 1) << 8, .name = "sparse", .handler = verb_noop, \
+	.in_signature = "", .out_signature = "" }
+
+static struct comms_verb dispatch_verbs[] = {
+		DENSE_VERB(0), DENSE_VERB(1), DENSE_VERB(2), DENSE_VERB(3),
+		DENSE_VERB(4), DENSE_VERB(5), DENSE_VERB(6), DENSE_VERB(7),
+		SPARSE_VERB(0), SPARSE_VERB(1), SPARSE_VERB(2), SPARSE_VERB(3),
+		SPARSE_VERB(4), SPARSE_VERB(5), SPARSE_VERB(6), SPARSE_VERB(7),
+		{} // Sentinel
+};
+
+static struct comms_class dispatch_classes[DISPATCH_BENCHMARK_MAX_CLASSES];
+static char dispatch_class_names[DISPATCH_BENCHMARK_MAX_CLASSES][20];
+static uint32_t dispatch_classes_registered;
+
+
+static void benchmark_task(void)
+{
+	task_runs++;
+}
+DEFINE_TASK(benchmark_task);
+
+
+/**
+ * @return The current time, in nanoseconds, from a monotonic clock.
+ */
+static uint64_t current_time_ns(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return ((uint64_t)now.tv_sec * 1000000000ULL) + (uint64_t)now.tv_nsec;
+}
+
+
+/**
+ * @return The processor's cycle count, where the host has a cycle counter we can cheaply read; or zero.
+ */
+static uint64_t current_cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+
+static void report(const char *name, uint64_t start_time, uint32_t iterations)
+{
+	uint64_t elapsed = current_time_ns() - start_time;
+	printf("%-28s %10u iterations %12.1f ns/iteration\n", name, iterations, (double)elapsed / iterations);
+}
+
+
+static void report_with_cycles(const char *name, uint64_t start_time, uint64_t start_cycles, uint32_t iterations)
+{
+	uint64_t elapsed = current_time_ns() - start_time;
+	uint64_t cycles = current_cycles() - start_cycles;
+
+	printf("%-28s %10u iterations %12.1f ns/iteration", name, iterations, (double)elapsed / iterations);
+	if (cycles) {
+		printf(" %10.1f cycles/iteration", (double)cycles / iterations);
+	}
+	printf("\n");
+}
+
+
+/**
+ * Resets a transaction to carry a new command, as a backend would before submitting it.
+ */
+static void prepare_transaction(struct command_transaction *trans, uint32_t class_number, uint32_t verb,
+	uint32_t data_in_length)
+{
+	trans->class_number = class_number;
+	trans->verb = verb;
+
+	trans->data_in = data_in_buffer;
+	trans->data_in_length = data_in_length;
+	trans->data_in_position = data_in_buffer;
+	trans->data_in_remaining = data_in_length;
+	trans->data_in_status = COMMS_PARSE_OKAY;
+
+	trans->data_out = data_out_buffer;
+	trans->data_out_max_length = sizeof(data_out_buffer);
+	trans->data_out_length = 0;
+	trans->data_out_position = data_out_buffer;
+	trans->data_out_status = COMMS_PARSE_OKAY;
+	trans->data_out_external = NULL;
+	trans->data_out_external_complete = NULL;
+
+	trans->last_error_number = 0;
+}
+
+
+/**
+ * Submits a single command, as prepared by prepare_transaction, the given number of times.
+ */
+static void benchmark_command(const char *name, uint32_t class_number, uint32_t verb,
+	uint32_t data_in_length, uint32_t iterations)
+{
+	int rc;
+	uint32_t i;
+	struct command_transaction trans;
+	uint64_t start_time = current_time_ns();
+
+	for (i = 0; i < iterations; ++i) {
+		prepare_transaction(&trans, class_number, verb, data_in_length);
+
+		rc = comms_backend_submit_command(&host_backend, &trans);
+		if (rc) {
+			pr_error("benchmark: %s failed (%d)\n", name, rc);
+			exit(rc);
+		}
+	}
+
+	report(name, start_time, iterations);
+}
+
+
+static void benchmark_dispatch(uint32_t iterations)
+{
+	benchmark_command("dispatch (noop)", CLASS_NUMBER_BENCHMARK, 0, 0, iterations);
+
+	// The core class's board-information verbs are weak stubs on the host; so use its class listing.
+	benchmark_command("dispatch (core classes)", 0, 4, 0, iterations);
+}
+
+
+/**
+ * Registers further classes for the class lookup benchmark, until the given number are registered.
+ * Classes can't be unregistered; so each step of the benchmark builds on the last.
+ */
+static void register_dispatch_classes(uint32_t count)
+{
+	while (dispatch_classes_registered < count) {
+		struct comms_class *cls = &dispatch_classes[dispatch_classes_registered];
+
+		snprintf(dispatch_class_names[dispatch_classes_registered], sizeof(dispatch_class_names[0]),
+			"dispatch%u", dispatch_classes_registered);
+
+		cls->class_number = CLASS_NUMBER_DISPATCH_BASE + dispatch_classes_registered;
+		cls->name = dispatch_class_names[dispatch_classes_registered];
+		cls->command_verbs = dispatch_verbs;
+		comms_register_class(cls);
+
+		++dispatch_classes_registered;
+	}
+}
+
+
+/**
+ * Dispatches commands round-robin across the registered dispatch benchmark classes, and each of
+ * their dense or sparse verbs.
+ */
+static void benchmark_class_lookup(const char *name, bool sparse, uint32_t iterations)
+{
+	int rc;
+	uint32_t i;
+	struct command_transaction trans;
+	uint64_t start_time = current_time_ns();
+	uint64_t start_cycles = current_cycles();
+
+	for (i = 0; i < iterations; ++i) {
+		uint32_t class_number = CLASS_NUMBER_DISPATCH_BASE + (i % dispatch_classes_registered);
+		uint32_t verb = (i / dispatch_classes_registered) % DISPATCH_BENCHMARK_VERBS;
+
+		if (sparse) {
+			verb = (verb + 1) << 8;
+		}
+
+		prepare_transaction(&trans, class_number, verb, 0);
+
+		rc = comms_backend_submit_command(&host_backend, &trans);
+		if (rc) {
+			pr_error("benchmark: %s failed (%d)\n", name, rc);
+			exit(rc);
+		}
+	}
+
+	report_with_cycles(name, start_time, start_cycles, iterations);
+}
+
+
+static void benchmark_class_count_scaling(uint32_t iterations)
+{
+	char name[32];
+	const uint32_t class_counts[] = { 1, 16, DISPATCH_BENCHMARK_MAX_CLASSES / 2, DISPATCH_BENCHMARK_MAX_CLASSES };
+
+	for (unsigned int i = 0; i < sizeof(class_counts) / sizeof(class_counts[0]); ++i) {
+		register_dispatch_classes(class_counts[i]);
+
+		snprintf(name, sizeof(name), "dispatch (%u cls, dense)", class_counts[i]);
+		benchmark_class_lookup(name, false, iterations);
+
+		snprintf(name, sizeof(name), "dispatch (%u cls, sparse)", class_counts[i]);
+		benchmark_class_lookup(name, true, iterations);
+	}
+}
+
+
+static void benchmark_arguments(uint32_t iterations)
+{
+	uint32_t value = 0x12345678;
+	uint32_t i;
+
+	memcpy(data_in_buffer, &value, sizeof(value));
+	benchmark_command("parse/respond (echo)", CLASS_NUMBER_BENCHMARK, 1, sizeof(value), iterations);
+
+	for (i = 0; i < 256; ++i) {
+		memcpy(&data_in_buffer[i * sizeof(uint32_t)], &i, sizeof(uint32_t));
+	}
+	benchmark_command("parse (256 x uint32)", CLASS_NUMBER_BENCHMARK, 2, 256 * sizeof(uint32_t), iterations / 16);
+
+	value = BENCHMARK_BUFFER_SIZE;
+	memcpy(data_in_buffer, &value, sizeof(value));
+	benchmark_command("respond (4 KiB)", CLASS_NUMBER_BENCHMARK, 3, sizeof(value), iterations / 16);
+}
+
+
+static void benchmark_batch(uint32_t iterations)
+{
+	int rc;
+	uint32_t i;
+	uint32_t length = 0;
+	struct command_transaction trans;
+	uint64_t start_time;
+
+	const uint32_t commands_per_batch = 16;
+
+	// Build a batch of echo commands; each of which is a header followed by a single argument.
+	for (i = 0; i < commands_per_batch; ++i) {
+		struct libgreat_batch_command_header header = {
+			.class_number = CLASS_NUMBER_BENCHMARK,
+			.verb = 1,
+			.length = sizeof(uint32_t),
+			.max_response_length = sizeof(uint32_t),
+		};
+
+		memcpy(&data_in_buffer[length], &header, sizeof(header));
+		length += sizeof(header);
+		memcpy(&data_in_buffer[length], &i, sizeof(i));
+		length += sizeof(i);
+	}
+
+	start_time = current_time_ns();
+	for (i = 0; i < iterations; ++i) {
+		prepare_transaction(&trans, 0, 0, length);
+
+		rc = comms_backend_submit_batch(&host_backend, &trans);
+		if (rc) {
+			pr_error("benchmark: batch failed (%d)\n", rc);
+			exit(rc);
+		}
+	}
+
+	report("batch (16 x echo)", start_time, iterations);
+}
+
+
+static void benchmark_allocator(uint32_t iterations)
+{
+	uint32_t i, j;
+	void *blocks[16];
+	uint64_t start_time = current_time_ns();
+
+	// Simple allocate / free pairs.
+	for (i = 0; i < iterations; ++i) {
+		void *block = umm_malloc(64);
+		umm_free(block);
+	}
+	report("allocator (malloc/free 64)", start_time, iterations);
+
+	// Interleaved allocations of varying sizes, freed out of order; which exercises coalescing.
+	start_time = current_time_ns();
+	for (i = 0; i < iterations / 16; ++i) {
+		for (j = 0; j < 16; ++j) {
+			blocks[j] = umm_malloc(16 + (j * 48));
+		}
+		for (j = 0; j < 16; j += 2) {
+			umm_free(blocks[j]);
+		}
+		for (j = 1; j < 16; j += 2) {
+			umm_free(blocks[j]);
+		}
+	}
+	report("allocator (16 mixed blocks)", start_time, iterations / 16);
+}
+
+
+static void benchmark_scheduler(uint32_t iterations)
+{
+	uint32_t i;
+	uint64_t start_time = current_time_ns();
+
+	for (i = 0; i < iterations; ++i) {
+		scheduler_run_tasks();
+	}
+
+	report("scheduler (round)", start_time, iterations);
+
+	if (task_runs != iterations) {
+		pr_error("benchmark: scheduler ran its task %u times; expected %u\n", task_runs, iterations);
+		exit(EIO);
+	}
+}
+
+
+int main(int argc, char *argv[])
+{
+	uint32_t iterations = BENCHMARK_DEFAULT_ITERATIONS;
+
+	if (argc > 1) {
+		iterations = strtoul(argv[1], NULL, 0);
+	}
+
+	if (iterations < 16) {
+		fprintf(stderr, "usage: %s [iterations >= 16]\n", argv[0]);
+		return EINVAL;
+	}
+
+	benchmark_dispatch(iterations);
+	benchmark_arguments(iterations);
+	benchmark_batch(iterations);
+	benchmark_allocator(iterations);
+	benchmark_scheduler(iterations);
+
+	// This registers classes, which can't be unregistered, and fills much of the class dispatch table;
+	// so it runs last, to avoid skewing the other benchmarks.
+	benchmark_class_count_scaling(iterations);
+
+	return 0;
+}
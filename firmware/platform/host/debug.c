@@ -0,0 +1,9 @@
+/*
+ * This file is part of libgreat
+ *
+ * Host stand-in for the board's debug logging support.
+ */
+
+#include <debug.h>
+
+loglevel_t libgreat_host_log_level = LOGLEVEL_WARNING;
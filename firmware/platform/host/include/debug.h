@@ -0,0 +1,53 @@
+/*
+ * This file is part of libgreat
+ *
+ * Host stand-in for the debug logging API, which is normally provided by the board firmware.
+ * Messages are written to stderr, if they're at least as important as libgreat_host_log_level.
+ */
+
+#ifndef __LIBGREAT_HOST_DEBUG_H__
+#define __LIBGREAT_HOST_DEBUG_H__
+
+#include <stdio.h>
+
+/**
+ * Log levels, in decreasing order of importance.
+ */
+typedef enum {
+	LOGLEVEL_EMERGENCY = 0,
+	LOGLEVEL_ALERT     = 1,
+	LOGLEVEL_CRITICAL  = 2,
+	LOGLEVEL_ERROR     = 3,
+	LOGLEVEL_WARNING   = 4,
+	LOGLEVEL_NOTICE    = 5,
+	LOGLEVEL_INFO      = 6,
+	LOGLEVEL_DEBUG     = 7,
+	LOGLEVEL_TRACE     = 8,
+} loglevel_t;
+
+
+/**
+ * The least important level of message that will be printed. Defaults to LOGLEVEL_WARNING,
+ * so debug chatter doesn't drown out (or slow down) benchmarks.
+ */
+extern loglevel_t libgreat_host_log_level;
+
+
+#define pr_at_level(level, ...) \
+	do { \
+		if ((level) <= libgreat_host_log_level) { \
+			fprintf(stderr, __VA_ARGS__); \
+		} \
+	} while (0)
+
+#define pr_emergency(...)  pr_at_level(LOGLEVEL_EMERGENCY, __VA_ARGS__)
+#define pr_alert(...)      pr_at_level(LOGLEVEL_ALERT,     __VA_ARGS__)
+#define pr_critical(...)   pr_at_level(LOGLEVEL_CRITICAL,  __VA_ARGS__)
+#define pr_error(...)      pr_at_level(LOGLEVEL_ERROR,     __VA_ARGS__)
+#define pr_warning(...)    pr_at_level(LOGLEVEL_WARNING,   __VA_ARGS__)
+#define pr_notice(...)     pr_at_level(LOGLEVEL_NOTICE,    __VA_ARGS__)
+#define pr_info(...)       pr_at_level(LOGLEVEL_INFO,      __VA_ARGS__)
+#define pr_debug(...)      pr_at_level(LOGLEVEL_DEBUG,     __VA_ARGS__)
+#define pr_trace(...)      pr_at_level(LOGLEVEL_TRACE,     __VA_ARGS__)
+
+#endif
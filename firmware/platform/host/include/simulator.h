@@ -0,0 +1,45 @@
+/*
+ * This file is part of libgreat
+ *
+ * Simulator backend to the libgreat communications API -- lets host software execute commands
+ * against the real communications core, built into a shared library, without any hardware.
+ */
+
+#ifndef __LIBGREAT_SIMULATOR_H__
+#define __LIBGREAT_SIMULATOR_H__
+
+#include <stdint.h>
+
+/** The largest command or response the simulator accepts; matches the USB backend. */
+#define LIBGREAT_SIMULATOR_BUFFER_SIZE (4096)
+
+
+/**
+ * Executes a single command.
+ *
+ * @param class_number The class number for the command.
+ * @param verb The verb number for the command.
+ * @param data_in The command's arguments; may be NULL if data_in_length is zero.
+ * @param data_in_length The length of the command's arguments. At most LIBGREAT_SIMULATOR_BUFFER_SIZE.
+ * @param data_out Buffer that accepts the command's response.
+ * @param data_out_max_length The size of the response buffer.
+ * @param data_out_length Out argument; accepts the length of the command's response.
+ *
+ * @return 0 on success, or the error number produced by the command.
+ */
+int libgreat_simulator_execute_command(uint32_t class_number, uint32_t verb,
+	void const *data_in, uint32_t data_in_length,
+	void *data_out, uint32_t data_out_max_length, uint32_t *data_out_length);
+
+
+/**
+ * Executes a batch of commands; see comms_backend_submit_batch() for the batch format.
+ *
+ * Parameters are as for libgreat_simulator_execute_command().
+ *
+ * @return 0 if the batch was well-formed, or an error number if it couldn't be parsed.
+ */
+int libgreat_simulator_execute_batch(void const *data_in, uint32_t data_in_length,
+	void *data_out, uint32_t data_out_max_length, uint32_t *data_out_length);
+
+#endif
@@ -0,0 +1,26 @@
+/*
+ * This file is part of libgreat
+ *
+ * Host wrapper for the system's string.h, which fills in the BSD extensions libgreat
+ * expects of its C library, but that some host C libraries (e.g. older glibc) lack.
+ */
+
+#include_next <string.h>
+
+#ifndef __LIBGREAT_HOST_STRING_H__
+#define __LIBGREAT_HOST_STRING_H__
+
+#ifdef LIBGREAT_HOST_PROVIDE_STRLCPY
+#include <stddef.h>
+
+/**
+ * Copies a NUL-terminated string into a buffer of the given size, truncating it if necessary.
+ * The result is always NUL-terminated, unless size is zero.
+ *
+ * @return The length of src; so truncation has occurred iff the return value is >= size.
+ */
+size_t strlcpy(char *dst, const char *src, size_t size);
+
+#endif
+
+#endif
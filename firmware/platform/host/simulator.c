@@ -0,0 +1,127 @@
+/*
+ * This file is part of libgreat
+ *
+ * Simulator backend to the libgreat communications API. Built into a shared library,
+ * which host software (e.g. pygreat's simulator backend) loads to run commands.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include <drivers/comms.h>
+#include <drivers/comms_backend.h>
+#include <simulator.h>
+
+static struct comm_backend_driver simulator_backend = {
+	.name = "simulator",
+};
+
+/** Stand-ins for a backend's command and response buffers. */
+static uint8_t simulator_data_in_buffer[LIBGREAT_SIMULATOR_BUFFER_SIZE] ATTR_ALIGNED(4);
+static uint8_t simulator_data_out_buffer[LIBGREAT_SIMULATOR_BUFFER_SIZE] ATTR_ALIGNED(4);
+
+
+/**
+ * Sets up a transaction to carry a command, as a hardware backend would on receiving one.
+ */
+static int simulator_prepare_transaction(struct command_transaction *trans, uint32_t class_number,
+	uint32_t verb, void const *data_in, uint32_t data_in_length, uint32_t data_out_max_length)
+{
+	if (data_in_length > sizeof(simulator_data_in_buffer)) {
+		return EMSGSIZE;
+	}
+
+	// Commands are executed from our own buffers; so handlers see the same alignment they would on hardware.
+	if (data_in_length) {
+		memcpy(simulator_data_in_buffer, data_in, data_in_length);
+	}
+
+	if (data_out_max_length > sizeof(simulator_data_out_buffer)) {
+		data_out_max_length = sizeof(simulator_data_out_buffer);
+	}
+
+	memset(trans, 0, sizeof(*trans));
+	trans->class_number        = class_number;
+	trans->verb                = verb;
+	trans->data_in             = simulator_data_in_buffer;
+	trans->data_in_length      = data_in_length;
+	trans->data_in_position    = simulator_data_in_buffer;
+	trans->data_in_remaining   = data_in_length;
+	trans->data_out            = simulator_data_out_buffer;
+	trans->data_out_max_length = data_out_max_length;
+	trans->data_out_position   = simulator_data_out_buffer;
+
+	return 0;
+}
+
+
+/**
+ * Copies a transaction's response out to the caller, and releases any buffer it was provided in.
+ */
+static void simulator_copy_response(struct command_transaction *trans, void *data_out, uint32_t *data_out_length)
+{
+	void *response = trans->data_out_external ? trans->data_out_external : trans->data_out;
+
+	memcpy(data_out, response, trans->data_out_length);
+	*data_out_length = trans->data_out_length;
+
+	comms_backend_release_external_response(trans);
+}
+
+
+/**
+ * Executes a single command. See simulator.h.
+ */
+int libgreat_simulator_execute_command(uint32_t class_number, uint32_t verb,
+	void const *data_in, uint32_t data_in_length,
+	void *data_out, uint32_t data_out_max_length, uint32_t *data_out_length)
+{
+	int rc;
+	struct command_transaction trans;
+
+	*data_out_length = 0;
+
+	rc = simulator_prepare_transaction(&trans, class_number, verb, data_in, data_in_length, data_out_max_length);
+	if (rc) {
+		return rc;
+	}
+
+	rc = comms_backend_submit_command(&simulator_backend, &trans);
+
+	// As with the USB backend, failed commands don't produce a response.
+	if (rc) {
+		comms_backend_release_external_response(&trans);
+		return rc;
+	}
+
+	simulator_copy_response(&trans, data_out, data_out_length);
+	return 0;
+}
+
+
+/**
+ * Executes a batch of commands. See simulator.h.
+ */
+int libgreat_simulator_execute_batch(void const *data_in, uint32_t data_in_length,
+	void *data_out, uint32_t data_out_max_length, uint32_t *data_out_length)
+{
+	int rc;
+	struct command_transaction trans;
+
+	*data_out_length = 0;
+
+	rc = simulator_prepare_transaction(&trans, 0, 0, data_in, data_in_length, data_out_max_length);
+	if (rc) {
+		return rc;
+	}
+
+	rc = comms_backend_submit_batch(&simulator_backend, &trans);
+	if (rc) {
+		return rc;
+	}
+
+	simulator_copy_response(&trans, data_out, data_out_length);
+	return 0;
+}
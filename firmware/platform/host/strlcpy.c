@@ -0,0 +1,25 @@
+/*
+ * This file is part of libgreat
+ *
+ * strlcpy() stand-in, for host C libraries that don't provide one.
+ */
+
+#include <string.h>
+
+
+/**
+ * Copies a NUL-terminated string into a buffer of the given size, truncating it if necessary.
+ */
+size_t strlcpy(char *dst, const char *src, size_t size)
+{
+	size_t length = strlen(src);
+
+	if (size) {
+		size_t to_copy = (length < size) ? length : size - 1;
+
+		memcpy(dst, src, to_copy);
+		dst[to_copy] = '\0';
+	}
+
+	return length;
+}
@@ -0,0 +1,14 @@
+/*
+ * This file is part of libgreat
+ *
+ * Host stand-in for libopencm3's interrupt control; tests deliver "interrupts" synchronously,
+ * so there's nothing to mask.
+ */
+
+#ifndef __LIBGREAT_HOST_TESTS_CORTEX_H__
+#define __LIBGREAT_HOST_TESTS_CORTEX_H__
+
+static inline void cm_disable_interrupts(void) {}
+static inline void cm_enable_interrupts(void) {}
+
+#endif
@@ -0,0 +1,24 @@
+/*
+ * This file is part of libgreat
+ *
+ * Host stand-in for libopencm3's exclusive-access primitives. Tests are single-threaded,
+ * so exclusive stores always succeed.
+ */
+
+#ifndef __LIBGREAT_HOST_TESTS_SYNC_H__
+#define __LIBGREAT_HOST_TESTS_SYNC_H__
+
+#include <stdint.h>
+
+static inline uint32_t __ldrex(volatile uint32_t *addr)
+{
+	return *addr;
+}
+
+static inline uint32_t __strex(uint32_t value, volatile uint32_t *addr)
+{
+	*addr = value;
+	return 0;
+}
+
+#endif
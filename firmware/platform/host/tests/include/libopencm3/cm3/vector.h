@@ -0,0 +1,12 @@
+/*
+ * This file is part of libgreat
+ *
+ * Host stand-in for libopencm3's vector table definitions.
+ */
+
+#ifndef __LIBGREAT_HOST_TESTS_VECTOR_H__
+#define __LIBGREAT_HOST_TESTS_VECTOR_H__
+
+typedef void (*vector_table_entry_t)(void);
+
+#endif
@@ -0,0 +1,44 @@
+/*
+ * This file is part of libgreat
+ *
+ * Host stand-in for libopencm3's LPC43xx USB definitions: just the controller's data structures,
+ * which the tests play the part of the controller for.
+ */
+
+#ifndef __LIBGREAT_HOST_TESTS_LPC43XX_USB_H__
+#define __LIBGREAT_HOST_TESTS_LPC43XX_USB_H__
+
+#include <stdint.h>
+
+typedef struct usb_transfer_descriptor_t usb_transfer_descriptor_t;
+struct usb_transfer_descriptor_t {
+	volatile usb_transfer_descriptor_t *next_dtd_pointer;
+	volatile uint32_t total_bytes;
+	volatile uint32_t buffer_pointer_page[5];
+	volatile uint32_t _reserved;
+};
+
+typedef struct {
+	volatile uint32_t capabilities;
+	volatile usb_transfer_descriptor_t *current_dtd_pointer;
+	volatile usb_transfer_descriptor_t *next_dtd_pointer;
+	volatile uint32_t total_bytes;
+	volatile uint32_t buffer_pointer_page[5];
+	volatile uint32_t _reserved_0;
+	volatile uint8_t setup[8];
+	volatile uint32_t _reserved_1[4];
+} usb_queue_head_t;
+
+#define USB_TD_NEXT_DTD_POINTER_TERMINATE         ((volatile usb_transfer_descriptor_t *)1)
+
+#define USB_TD_DTD_TOKEN_TOTAL_BYTES_SHIFT        (16)
+#define USB_TD_DTD_TOKEN_TOTAL_BYTES_MASK         (0x7FFF << USB_TD_DTD_TOKEN_TOTAL_BYTES_SHIFT)
+#define USB_TD_DTD_TOKEN_TOTAL_BYTES(x)           ((x) << USB_TD_DTD_TOKEN_TOTAL_BYTES_SHIFT)
+#define USB_TD_DTD_TOKEN_IOC                      (1 << 15)
+#define USB_TD_DTD_TOKEN_MULTO(x)                 ((x) << 10)
+#define USB_TD_DTD_TOKEN_STATUS_ACTIVE            (1 << 7)
+#define USB_TD_DTD_TOKEN_STATUS_HALTED            (1 << 6)
+#define USB_TD_DTD_TOKEN_STATUS_BUFFER_ERROR      (1 << 5)
+#define USB_TD_DTD_TOKEN_STATUS_TRANSACTION_ERROR (1 << 3)
+
+#endif
@@ -0,0 +1,24 @@
+/*
+ * This file is part of libgreat
+ *
+ * Host replacements for the core-specific instructions used by the LPC43xx USB queue; included ahead
+ * of each of the usb_queue tests' sources. Each is handed to the tests, which decide whether we're in
+ * interrupt context, and what happens while the queue sleeps.
+ */
+
+#ifndef __LIBGREAT_HOST_TESTS_USB_QUEUE_HOOKS_H__
+#define __LIBGREAT_HOST_TESTS_USB_QUEUE_HOOKS_H__
+
+#include <stdint.h>
+
+/** The value the queue reads from the IPSR; non-zero to act as though an exception handler is running. */
+extern uint32_t usb_queue_test_ipsr;
+
+/** Called in place of the wfe instruction; stands in for whatever would have woken the core. */
+void usb_queue_test_wait_for_event(void);
+
+#define USB_QUEUE_SEND_EVENT()
+#define USB_QUEUE_WAIT_FOR_EVENT() usb_queue_test_wait_for_event()
+#define USB_QUEUE_READ_IPSR(ipsr) ((ipsr) = usb_queue_test_ipsr)
+
+#endif
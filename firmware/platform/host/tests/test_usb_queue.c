@@ -0,0 +1,662 @@
+/*
+ * This file is part of libgreat
+ *
+ * Host-native tests for the LPC43xx USB transfer queue's bookkeeping. The tests play the part of the
+ * USB controller -- retiring transfer descriptors, and raising the completion "interrupt" -- and check
+ * that each queue's active list, tail and active count stay consistent throughout.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+
+#include <drivers/usb/usb.h>
+#include <drivers/usb/usb_queue.h>
+
+#define TEST_POOL_SIZE (8)
+
+static usb_peripheral_t test_device = {
+	.controller = 0,
+};
+
+static usb_endpoint_t test_endpoint = {
+	.address = 0x81,
+	.device = &test_device,
+};
+
+USB_DEFINE_QUEUE(test_endpoint, TEST_POOL_SIZE);
+
+static usb_endpoint_t test_out_endpoint = {
+	.address = 0x01,
+	.device = &test_device,
+};
+
+USB_DEFINE_QUEUE(test_out_endpoint, TEST_POOL_SIZE);
+
+static uint8_t test_buffer[TEST_POOL_SIZE][64];
+
+static unsigned int failures;
+
+#define CHECK(condition) \
+	do { \
+		if (!(condition)) { \
+			fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+			failures++; \
+		} \
+	} while (0)
+
+
+/*
+ * Stand-ins for the controller driver and timer.
+ */
+
+/** The number of times the controller was primed with an empty queue's first descriptor. */
+static unsigned int primes;
+
+/** If set, the controller finishes the queue's head while the next transfer is being appended. */
+static bool complete_head_during_append;
+
+/** The current time, in microseconds; and how far it moves each time it's read. */
+static uint32_t now;
+static uint32_t clock_step;
+
+/** If set, the timer can wake the core by a deadline; and the last deadline it was asked for. */
+static bool wakeups_available;
+static uint32_t wakeup_deadline;
+
+/** The number of times the queue slept, and yielded to the scheduler; and whether either frees a transfer. */
+static unsigned int waits;
+static unsigned int yields;
+static bool complete_on_wait;
+static bool complete_on_yield;
+
+uint32_t usb_queue_test_ipsr;
+
+static void complete_transfers(unsigned int count);
+
+uint32_t get_time(void)
+{
+	now += clock_step;
+	return now;
+}
+
+uint32_t get_time_since(uint32_t base)
+{
+	return get_time() - base;
+}
+
+bool schedule_wakeup(uint32_t deadline)
+{
+	wakeup_deadline = deadline;
+	return wakeups_available && ((int32_t)(deadline - now) > 0);
+}
+
+void usb_queue_test_wait_for_event(void)
+{
+	waits++;
+
+	// Sleep until the transfer at the head of the queue completes; or, failing that, until just after our wakeup.
+	if (complete_on_wait) {
+		complete_transfers(1);
+	} else {
+		now = wakeup_deadline + 1;
+	}
+}
+
+void scheduler_yield(void)
+{
+	yields++;
+
+	// While we're yielding, other tasks run for a while; and the controller may finish a transfer.
+	now += 100;
+	if (complete_on_yield) {
+		complete_transfers(1);
+	}
+}
+
+bool usb_endpoint_is_ready(const usb_endpoint_t* const endpoint)
+{
+	return false;
+}
+
+void usb_endpoint_prime(const usb_endpoint_t* const endpoint, usb_transfer_descriptor_t* const first_td)
+{
+	primes++;
+}
+
+void usb_endpoint_schedule_wait(const usb_endpoint_t* const endpoint, usb_transfer_descriptor_t* const td)
+{
+	primes++;
+}
+
+void usb_endpoint_schedule_append(const usb_endpoint_t* const endpoint,
+	usb_transfer_descriptor_t* const tail_td, usb_transfer_descriptor_t* const new_td)
+{
+	if (complete_head_during_append) {
+		test_endpoint_queue.active->td.total_bytes &= ~(USB_TD_DTD_TOKEN_STATUS_ACTIVE | USB_TD_DTD_TOKEN_TOTAL_BYTES_MASK);
+	}
+
+	tail_td->next_dtd_pointer = new_td;
+}
+
+void usb_endpoint_flush(const usb_endpoint_t* const endpoint)
+{
+	usb_queue_flush_endpoint(endpoint);
+}
+
+
+/*
+ * Helpers.
+ */
+
+/**
+ * Checks that the queue's active list agrees with its tail and active count, and that every transfer
+ * in the pool is either active, free, or one of the given number being retired.
+ */
+static void check_queue_consistent_retiring(unsigned int retiring)
+{
+	usb_transfer_t *transfer;
+	usb_transfer_t *last = NULL;
+	unsigned int active = 0, free = 0;
+
+	for (transfer = test_endpoint_queue.active; transfer && active <= TEST_POOL_SIZE; transfer = transfer->next) {
+		last = transfer;
+		active++;
+	}
+	for (transfer = test_endpoint_queue.free_transfers; transfer && free <= TEST_POOL_SIZE; transfer = transfer->next) {
+		free++;
+	}
+
+	CHECK(test_endpoint_queue.tail == last);
+	CHECK(test_endpoint_queue.active_count == active);
+	CHECK(active + free + retiring == TEST_POOL_SIZE);
+}
+
+
+static void check_queue_consistent(void)
+{
+	check_queue_consistent_retiring(0);
+}
+
+
+/**
+ * Has the "controller" finish the first count active transfers, and then raises its completion interrupt.
+ */
+static void complete_transfers(unsigned int count)
+{
+	usb_transfer_t *transfer = test_endpoint_queue.active;
+
+	for (unsigned int i = 0; i < count && transfer; ++i, transfer = transfer->next) {
+		transfer->td.total_bytes &= ~(USB_TD_DTD_TOKEN_STATUS_ACTIVE | USB_TD_DTD_TOKEN_TOTAL_BYTES_MASK);
+	}
+
+	usb_queue_transfer_complete(&test_endpoint);
+}
+
+
+/**
+ * Has the "controller" fill the first count of the OUT queue's active transfers with the given number of bytes,
+ * and then raises its completion interrupt.
+ */
+static void receive_transfers(unsigned int count, unsigned int length)
+{
+	usb_transfer_t *transfer = test_out_endpoint_queue.active;
+
+	for (unsigned int i = 0; i < count && transfer; ++i, transfer = transfer->next) {
+		transfer->td.total_bytes &= ~(USB_TD_DTD_TOKEN_STATUS_ACTIVE | USB_TD_DTD_TOKEN_TOTAL_BYTES_MASK);
+		transfer->td.total_bytes |= USB_TD_DTD_TOKEN_TOTAL_BYTES(transfer->maximum_length - length);
+	}
+
+	usb_queue_transfer_complete(&test_out_endpoint);
+}
+
+
+static unsigned int completions;
+static unsigned int last_transferred;
+
+static void count_completion(void *user_data, unsigned int transferred)
+{
+	completions++;
+	last_transferred = transferred;
+}
+
+
+static int schedule(void)
+{
+	static unsigned int next_buffer;
+
+	uint8_t *buffer = test_buffer[next_buffer++ % TEST_POOL_SIZE];
+	return usb_transfer_schedule(&test_endpoint, buffer, sizeof(test_buffer[0]), count_completion, NULL);
+}
+
+
+/*
+ * Tests.
+ */
+
+static void test_append_and_complete(void)
+{
+	for (unsigned int i = 0; i < 4; ++i) {
+		CHECK(schedule() == 0);
+		check_queue_consistent();
+	}
+	CHECK(test_endpoint_queue.active_count == 4);
+
+	// Complete transfers one at a time, and then the rest at once.
+	complete_transfers(1);
+	check_queue_consistent();
+	CHECK(test_endpoint_queue.active_count == 3);
+
+	complete_transfers(3);
+	check_queue_consistent();
+	CHECK(test_endpoint_queue.active == NULL);
+	CHECK(completions == 4);
+	CHECK(last_transferred == sizeof(test_buffer[0]));
+}
+
+
+static void test_head_completes_during_append(void)
+{
+	usb_transfer_t *head;
+
+	CHECK(schedule() == 0);
+	head = test_endpoint_queue.active;
+
+	// The controller retires the head while the second transfer is being appended behind it;
+	// the head stays in the list until the completion interrupt is handled.
+	complete_head_during_append = true;
+	CHECK(schedule() == 0);
+	complete_head_during_append = false;
+
+	check_queue_consistent();
+	CHECK(test_endpoint_queue.active == head);
+	CHECK(test_endpoint_queue.tail == head->next);
+	CHECK(test_endpoint_queue.active_count == 2);
+
+	// Handling the interrupt retires only the finished head; the new tail is left in place.
+	usb_queue_transfer_complete(&test_endpoint);
+	check_queue_consistent();
+	CHECK(test_endpoint_queue.active_count == 1);
+	CHECK(test_endpoint_queue.active == test_endpoint_queue.tail);
+
+	complete_transfers(1);
+	check_queue_consistent();
+	CHECK(test_endpoint_queue.active == NULL);
+}
+
+
+static unsigned int resubmissions;
+
+static void resubmit_on_completion(void *user_data, unsigned int transferred)
+{
+	// By the time we're called, the completed transfer must already be off the list;
+	// though it's only freed once we return.
+	check_queue_consistent_retiring(1);
+
+	if (resubmissions) {
+		resubmissions--;
+		CHECK(usb_transfer_schedule(&test_endpoint, test_buffer[0], sizeof(test_buffer[0]),
+			resubmit_on_completion, NULL) == 0);
+		check_queue_consistent_retiring(1);
+	}
+}
+
+
+static void test_append_from_completion(void)
+{
+	unsigned int primes_before = primes;
+
+	// Append from the completion of the only transfer, which leaves the queue empty; and from the
+	// completion of a head that still has transfers behind it.
+	resubmissions = 3;
+	CHECK(usb_transfer_schedule(&test_endpoint, test_buffer[0], sizeof(test_buffer[0]),
+		resubmit_on_completion, NULL) == 0);
+	CHECK(schedule() == 0);
+
+	complete_transfers(1);
+	check_queue_consistent();
+	CHECK(test_endpoint_queue.active_count == 2);
+
+	complete_transfers(2);
+	check_queue_consistent();
+	CHECK(test_endpoint_queue.active_count == 1);
+
+	// The resubmission onto the now-empty queue had to prime the controller.
+	complete_transfers(1);
+	check_queue_consistent();
+	CHECK(test_endpoint_queue.active_count == 1);
+	CHECK(primes > primes_before + 1);
+
+	complete_transfers(1);
+	check_queue_consistent();
+	CHECK(test_endpoint_queue.active == NULL);
+	CHECK(resubmissions == 0);
+}
+
+
+static void test_pool_exhaustion(void)
+{
+	for (unsigned int i = 0; i < TEST_POOL_SIZE; ++i) {
+		CHECK(schedule() == 0);
+	}
+
+	CHECK(schedule() == ENOSPC);
+	check_queue_consistent();
+	CHECK(test_endpoint_queue.active_count == TEST_POOL_SIZE);
+
+	complete_transfers(TEST_POOL_SIZE);
+	check_queue_consistent();
+	CHECK(test_endpoint_queue.active == NULL);
+}
+
+
+static void test_scatter_gather(void)
+{
+	usb_transfer_segment_t segments[3] = {
+		{ test_buffer[0], 16 },
+		{ test_buffer[1], 16 },
+		{ test_buffer[2], 16 },
+	};
+
+	CHECK(schedule() == 0);
+	CHECK(usb_transfer_schedule_segments(&test_endpoint, segments, 3, count_completion, NULL) == 0);
+	check_queue_consistent();
+	CHECK(test_endpoint_queue.active_count == 4);
+
+	// The chain reports once, with its total length.
+	completions = 0;
+	complete_transfers(4);
+	check_queue_consistent();
+	CHECK(completions == 2);
+	CHECK(last_transferred == 48);
+}
+
+
+static void test_flush(void)
+{
+	for (unsigned int i = 0; i < 3; ++i) {
+		CHECK(schedule() == 0);
+	}
+
+	// Flushing discards transfers the controller hasn't finished.
+	usb_endpoint_flush(&test_endpoint);
+	check_queue_consistent();
+	CHECK(test_endpoint_queue.active == NULL);
+	CHECK(!usb_queue_flushing(&test_endpoint));
+
+	// ... and leaves the queue usable.
+	CHECK(schedule() == 0);
+	check_queue_consistent();
+	complete_transfers(1);
+	check_queue_consistent();
+}
+
+
+/**
+ * Fills every transfer in the pool, so the next schedule has to wait; and resets our record of the wait.
+ */
+static void fill_pool(void)
+{
+	for (unsigned int i = 0; i < TEST_POOL_SIZE; ++i) {
+		CHECK(schedule() == 0);
+	}
+
+	waits = 0;
+	yields = 0;
+}
+
+
+static int schedule_wait(bool yielding, uint32_t timeout)
+{
+	if (yielding) {
+		return usb_transfer_schedule_wait_yielding(&test_endpoint, test_buffer[0], sizeof(test_buffer[0]),
+			NULL, NULL, timeout);
+	} else {
+		return usb_transfer_schedule_wait(&test_endpoint, test_buffer[0], sizeof(test_buffer[0]),
+			NULL, NULL, timeout);
+	}
+}
+
+
+static void test_wait_timeout(void)
+{
+	uint32_t start;
+
+	fill_pool();
+
+	// If nothing completes, the timer wakes us by our deadline; and we give up, rather than sleeping again.
+	wakeups_available = true;
+	start = now;
+	CHECK(schedule_wait(false, 1000) == ETIMEDOUT);
+	CHECK(wakeup_deadline == start + 1000);
+	CHECK(waits == 1);
+
+	// Without a timer to wake us, we have to poll; but still time out.
+	wakeups_available = false;
+	clock_step = 100;
+	CHECK(schedule_wait(false, 1000) == ETIMEDOUT);
+	CHECK(waits == 1);
+	clock_step = 0;
+
+	// Waiting without opting in never yields to the scheduler.
+	CHECK(yields == 0);
+
+	complete_transfers(TEST_POOL_SIZE);
+	check_queue_consistent();
+}
+
+
+static void test_wait_wakes_on_free(void)
+{
+	fill_pool();
+
+	// A transfer freed while we sleep wakes us; with no time passing, that's the only way we could succeed.
+	wakeups_available = true;
+	complete_on_wait = true;
+	CHECK(schedule_wait(false, 1000) == 0);
+	complete_on_wait = false;
+
+	CHECK(waits == 1);
+	CHECK(yields == 0);
+	check_queue_consistent();
+	CHECK(test_endpoint_queue.active_count == TEST_POOL_SIZE);
+
+	complete_transfers(TEST_POOL_SIZE);
+	check_queue_consistent();
+}
+
+
+static void test_wait_in_interrupt_context(void)
+{
+	fill_pool();
+
+	// The completion interrupt can't run until an exception handler returns; so there we neither sleep
+	// nor yield, but poll until we time out.
+	usb_queue_test_ipsr = 16 + 8;
+	wakeups_available = true;
+	complete_on_wait = true;
+	complete_on_yield = true;
+	clock_step = 100;
+	CHECK(schedule_wait(true, 1000) == ETIMEDOUT);
+	clock_step = 0;
+	complete_on_wait = false;
+	complete_on_yield = false;
+	usb_queue_test_ipsr = 0;
+
+	CHECK(waits == 0);
+	CHECK(yields == 0);
+
+	complete_transfers(TEST_POOL_SIZE);
+	check_queue_consistent();
+}
+
+
+static void test_wait_yielding(void)
+{
+	fill_pool();
+
+	// Callers that opt in let the scheduler's other tasks run, rather than sleeping.
+	wakeups_available = true;
+	complete_on_yield = true;
+	CHECK(schedule_wait(true, 1000) == 0);
+	complete_on_yield = false;
+
+	CHECK(yields == 1);
+	CHECK(waits == 0);
+	check_queue_consistent();
+
+	// Without anything completing, yielding still respects our timeout.
+	CHECK(schedule_wait(true, 1000) == ETIMEDOUT);
+	CHECK(yields > 1);
+	CHECK(waits == 0);
+
+	complete_transfers(TEST_POOL_SIZE);
+	check_queue_consistent();
+}
+
+
+#define TEST_RING_CHUNKS (4)
+
+static uint8_t ring_buffer[TEST_RING_CHUNKS][64];
+static usb_ring_t test_ring;
+
+
+static void test_out_ring(void)
+{
+	uint32_t length;
+
+	CHECK(usb_ring_start(&test_ring, &test_out_endpoint, ring_buffer, sizeof(ring_buffer[0]),
+		TEST_RING_CHUNKS, count_completion, NULL) == 0);
+
+	// OUT rings start with every chunk armed to receive; and own every transfer while they run.
+	CHECK(test_out_endpoint_queue.active_count == TEST_RING_CHUNKS);
+	CHECK(usb_ring_chunks_available(&test_ring) == 0);
+	CHECK(usb_ring_current_chunk(&test_ring, &length) == NULL);
+	CHECK(usb_transfer_schedule(&test_out_endpoint, test_buffer[0], sizeof(test_buffer[0]), NULL, NULL) == ENOSPC);
+	CHECK(usb_ring_start(&test_ring, &test_out_endpoint, ring_buffer, sizeof(ring_buffer[0]),
+		TEST_RING_CHUNKS, NULL, NULL) == EBUSY);
+
+	// Filled chunks are handed to the application in order, with the amount received.
+	completions = 0;
+	receive_transfers(2, 10);
+	CHECK(completions == 2);
+	CHECK(last_transferred == 10);
+	CHECK(usb_ring_chunks_available(&test_ring) == 2);
+	CHECK(usb_ring_current_chunk(&test_ring, &length) == ring_buffer[0]);
+	CHECK(length == 10);
+
+	// Releasing a chunk re-arms it behind the chunks still waiting on the controller.
+	usb_ring_advance(&test_ring, 0);
+	CHECK(test_out_endpoint_queue.active_count == 3);
+	CHECK(usb_ring_current_chunk(&test_ring, &length) == ring_buffer[1]);
+
+	// Flushing mid-stream retires the armed chunks without data; the chunk already received survives it...
+	usb_endpoint_flush(&test_out_endpoint);
+	CHECK(test_out_endpoint_queue.active == NULL);
+	CHECK(usb_ring_chunks_available(&test_ring) == 4);
+	CHECK(usb_ring_current_chunk(&test_ring, &length) == ring_buffer[1]);
+	CHECK(length == 10);
+	usb_ring_advance(&test_ring, 0);
+
+	// ... but the discarded chunks are skipped, rather than reported as empty reads; and are re-armed.
+	CHECK(usb_ring_current_chunk(&test_ring, &length) == NULL);
+	CHECK(usb_ring_chunks_available(&test_ring) == 0);
+	CHECK(test_out_endpoint_queue.active_count == TEST_RING_CHUNKS);
+
+	// Streaming resumes where the controller left off.
+	receive_transfers(1, 64);
+	CHECK(usb_ring_current_chunk(&test_ring, &length) == ring_buffer[1]);
+	CHECK(length == 64);
+
+	// Stopping the ring hands the endpoint back for normal transfers.
+	usb_ring_stop(&test_ring);
+	CHECK(test_out_endpoint_queue.active == NULL);
+	CHECK(test_out_endpoint_queue.ring == NULL);
+	CHECK(usb_transfer_schedule(&test_out_endpoint, test_buffer[0], sizeof(test_buffer[0]), NULL, NULL) == 0);
+	usb_endpoint_flush(&test_out_endpoint);
+}
+
+
+static void test_in_ring(void)
+{
+	uint32_t length;
+
+	CHECK(usb_ring_start(&test_ring, &test_endpoint, ring_buffer, sizeof(ring_buffer[0]),
+		TEST_RING_CHUNKS, NULL, NULL) == 0);
+
+	// IN rings start empty; with every chunk waiting to be filled.
+	CHECK(test_endpoint_queue.active == NULL);
+	CHECK(usb_ring_chunks_available(&test_ring) == TEST_RING_CHUNKS);
+	CHECK(usb_ring_current_chunk(&test_ring, &length) == ring_buffer[0]);
+	CHECK(length == sizeof(ring_buffer[0]));
+
+	// Committing a chunk transmits as much of it as was filled.
+	usb_ring_advance(&test_ring, 32);
+	CHECK(test_endpoint_queue.active_count == 1);
+	CHECK(test_endpoint_queue.active->maximum_length == 32);
+
+	for (unsigned int i = 1; i < TEST_RING_CHUNKS; ++i) {
+		CHECK(usb_ring_current_chunk(&test_ring, NULL) == ring_buffer[i]);
+		usb_ring_advance(&test_ring, sizeof(ring_buffer[0]));
+	}
+
+	// Once every chunk is committed, there's nothing left to fill; and advancing does nothing.
+	CHECK(usb_ring_chunks_available(&test_ring) == 0);
+	CHECK(usb_ring_current_chunk(&test_ring, NULL) == NULL);
+	usb_ring_advance(&test_ring, sizeof(ring_buffer[0]));
+	CHECK(test_endpoint_queue.active_count == TEST_RING_CHUNKS);
+
+	// Transmitted chunks come back to be filled again, in order.
+	complete_transfers(2);
+	CHECK(usb_ring_chunks_available(&test_ring) == 2);
+	CHECK(usb_ring_current_chunk(&test_ring, NULL) == ring_buffer[0]);
+
+	// Flushing mid-stream drops the untransmitted chunks; which are free to be filled again.
+	usb_endpoint_flush(&test_endpoint);
+	CHECK(test_endpoint_queue.active == NULL);
+	CHECK(usb_ring_chunks_available(&test_ring) == TEST_RING_CHUNKS);
+	CHECK(usb_ring_current_chunk(&test_ring, NULL) == ring_buffer[0]);
+
+	usb_ring_advance(&test_ring, 16);
+	CHECK(test_endpoint_queue.active_count == 1);
+
+	usb_ring_stop(&test_ring);
+	check_queue_consistent();
+	CHECK(test_endpoint_queue.ring == NULL);
+}
+
+
+int main(void)
+{
+	// The queue packs transfer pointers into 32-bit words, as it would on the target;
+	// so its pool must live in the low 4 GiB.
+	if ((uintptr_t)&test_endpoint_transfers[TEST_POOL_SIZE] > UINT32_MAX) {
+		fprintf(stderr, "usb_queue tests must be linked at low addresses (e.g. with -no-pie)\n");
+		return 1;
+	}
+
+	usb_queue_init(&test_endpoint_queue);
+	usb_queue_init(&test_out_endpoint_queue);
+
+	test_append_and_complete();
+	test_head_completes_during_append();
+	test_append_from_completion();
+	test_pool_exhaustion();
+	test_scatter_gather();
+	test_flush();
+	test_wait_timeout();
+	test_wait_wakes_on_free();
+	test_wait_in_interrupt_context();
+	test_wait_yielding();
+	test_out_ring();
+	test_in_ring();
+
+	if (failures) {
+		fprintf(stderr, "%u check(s) failed\n", failures);
+		return 1;
+	}
+
+	printf("usb_queue: all tests passed\n");
+	return 0;
+}
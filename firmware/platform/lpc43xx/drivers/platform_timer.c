@@ -9,15 +9,30 @@
 
 
 #include <debug.h>
+#include <errno.h>
 #include <drivers/timer.h>
 
 #include <drivers/platform_clock.h>
 
+#include <libopencm3/cm3/vector.h>
+#include <libopencm3/lpc43xx/m4/nvic.h>
+
+/** The match channel each timer uses to generate wakeups; see platform_timer_schedule_wakeup(). */
+#define PLATFORM_TIMER_WAKEUP_CHANNEL (3)
+
+/** Bits in the match control register that enable interrupting on a given channel. */
+#define PLATFORM_TIMER_MATCH_INTERRUPT(channel) (1 << ((channel) * 3))
+
 /**
  * Timer object for the timer reserved for system use.
  */
 static timer_t platform_timer = { .reg = NULL, .number = TIMER3 };
 
+/**
+ * The timers with a wakeup armed, by index; or NULL for timers without one.
+ */
+static timer_t *volatile wakeup_timers[4];
+
 
 /**
  * @returns a reference to the register bank for the given timer index.
@@ -135,6 +150,80 @@ uint32_t platform_timer_get_value(timer_t *timer)
 
 
 
+/**
+ * @returns The NVIC interrupt number for the given timer.
+ */
+static uint8_t platform_get_timer_irq(timer_index_t index)
+{
+	switch(index)  {
+		case TIMER0: return NVIC_TIMER0_IRQ;
+		case TIMER1: return NVIC_TIMER1_IRQ;
+		case TIMER2: return NVIC_TIMER2_IRQ;
+		case TIMER3: return NVIC_TIMER3_IRQ;
+	}
+
+	return NVIC_TIMER3_IRQ;
+}
+
+
+/**
+ * Interrupt handler for timer wakeups. Wakeups are one-shot, so we just disarm them;
+ * taking the interrupt has already woken the core.
+ */
+static void platform_timer_wakeup_isr(void)
+{
+	for (unsigned int index = 0; index < sizeof(wakeup_timers) / sizeof(wakeup_timers[0]); ++index) {
+		timer_t *timer = wakeup_timers[index];
+
+		if (!timer || !timer->reg->interrupt_pending.match3) {
+			continue;
+		}
+
+		// Stop interrupting, and acknowledge the match. The pending bits are write-one-to-clear.
+		timer->reg->match_control &= ~PLATFORM_TIMER_MATCH_INTERRUPT(PLATFORM_TIMER_WAKEUP_CHANNEL);
+		*(volatile uint32_t *)&timer->reg->interrupt_pending = (1 << PLATFORM_TIMER_WAKEUP_CHANNEL);
+		wakeup_timers[index] = NULL;
+	}
+
+	// Also wake anyone who's about to WFE, but hasn't yet.
+	__asm__ volatile ("sev");
+}
+
+
+/**
+ * Arranges for the given timer to raise a one-shot interrupt once its counter reaches the given value;
+ * which wakes the core, if it's sleeping. Arming a wakeup replaces any the timer already had pending.
+ *
+ * @param timer The timer to be used.
+ * @param value The counter value at which the wakeup should occur.
+ *
+ * @return 0 on success, or an error number on failure
+ */
+int platform_timer_schedule_wakeup(timer_t *timer, uint32_t value)
+{
+	uint8_t irq;
+
+	if (!timer || !timer->reg) {
+		return ENODEV;
+	}
+
+	irq = platform_get_timer_irq(timer->number);
+
+	// Point the match channel at our new wakeup time, and discard any match from an earlier wakeup.
+	// We only interrupt on the match; we don't want to reset or stop the timer.
+	timer->reg->match_control &= ~(0x7 << (PLATFORM_TIMER_WAKEUP_CHANNEL * 3));
+	timer->reg->match_value[PLATFORM_TIMER_WAKEUP_CHANNEL] = value;
+	*(volatile uint32_t *)&timer->reg->interrupt_pending = (1 << PLATFORM_TIMER_WAKEUP_CHANNEL);
+
+	wakeup_timers[timer->number] = timer;
+	vector_table.irq[irq] = platform_timer_wakeup_isr;
+	nvic_enable_irq(irq);
+
+	timer->reg->match_control |= PLATFORM_TIMER_MATCH_INTERRUPT(PLATFORM_TIMER_WAKEUP_CHANNEL);
+	return 0;
+}
+
+
 /**
  * Sets up the system's platform timer.
  *
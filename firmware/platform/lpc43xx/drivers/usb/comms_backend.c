@@ -6,26 +6,61 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <string.h>
+#include <errno.h>
 #include <debug.h>
 
 #include <drivers/comms.h>
 #include <drivers/comms_backend.h>
 #include <drivers/usb/comms_backend.h>
 
+#include <drivers/usb/usb.h>
 #include <drivers/usb/usb_standard_request.h>
 #include <drivers/usb/usb_queue.h>
 
+#include <libopencm3/cm3/cortex.h>
+
 #define LIBGREAT_REQUEST_CANCEL_VALUE (0xDEAD)
 
+/** Special request value that asks how many recent commands we can repeat; see
+ *  libgreat_comms_vendor_request_query_repeat_slots_handler(). */
+#define LIBGREAT_REQUEST_QUERY_REPEAT_SLOTS_VALUE (0xDEAE)
+
 /** Flag indicating that the host does not expect us to send a response. */
 /* This allows us to skip half of the USB transaction. */
 #define LIBGREAT_REQUEST_FLAG_SKIP_RESPONSE (1 << 0)
 
 /** Flag indicating that the host expects us to use the same input (class/verb/arguments)
- *  for the next transaction. This allows us to skip half of the USB transaction.
- *  Currently only valid when performing a follow-up IN request. */
+ *  as a recent transaction -- the one held in the repeat slot selected by the request's index.
+ *  This allows us to skip half of the USB transaction. Currently only valid when performing a
+ *  follow-up IN request. */
 #define LIBGREAT_REQUEST_FLAG_REPEAT_LAST (1 << 1)
 
+/** Flag indicating that the request contains a batch of commands, rather than a single command.
+ *  See comms_backend_submit_batch() for the batch format. */
+#define LIBGREAT_REQUEST_FLAG_BATCH (1 << 2)
+
+/** Bits of the request's index that select a repeat slot. Each command the host sends is recorded
+ *  in the slot it selects; and REPEAT_LAST requests re-issue the command in the slot they select.
+ *  Hosts that don't know about repeat slots always select slot zero. */
+#define LIBGREAT_REQUEST_REPEAT_SLOT_SHIFT (8)
+#define LIBGREAT_REQUEST_REPEAT_SLOT_MASK  (0xF << LIBGREAT_REQUEST_REPEAT_SLOT_SHIFT)
+
+/** The number of recent commands the host can ask us to repeat. */
+#ifndef LIBGREAT_USB_COMMS_REPEAT_SLOTS
+#define LIBGREAT_USB_COMMS_REPEAT_SLOTS (4)
+#endif
+
+#if LIBGREAT_USB_COMMS_REPEAT_SLOTS > 16
+#error "LIBGREAT_USB_COMMS_REPEAT_SLOTS must fit in the request's repeat slot bits!"
+#endif
+
+/** The largest arguments a repeat slot can hold. Commands with longer arguments can only be repeated
+ *  while their arguments are still in our receive buffer; i.e. until the host sends another command. */
+#ifndef LIBGREAT_USB_COMMS_REPEAT_SLOT_SIZE
+#define LIBGREAT_USB_COMMS_REPEAT_SLOT_SIZE (64)
+#endif
+
 
 struct comm_backend_driver usb_backend_driver = {
 	.name = "USB",
@@ -36,13 +71,76 @@ struct comm_backend_driver usb_backend_driver = {
 static struct command_transaction active_transaction;
 static bool transaction_underway = false;
 
+/** True iff the active transaction is a batch of commands, rather than a single command. */
+static bool active_transaction_is_batch = false;
+
+/**
+ * State for deferred execution, in which commands are executed by a scheduler task,
+ * rather than directly from the USB interrupt. See libgreat_comms_set_deferred_execution().
+ */
+static bool deferred_execution_enabled = false;
+
+/** Set from when a command is captured until our execution task has finished running it. */
+static volatile bool deferred_command_pending = false;
+
+/** The control endpoint on which the pending command was issued. */
+static usb_endpoint_t *deferred_endpoint;
+
+/** Set if the host has requested the pending command's response, and is being NAK'd until it's ready. */
+static volatile bool deferred_response_requested = false;
+
+/** Set if we're holding the status stage of the pending command until it completes. */
+static volatile bool deferred_status_pending = false;
+
+/** Set while our execution task is running the pending command. */
+static volatile bool deferred_command_executing = false;
+
+/**
+ * Incremented each time the host cancels a command; so the execution task can tell whether
+ * the command it just ran was cancelled in the meantime, and drop its results.
+ */
+static volatile uint32_t deferred_generation = 0;
+
 // FIXME: abstract the maximum size, here
 uint8_t usb_data_in_buffer[4096] ATTR_ALIGNED(4);
 uint8_t usb_data_out_buffer[4096] ATTR_ALIGNED(4);
 
+
+/**
+ * Slot that records a recent command, so the host can have it re-issued without sending it again.
+ * Polling loops that alternate among a few commands can then skip the OUT stage of every request.
+ */
+struct libgreat_repeat_slot {
+
+	/** True iff the slot holds a command. */
+	bool valid;
+
+	/** The command's class and verb. */
+	uint32_t class_number;
+	uint32_t verb;
+
+	/** The length of the command's arguments; which may be longer than the slot can hold. */
+	uint32_t data_length;
+
+	/** A copy of the command's arguments, if they fit. */
+	uint8_t data[LIBGREAT_USB_COMMS_REPEAT_SLOT_SIZE] ATTR_ALIGNED(4);
+};
+
+static struct libgreat_repeat_slot repeat_slots[LIBGREAT_USB_COMMS_REPEAT_SLOTS];
+
+/** The slot whose command's arguments are currently in usb_data_in_buffer; or NULL if none are. */
+static struct libgreat_repeat_slot *repeat_slot_in_buffer;
+
+
 /** Clears our position in the current transaction. */
 static void libgreat_clear_position_in_active_transaction(void)
 {
+	// Any response from the last execution will never be sent, now; let its handler have back
+	// any buffer it provided. Handlers providing external buffers also limit the response length,
+	// so restore that, too.
+	comms_backend_release_external_response(&active_transaction);
+	active_transaction.data_out_max_length = sizeof(usb_data_out_buffer);
+
 	active_transaction.data_out_length = 0;
 	active_transaction.data_in_position = active_transaction.data_in;
 	active_transaction.data_out_position = active_transaction.data_out;
@@ -53,6 +151,123 @@ static void libgreat_clear_position_in_active_transaction(void)
 }
 
 
+/**
+ * @return The number of the repeat slot selected by the request currently being handled.
+ */
+static inline uint32_t libgreat_comms_repeat_slot_number(usb_endpoint_t* const endpoint)
+{
+	return (endpoint->setup.index & LIBGREAT_REQUEST_REPEAT_SLOT_MASK) >> LIBGREAT_REQUEST_REPEAT_SLOT_SHIFT;
+}
+
+
+/**
+ * Records the command that was just received -- the active transaction -- in the repeat slot
+ * selected by the host.
+ */
+static void libgreat_comms_record_repeat_slot(usb_endpoint_t* const endpoint)
+{
+	struct libgreat_repeat_slot *slot = &repeat_slots[libgreat_comms_repeat_slot_number(endpoint)];
+
+	slot->class_number = active_transaction.class_number;
+	slot->verb = active_transaction.verb;
+	slot->data_length = active_transaction.data_in_length;
+
+	// Keep our own copy of the arguments, if we can; so the command can be repeated even once
+	// the host has sent other commands.
+	if (slot->data_length <= sizeof(slot->data)) {
+		memcpy(slot->data, active_transaction.data_in, slot->data_length);
+	}
+
+	slot->valid = true;
+	repeat_slot_in_buffer = slot;
+}
+
+
+/**
+ * Makes the command in the repeat slot selected by the host the active transaction.
+ *
+ * @return 0 on success, or EINVAL if the slot doesn't hold a command we can repeat.
+ */
+static int libgreat_comms_load_repeat_slot(usb_endpoint_t* const endpoint)
+{
+	uint8_t *post_prelude_buffer = &usb_data_in_buffer[sizeof(struct libgreat_command_prelude)];
+	uint32_t slot_number = libgreat_comms_repeat_slot_number(endpoint);
+	struct libgreat_repeat_slot *slot;
+
+	if (slot_number >= LIBGREAT_USB_COMMS_REPEAT_SLOTS) {
+		return EINVAL;
+	}
+
+	slot = &repeat_slots[slot_number];
+	if (!slot->valid) {
+		return EINVAL;
+	}
+
+	// If the command's arguments aren't still in our receive buffer, restore them from the slot.
+	if (slot != repeat_slot_in_buffer) {
+		if (slot->data_length > sizeof(slot->data)) {
+			return EINVAL;
+		}
+
+		memcpy(post_prelude_buffer, slot->data, slot->data_length);
+		repeat_slot_in_buffer = slot;
+	}
+
+	active_transaction_is_batch = false;
+	active_transaction.class_number = slot->class_number;
+	active_transaction.verb = slot->verb;
+	active_transaction.data_in = post_prelude_buffer;
+	active_transaction.data_in_length = slot->data_length;
+
+	// Our parse position still refers to the last command's arguments; which may have had a different
+	// length, or been a whole batch. Start parsing from the beginning of the repeated command's arguments.
+	active_transaction.data_in_position = active_transaction.data_in;
+	active_transaction.data_in_remaining = active_transaction.data_in_length;
+
+	return 0;
+}
+
+
+/**
+ * Executes the active transaction, which may be either a single command or a batch of commands.
+ *
+ * @return 0 on success, or an error number on failure.
+ */
+static int libgreat_comms_execute_active_transaction(void)
+{
+	if (active_transaction_is_batch) {
+		return comms_backend_submit_batch(&usb_backend_driver, &active_transaction);
+	} else {
+		return comms_backend_submit_command(&usb_backend_driver, &active_transaction);
+	}
+}
+
+
+/**
+ * Selects whether commands are executed directly from the USB interrupt (the default),
+ * or deferred to a scheduler task. See the header for details.
+ */
+void libgreat_comms_set_deferred_execution(bool enabled)
+{
+	deferred_execution_enabled = enabled;
+}
+
+
+/**
+ * Hands the active transaction off to our deferred-execution task.
+ *
+ * @param endpoint The control endpoint on which the command was issued.
+ * @param hold_status If true, the request's status stage won't be ACK'd until the command completes.
+ */
+static void libgreat_comms_defer_active_transaction(usb_endpoint_t* const endpoint, bool hold_status)
+{
+	deferred_endpoint = endpoint;
+	deferred_status_pending = hold_status;
+	deferred_response_requested = false;
+	deferred_command_pending = true;
+}
+
+
 static usb_request_status_t libgreat_comms_vendor_request_out_handler(
 	usb_endpoint_t* const endpoint, const usb_transfer_stage_t stage)
 {
@@ -64,6 +279,13 @@ static usb_request_status_t libgreat_comms_vendor_request_out_handler(
 	struct libgreat_command_prelude *prelude = (void *)usb_data_in_buffer;
 	uint8_t *post_prelude_buffer = &usb_data_in_buffer[sizeof(*prelude)];
 
+	// If we're still executing a deferred command, we can't accept a new one until it completes;
+	// its arguments live in the buffer the new command would be received into.
+	if ((stage == USB_TRANSFER_STAGE_SETUP) && deferred_command_pending) {
+		pr_error("comms error: host issued a new request while a deferred request was still executing!\n");
+		return USB_REQUEST_STATUS_STALL;
+	}
+
 	// If we've gotten out of sync, cancel the existing transaction and
 	// stall this request. This likely means the host misbehaved.
 	if ((stage != USB_TRANSFER_STAGE_STATUS) && transaction_underway) {
@@ -87,12 +309,19 @@ static usb_request_status_t libgreat_comms_vendor_request_out_handler(
 		return USB_REQUEST_STATUS_STALL;
 	}
 
+	// If the host has selected a repeat slot we don't have, stall.
+	if (libgreat_comms_repeat_slot_number(endpoint) >= LIBGREAT_USB_COMMS_REPEAT_SLOTS) {
+		return USB_REQUEST_STATUS_STALL;
+	}
+
 	// Compute how much non-prelude data we have.
 	data_length = endpoint->setup.length - sizeof(*prelude);
 
 	// If this is the setup stage of the transaction, schedule the data
 	// read itself.
 	if (stage == USB_TRANSFER_STAGE_SETUP) {
+		repeat_slot_in_buffer = NULL;
+
 		rc = usb_transfer_schedule_block(endpoint->out, usb_data_in_buffer,
 				endpoint->setup.length, NULL, NULL);
 		return rc ? USB_REQUEST_STATUS_STALL : USB_REQUEST_STATUS_OK;
@@ -104,26 +333,57 @@ static usb_request_status_t libgreat_comms_vendor_request_out_handler(
 		// Determine if the host is opting to skip reading a response.
 		bool skip_response = (endpoint->setup.index & LIBGREAT_REQUEST_FLAG_SKIP_RESPONSE);
 
-		// Populate the transaction details.
-		active_transaction.class_number = prelude->class_number;
-		active_transaction.verb = prelude->verb;
-		active_transaction.data_in = post_prelude_buffer;
-		active_transaction.data_in_length = data_length;
+		// Populate the transaction details. Batches have no prelude; each of their
+		// commands carries its own header.
+		active_transaction_is_batch = (endpoint->setup.index & LIBGREAT_REQUEST_FLAG_BATCH);
+		if (active_transaction_is_batch) {
+			active_transaction.class_number = 0;
+			active_transaction.verb = 0;
+			active_transaction.data_in = usb_data_in_buffer;
+			active_transaction.data_in_length = endpoint->setup.length;
+		} else {
+			active_transaction.class_number = prelude->class_number;
+			active_transaction.verb = prelude->verb;
+			active_transaction.data_in = post_prelude_buffer;
+			active_transaction.data_in_length = data_length;
+			libgreat_comms_record_repeat_slot(endpoint);
+		}
 		active_transaction.data_out = usb_data_out_buffer;
 		active_transaction.data_out_max_length = sizeof(usb_data_out_buffer);
 		libgreat_clear_position_in_active_transaction();
 		transaction_underway = true;
 
+		// If we're deferring execution, hand the command off to our execution task rather than
+		// running it here. If the host is waiting on a response, we ACK now, and NAK its request for
+		// the response until it's ready; otherwise, we hold our ACK until the command completes.
+		if (deferred_execution_enabled) {
+			libgreat_comms_defer_active_transaction(endpoint, skip_response);
+
+			if (skip_response) {
+				return USB_REQUEST_STATUS_OK;
+			}
+
+			rc = usb_transfer_schedule_ack(endpoint->in);
+			if(rc) {
+				pr_warning("warning: comms: could not ACK the start of a USB comms request (%d)\n", rc);
+				return USB_REQUEST_STATUS_STALL;
+			}
+			return USB_REQUEST_STATUS_OK;
+		}
+
 		// Submit the command to the backend for execution.
-		// TODO: do we want to set up a back/front to handle these outside
-		// of the interrupt context? or perhaps check for an early-ack for the given class/verb?
-		active_transaction.last_error_number = comms_backend_submit_command(&usb_backend_driver, &active_transaction);
+		active_transaction.last_error_number = libgreat_comms_execute_active_transaction();
 
 		// If the host is opting to skip reading a response, the transaction is compelte, here.
 		if (skip_response) {
 			transaction_underway = false;
 		}
 
+		// If we won't be sending a response, we're done with any buffer the handler provided for it.
+		if (skip_response || active_transaction.last_error_number) {
+			comms_backend_release_external_response(&active_transaction);
+		}
+
 		// If any error occurred, stall.
 		if (active_transaction.last_error_number) {
 			return USB_REQUEST_STATUS_STALL;
@@ -142,18 +402,83 @@ static usb_request_status_t libgreat_comms_vendor_request_out_handler(
 }
 
 /**
- * Re-issues the most recent libgreat command with the same in-arguments.
+ * Re-issues a recent libgreat command -- the one in the repeat slot selected by the host -- with the same in-arguments.
  */
-static void libgreat_comms_reissue_command(void)
+static void libgreat_comms_reissue_command(usb_endpoint_t* const endpoint)
 {
+	int rc;
+
 	// Reset our positions and status within the transaction.
 	libgreat_clear_position_in_active_transaction();
+	transaction_underway = true;
+
+	// Fetch the command to be repeated. If we can't, fail the request, as if the command had failed.
+	rc = libgreat_comms_load_repeat_slot(endpoint);
+	if (rc) {
+		pr_error("comms error: host requested a repeat of a command we don't have (slot %d)!\n",
+				libgreat_comms_repeat_slot_number(endpoint));
+		active_transaction.last_error_number = rc;
+		return;
+	}
+
+	// If we're deferring execution, let our execution task pick the command up.
+	if (deferred_execution_enabled) {
+		libgreat_comms_defer_active_transaction(endpoint, false);
+		return;
+	}
 
 	// Submit the command to the backend for execution.
-	// TODO: do we want to set up a back/front to handle these outside
-	// of the interrupt context? or perhaps check for an early-ack for the given class/verb?
-	transaction_underway = true;
-	active_transaction.last_error_number = comms_backend_submit_command(&usb_backend_driver, &active_transaction);
+	active_transaction.last_error_number = libgreat_comms_execute_active_transaction();
+}
+
+
+/**
+ * Called once a response sent from a handler-provided buffer has been transmitted.
+ */
+static void libgreat_comms_external_response_complete(void *user_data, unsigned int transferred)
+{
+	(void)user_data;
+	(void)transferred;
+
+	comms_backend_release_external_response(&active_transaction);
+}
+
+
+/**
+ * Schedules transmission of the active transaction's response, in reply to
+ * the IN request currently being handled on the given endpoint.
+ */
+static usb_request_status_t libgreat_comms_schedule_response(usb_endpoint_t* const endpoint)
+{
+	int rc;
+	void *response = usb_data_out_buffer;
+	transfer_completion_cb completion_cb = NULL;
+
+	// Transmit the amount of returned data, or the requested
+	// data; whichever is less.
+	uint32_t data_length = active_transaction.data_out_length;
+	if (endpoint->setup.length < data_length) {
+		data_length = endpoint->setup.length;
+	}
+	if (sizeof(usb_data_out_buffer) < data_length) {
+		data_length = sizeof(usb_data_out_buffer);
+	}
+
+	// If the handler provided its own buffer for the response, DMA straight out of it,
+	// and give it back to the handler once we're done.
+	if (active_transaction.data_out_external) {
+		response = active_transaction.data_out_external;
+		completion_cb = libgreat_comms_external_response_complete;
+	}
+
+	// Schedule the transfer itself.
+	rc = usb_transfer_schedule_block(endpoint->in, response, data_length, completion_cb, NULL);
+	if (rc) {
+		pr_warning("warning: comms: could not respond to a USB comms request (%d) \n", rc);
+		return USB_REQUEST_STATUS_STALL;
+	}
+
+	return USB_REQUEST_STATUS_OK;
 }
 
 
@@ -166,10 +491,17 @@ static usb_request_status_t libgreat_comms_vendor_request_in_handler(
 	// read itself.
 	if (stage == USB_TRANSFER_STAGE_SETUP) {
 
-		// If this is a request for a repeat of the previous command with the same in-arguments,
+		// If this is a request for a repeat of a recent command with the same in-arguments,
 		// re-issue the command.
 		if (endpoint->setup.index & LIBGREAT_REQUEST_FLAG_REPEAT_LAST) {
-			libgreat_comms_reissue_command();
+
+			// If we're still executing a deferred command, its arguments are still in use; we can't load new ones.
+			if (deferred_command_pending) {
+				pr_error("comms error: host requested a repeat while a deferred request was still executing!\n");
+				return USB_REQUEST_STATUS_STALL;
+			}
+
+			libgreat_comms_reissue_command(endpoint);
 		}
 
 		// Check to make sure we have an active transaction to respond to.
@@ -178,22 +510,19 @@ static usb_request_status_t libgreat_comms_vendor_request_in_handler(
 			return USB_REQUEST_STATUS_STALL;
 		}
 
-		// Transmit the amount of returned data, or the requested
-		// data; whichever is less.
-		uint32_t data_length = active_transaction.data_out_length;
-		if (endpoint->setup.length < data_length) {
-			data_length = endpoint->setup.length;
-		}
-		if (sizeof(usb_data_out_buffer) < data_length) {
-			data_length = sizeof(usb_data_out_buffer);
+		// If the command is still waiting on our deferred-execution task, don't schedule anything yet.
+		// The controller will NAK the host until the task completes the command and sends the response.
+		if (deferred_command_pending) {
+			deferred_response_requested = true;
+			return USB_REQUEST_STATUS_OK;
 		}
 
-		// Schedule the transfer itself.
-		rc = usb_transfer_schedule_block(endpoint->in, usb_data_out_buffer, data_length, NULL, NULL);
-		if (rc) {
-			pr_warning("warning: comms: could not respond to a USB comms request (%d) \n", rc);
+		// If the command failed, stall, so the host knows to retrieve the error.
+		if (active_transaction.last_error_number) {
 			return USB_REQUEST_STATUS_STALL;
 		}
+
+		return libgreat_comms_schedule_response(endpoint);
 	}
 
 	// If this is the end of the DATA stage, queue an ACK for the status stage.
@@ -210,6 +539,81 @@ static usb_request_status_t libgreat_comms_vendor_request_in_handler(
 	return USB_REQUEST_STATUS_OK;
 }
 
+/**
+ * Scheduler task that executes commands captured while in deferred-execution mode,
+ * and then completes the control request the host is waiting on.
+ */
+static void libgreat_comms_deferred_execution_task(void)
+{
+	int rc;
+	uint32_t generation;
+	bool complete_status, send_response;
+	usb_endpoint_t *endpoint = deferred_endpoint;
+
+	// If we don't have a command waiting, there's nothing to do. Otherwise, claim it; once we've
+	// started executing it, a cancellation can no longer take it away from us.
+	cm_disable_interrupts();
+	if (!deferred_command_pending) {
+		cm_enable_interrupts();
+		return;
+	}
+	deferred_command_executing = true;
+	generation = deferred_generation;
+	cm_enable_interrupts();
+
+	// Execute the command. This is the potentially-slow part, and it's why we're here
+	// rather than in the USB interrupt.
+	rc = libgreat_comms_execute_active_transaction();
+
+	// Mark the command complete with interrupts disabled, so the USB interrupt sees a
+	// consistent view of our state, and figure out which stage of the request we owe the host.
+	// Once we've cleared the pending flag, the interrupt will handle any new requests itself.
+	cm_disable_interrupts();
+	deferred_command_executing = false;
+	deferred_command_pending = false;
+
+	// If the host cancelled the command while it ran, it's abandoned the request; so we owe it nothing,
+	// and touching the control endpoint now would only confuse whatever request it's making next.
+	if (generation != deferred_generation) {
+		comms_backend_release_external_response(&active_transaction);
+		cm_enable_interrupts();
+		return;
+	}
+
+	active_transaction.last_error_number = rc;
+
+	complete_status = deferred_status_pending;
+	send_response = deferred_response_requested;
+	deferred_status_pending = false;
+	deferred_response_requested = false;
+
+	if (complete_status) {
+		transaction_underway = false;
+	}
+
+	// If we won't be sending a response, we're done with any buffer the handler provided for it.
+	if (complete_status || rc) {
+		comms_backend_release_external_response(&active_transaction);
+	}
+	cm_enable_interrupts();
+
+	// If we've been holding the request's status stage, complete it.
+	if (complete_status) {
+		if (rc || usb_transfer_schedule_ack(endpoint->in)) {
+			usb_endpoint_stall(endpoint);
+		}
+	}
+
+	// If the host is already waiting on our response, send it.
+	if (send_response) {
+		if (rc || (libgreat_comms_schedule_response(endpoint) != USB_REQUEST_STATUS_OK)) {
+			usb_endpoint_stall(endpoint);
+		}
+	}
+}
+DEFINE_TASK(libgreat_comms_deferred_execution_task);
+
+
 /**
  * Handler for special cancellation requests, which abort execution of an
  * existing command. These allow us to fail gracefully rather than being
@@ -226,9 +630,23 @@ static usb_request_status_t libgreat_comms_vendor_request_cancel_handler(
 		pr_debug("usb comms: aborting active command at host's request\n");
 
 		// Grab the most recent transaction's error number, and invalidate the existing transaction.
+		// We do this with interrupts disabled, so our execution task sees a consistent view of our state.
+		cm_disable_interrupts();
 		last_errno = active_transaction.last_error_number;
 		transaction_underway = false;
 
+		// Abandon any deferred command; we owe the host neither its status stage nor its response.
+		// If our execution task is already running the command, it'll drop its results once it's done;
+		// and the command stays pending until then, as its handler is still using our buffers.
+		deferred_generation++;
+		deferred_status_pending = false;
+		deferred_response_requested = false;
+		if (!deferred_command_executing) {
+			deferred_command_pending = false;
+			comms_backend_release_external_response(&active_transaction);
+		}
+		cm_enable_interrupts();
+
 		if(endpoint->setup.length != sizeof(last_errno)) {
 			pr_warning("usb comms: received an invalid abort request (bad length of %d)!\n", endpoint->setup.length);
 			return USB_REQUEST_STATUS_STALL;
@@ -255,6 +673,58 @@ static usb_request_status_t libgreat_comms_vendor_request_cancel_handler(
 }
 
 
+/**
+ * Responds to one of the host's queries about our capabilities.
+ *
+ * @param response The response to send; must remain valid until the request completes.
+ * @param length The length of the response; truncated to what the host requested.
+ */
+static usb_request_status_t libgreat_comms_respond_to_query(usb_endpoint_t* const endpoint,
+	const usb_transfer_stage_t stage, const void *response, uint32_t length)
+{
+	int rc;
+
+	if (stage == USB_TRANSFER_STAGE_SETUP) {
+		if (endpoint->setup.length < length) {
+			length = endpoint->setup.length;
+		}
+
+		rc = usb_transfer_schedule_block(endpoint->in, (void *)response, length, NULL, NULL);
+		if (rc) {
+			pr_warning("warning: comms: could not respond to a capability query (%d)\n", rc);
+			return USB_REQUEST_STATUS_STALL;
+		}
+	}
+
+	if (stage == USB_TRANSFER_STAGE_DATA) {
+		rc = usb_transfer_schedule_ack(endpoint->out);
+		if (rc) {
+			pr_warning("warning: comms: could not ACK a capability query (%d)\n", rc);
+			return USB_REQUEST_STATUS_STALL;
+		}
+	}
+
+	return USB_REQUEST_STATUS_OK;
+}
+
+
+/**
+ * Handler for requests that ask about our repeat slots; which lets hosts know how many recent commands
+ * they can ask us to repeat. Responds with the number of slots, followed by the largest arguments each
+ * slot can hold; both as uint32s. Devices without repeat slots stall this request.
+ */
+static usb_request_status_t libgreat_comms_vendor_request_query_repeat_slots_handler(
+	usb_endpoint_t* const endpoint, const usb_transfer_stage_t stage)
+{
+	static const uint32_t repeat_slot_info[] = {
+		LIBGREAT_USB_COMMS_REPEAT_SLOTS,
+		LIBGREAT_USB_COMMS_REPEAT_SLOT_SIZE,
+	};
+
+	return libgreat_comms_respond_to_query(endpoint, stage, repeat_slot_info, sizeof(repeat_slot_info));
+}
+
+
 /**
  * Top-level handler for vendor requests for LPC43xx devices that are
  * communicating via a libgreat backend.
@@ -269,10 +739,16 @@ usb_request_status_t libgreat_comms_vendor_request_handler(
 		return libgreat_comms_vendor_request_cancel_handler(endpoint, stage);
 	}
 
+	// If this is a query about our repeat slots, answer it.
+	if (endpoint->setup.value == LIBGREAT_REQUEST_QUERY_REPEAT_SLOTS_VALUE) {
+		return libgreat_comms_vendor_request_query_repeat_slots_handler(endpoint, stage);
+	}
+
 	// If this is an IN request, we're being asked for the response
 	// to a previous query. Handle that accordingly.
 	is_in_request = endpoint->setup.request_type
 		>> USB_SETUP_REQUEST_TYPE_DATA_TRANSFER_DIRECTION_shift;
+
 	if (is_in_request) {
 		return libgreat_comms_vendor_request_in_handler(endpoint, stage);
 	} else {
@@ -0,0 +1,269 @@
+/*
+ * This file is part of libgreat
+ *
+ * USB transport for libgreat comms pipes -- carries each pipe's data
+ * over a dedicated pair of USB bulk endpoints.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <errno.h>
+#include <debug.h>
+
+#include <drivers/comms.h>
+#include <drivers/comms_backend.h>
+#include <drivers/usb/comms_backend.h>
+
+#include <drivers/usb/usb.h>
+#include <drivers/usb/usb_queue.h>
+
+#include <libopencm3/cm3/cortex.h>
+
+/**
+ * The maximum number of transmissions that can be in flight on a pipe at once.
+ * Allowing more than one lets the owner fill its next buffer while the last is sent.
+ */
+#define USB_PIPE_MAX_PENDING_TRANSMISSIONS (2)
+
+/** The size of the region a single transfer descriptor can address. */
+#define USB_PIPE_TD_BUFFER_SPAN (0x5000)
+
+
+/**
+ * State for a pipe carried over USB.
+ */
+struct usb_comms_pipe {
+
+	/** The endpoint on which we send data to the host, or NULL if the pipe is receive-only. */
+	usb_endpoint_t *in_endpoint;
+
+	/** The endpoint on which we receive data from the host, or NULL if the pipe is transmit-only. */
+	usb_endpoint_t *out_endpoint;
+
+	/** Buffer into which data from the host is received. */
+	void *receive_buffer;
+	uint32_t receive_buffer_size;
+
+	/** The transmissions in flight, in the order they were scheduled. */
+	struct {
+		void *data;
+		uint32_t length;
+	} pending[USB_PIPE_MAX_PENDING_TRANSMISSIONS];
+
+	volatile uint32_t pending_head;
+	volatile uint32_t pending_count;
+};
+
+static struct usb_comms_pipe usb_pipes[COMMS_MAX_PIPES];
+
+
+/**
+ * Called from the USB interrupt once a transmission to the host has completed.
+ */
+static void usb_pipe_transmit_complete(void *user_data, unsigned int transferred)
+{
+	struct comms_pipe *pipe = user_data;
+	struct usb_comms_pipe *usb_pipe = pipe->transport_data;
+
+	void *data = usb_pipe->pending[usb_pipe->pending_head].data;
+	uint32_t length = usb_pipe->pending[usb_pipe->pending_head].length;
+
+	(void)transferred;
+
+	// Retire the transmission; transmissions on an endpoint always complete in order.
+	usb_pipe->pending_head = (usb_pipe->pending_head + 1) % USB_PIPE_MAX_PENDING_TRANSMISSIONS;
+	usb_pipe->pending_count--;
+
+	// Let the pipe's owner reclaim its buffer, and then let it know it can send more.
+	if (pipe->ops.handle_data_out_complete) {
+		pipe->ops.handle_data_out_complete(data, length);
+	}
+	if (pipe->ops.handle_host_ready_for_data) {
+		pipe->ops.handle_host_ready_for_data(0);
+	}
+}
+
+
+/**
+ * Queues data for transmission to the host.
+ */
+static int usb_pipe_transmit(struct comms_pipe *pipe, void *data, uint32_t length)
+{
+	int rc;
+	uint32_t slot;
+	struct usb_comms_pipe *usb_pipe = pipe->transport_data;
+
+	if (!usb_pipe->in_endpoint) {
+		return ENOTSUP;
+	}
+
+	// A transfer descriptor can only address a limited span of memory, which starts at the page
+	// containing the data. Larger transmissions need to be broken up by the pipe's owner.
+	if (length > (USB_PIPE_TD_BUFFER_SPAN - ((uint32_t)data & 0xFFF))) {
+		return EMSGSIZE;
+	}
+
+	// Claim a slot to track the transmission. We do this with interrupts disabled, as
+	// completions (which retire slots) are handled from the USB interrupt.
+	cm_disable_interrupts();
+	if (usb_pipe->pending_count >= USB_PIPE_MAX_PENDING_TRANSMISSIONS) {
+		cm_enable_interrupts();
+		return EBUSY;
+	}
+
+	slot = (usb_pipe->pending_head + usb_pipe->pending_count) % USB_PIPE_MAX_PENDING_TRANSMISSIONS;
+	usb_pipe->pending[slot].data = data;
+	usb_pipe->pending[slot].length = length;
+	usb_pipe->pending_count++;
+	cm_enable_interrupts();
+
+	// Hand the data to the USB controller, which will DMA it directly from the owner's buffer.
+	rc = usb_transfer_schedule(usb_pipe->in_endpoint, data, length, usb_pipe_transmit_complete, pipe);
+	if (rc) {
+		cm_disable_interrupts();
+		usb_pipe->pending_count--;
+		cm_enable_interrupts();
+	}
+
+	return rc;
+}
+
+
+/**
+ * @return True iff the given pipe can accept data for transmission.
+ */
+static bool usb_pipe_ready(struct comms_pipe *pipe)
+{
+	struct usb_comms_pipe *usb_pipe = pipe->transport_data;
+	return usb_pipe->in_endpoint && (usb_pipe->pending_count < USB_PIPE_MAX_PENDING_TRANSMISSIONS);
+}
+
+
+/**
+ * @return The pipe's endpoint addresses; the IN endpoint's in the low byte, and the OUT endpoint's
+ *		in the next byte. Missing endpoints are represented as zero.
+ */
+static uint32_t usb_pipe_get_address(struct comms_pipe *pipe)
+{
+	struct usb_comms_pipe *usb_pipe = pipe->transport_data;
+
+	uint32_t in_address = usb_pipe->in_endpoint ? usb_pipe->in_endpoint->address : 0;
+	uint32_t out_address = usb_pipe->out_endpoint ? usb_pipe->out_endpoint->address : 0;
+
+	return in_address | (out_address << 8);
+}
+
+
+static struct comms_pipe_transport usb_pipe_transport = {
+	.name = "USB",
+	.transmit = usb_pipe_transmit,
+	.ready = usb_pipe_ready,
+	.get_address = usb_pipe_get_address,
+};
+
+
+static void usb_pipe_receive_complete(void *user_data, unsigned int transferred);
+
+/**
+ * Schedules reception of the next chunk of data from the host.
+ */
+static int usb_pipe_schedule_receive(struct comms_pipe *pipe)
+{
+	struct usb_comms_pipe *usb_pipe = pipe->transport_data;
+
+	return usb_transfer_schedule(usb_pipe->out_endpoint, usb_pipe->receive_buffer,
+			usb_pipe->receive_buffer_size, usb_pipe_receive_complete, pipe);
+}
+
+
+/**
+ * Called from the USB interrupt once we've received data from the host.
+ */
+static void usb_pipe_receive_complete(void *user_data, unsigned int transferred)
+{
+	int rc;
+	struct comms_pipe *pipe = user_data;
+	struct usb_comms_pipe *usb_pipe = pipe->transport_data;
+
+	// Transfers discarded by a flush -- e.g. on a bus reset -- aren't re-armed until the pipes are
+	// restarted, or we'd be re-queueing onto an endpoint that's being flushed.
+	if (usb_queue_flushing(usb_pipe->out_endpoint)) {
+		return;
+	}
+
+	// Zero-length packets from the host carry no data, but still need us to keep receiving.
+	if (transferred && pipe->ops.handle_data_in) {
+		pipe->ops.handle_data_in(0, usb_pipe->receive_buffer, transferred);
+	}
+
+	rc = usb_pipe_schedule_receive(pipe);
+	if (rc) {
+		pr_warning("usb comms: could not continue receiving on pipe %d (%d)\n", pipe->pipe_number, rc);
+	}
+}
+
+
+/**
+ * Attaches a registered comms pipe to a pair of USB bulk endpoints.
+ */
+int libgreat_comms_attach_usb_pipe(uint32_t pipe_number, usb_endpoint_t *in_endpoint,
+	usb_endpoint_t *out_endpoint, void *receive_buffer, uint32_t receive_buffer_size)
+{
+	struct usb_comms_pipe *usb_pipe;
+	struct comms_pipe *pipe = comms_get_pipe_by_number(pipe_number);
+
+	if (!pipe) {
+		pr_error("usb comms: cannot attach pipe %d, which hasn't been registered\n", pipe_number);
+		return ENOENT;
+	}
+
+	// We need somewhere to receive into, if we're going to receive.
+	if (out_endpoint && (!receive_buffer || !receive_buffer_size)) {
+		return EINVAL;
+	}
+
+	usb_pipe = &usb_pipes[pipe_number];
+	usb_pipe->in_endpoint = in_endpoint;
+	usb_pipe->out_endpoint = out_endpoint;
+	usb_pipe->receive_buffer = receive_buffer;
+	usb_pipe->receive_buffer_size = receive_buffer_size;
+	usb_pipe->pending_head = 0;
+	usb_pipe->pending_count = 0;
+
+	return comms_backend_attach_pipe(pipe, &usb_pipe_transport, usb_pipe);
+}
+
+
+/**
+ * Starts communication on each of the pipes attached to USB.
+ */
+void libgreat_comms_start_usb_pipes(void)
+{
+	int rc;
+	uint32_t pipe_number;
+
+	for (pipe_number = 0; pipe_number < comms_get_pipe_count(); ++pipe_number) {
+		struct comms_pipe *pipe = comms_get_pipe_by_number(pipe_number);
+		struct usb_comms_pipe *usb_pipe = pipe->transport_data;
+
+		// Skip any pipes carried by other transports.
+		if (pipe->transport != &usb_pipe_transport) {
+			continue;
+		}
+
+		// Anything that was in flight was discarded when the endpoints were (re-)initialized.
+		usb_pipe->pending_head = 0;
+		usb_pipe->pending_count = 0;
+
+		if (usb_pipe->out_endpoint) {
+			rc = usb_pipe_schedule_receive(pipe);
+			if (rc) {
+				pr_warning("usb comms: could not start receiving on pipe %d (%d)\n", pipe_number, rc);
+			}
+		}
+
+		if (usb_pipe->in_endpoint && pipe->ops.handle_host_ready_for_data) {
+			pipe->ops.handle_host_ready_for_data(0);
+		}
+	}
+}
@@ -0,0 +1,101 @@
+/*
+ * This file is part of libgreat
+ *
+ * Communications class that exposes the USB stack's per-endpoint queue statistics;
+ * which allow throughput problems to be diagnosed without a bus analyzer.
+ */
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <errno.h>
+
+#include <drivers/comms.h>
+#include <drivers/usb/usb_queue.h>
+
+#ifndef CLASS_NUMBER_USB_STATISTICS
+#define CLASS_NUMBER_USB_STATISTICS (0x18)
+#endif
+
+
+/**
+ * Responds with the statistics for a given endpoint's queue.
+ */
+static int usb_statistics_respond(struct command_transaction *trans, bool clear)
+{
+	usb_queue_statistics_t statistics;
+	unsigned int depth;
+	int rc;
+
+	uint8_t controller = comms_argument_parse_uint8_t(trans);
+	uint8_t endpoint_address = comms_argument_parse_uint8_t(trans);
+
+	if (!comms_argument_parse_okay(trans)) {
+		return EINVAL;
+	}
+
+	rc = usb_queue_read_statistics(controller, endpoint_address, &statistics, &depth, clear);
+	if (rc) {
+		return rc;
+	}
+
+	comms_response_add_uint32_t(trans, depth);
+	comms_response_add_uint32_t(trans, statistics.max_depth);
+	comms_response_add_uint32_t(trans, statistics.scheduled);
+	comms_response_add_uint32_t(trans, statistics.completed);
+	comms_response_add_uint32_t(trans, statistics.halted_errors);
+	comms_response_add_uint32_t(trans, statistics.buffer_errors);
+	comms_response_add_uint32_t(trans, statistics.transaction_errors);
+
+	for (unsigned int i = 0; i < USB_QUEUE_LATENCY_BUCKETS; ++i) {
+		comms_response_add_uint32_t(trans, statistics.latency_histogram[i]);
+	}
+
+	return 0;
+}
+
+
+static int verb_get_endpoint_statistics(struct command_transaction *trans)
+{
+	return usb_statistics_respond(trans, false);
+}
+
+
+static int verb_get_and_clear_endpoint_statistics(struct command_transaction *trans)
+{
+	return usb_statistics_respond(trans, true);
+}
+
+
+static int verb_get_latency_bucket_limits(struct command_transaction *trans)
+{
+	for (unsigned int i = 0; i < USB_QUEUE_LATENCY_BUCKETS; ++i) {
+		comms_response_add_uint32_t(trans, usb_queue_latency_bucket_limits[i]);
+	}
+
+	return 0;
+}
+
+
+/**
+ * Verbs for the USB statistics API.
+ */
+static struct comms_verb usb_statistics_verbs[] = {
+		{ .verb_number = 0x0, .name = "get_endpoint_statistics", .handler = verb_get_endpoint_statistics,
+			.in_signature = "<BB", .out_signature = "<IIIIIII*I", .in_param_names = "controller, endpoint_address",
+			.out_param_names = "depth, max_depth, scheduled, completed, halted_errors, buffer_errors, "
+				"transaction_errors, latency_histogram",
+			.doc = "Returns the queue statistics for the given endpoint, and its histogram of transfer latencies." },
+		{ .verb_number = 0x1, .name = "get_and_clear_endpoint_statistics",
+			.handler = verb_get_and_clear_endpoint_statistics,
+			.in_signature = "<BB", .out_signature = "<IIIIIII*I", .in_param_names = "controller, endpoint_address",
+			.out_param_names = "depth, max_depth, scheduled, completed, halted_errors, buffer_errors, "
+				"transaction_errors, latency_histogram",
+			.doc = "Returns the queue statistics for the given endpoint; and then resets them." },
+		{ .verb_number = 0x2, .name = "get_latency_bucket_limits", .handler = verb_get_latency_bucket_limits,
+			.in_signature = "", .out_signature = "<*I", .out_param_names = "limits_us",
+			.doc = "Returns the upper bound of each latency histogram bucket, in microseconds.",
+			.flags = COMMS_VERB_FLAG_CACHEABLE },
+		{} // Sentinel
+};
+COMMS_DEFINE_SIMPLE_CLASS(usb_statistics_api, CLASS_NUMBER_USB_STATISTICS, "usb_statistics", usb_statistics_verbs,
+        "Statistics describing the device's USB transfer queues.");
@@ -7,10 +7,13 @@
 #include <stddef.h>
 #include <assert.h>
 #include <string.h>
-#include <time.h>
 #include <errno.h>
 
 #include <debug.h>
+#include <toolchain.h>
+#include <scheduler.h>
+
+#include <drivers/timer.h>
 
 #include <libopencm3/cm3/cortex.h>
 #include <libopencm3/cm3/sync.h>
@@ -21,8 +24,28 @@
 // FIXME abstract:
 #define USB_ALLOC_TIMEOUT_DEFAULT_US (1000000UL)
 
+// The cooperative scheduler is optional; if it's linked in, usb_transfer_schedule_wait_yielding() yields to it
+// while waiting for free transfers.
+extern void scheduler_yield(void) ATTR_WEAK;
+
+// Core-specific instructions; these can be overridden so the queue can be exercised off-target,
+// as by the host build's usb_queue tests.
+#ifndef USB_QUEUE_SEND_EVENT
+#define USB_QUEUE_SEND_EVENT() __asm__ volatile ("sev")
+#endif
+#ifndef USB_QUEUE_WAIT_FOR_EVENT
+#define USB_QUEUE_WAIT_FOR_EVENT() __asm__ volatile ("wfe")
+#endif
+#ifndef USB_QUEUE_READ_IPSR
+#define USB_QUEUE_READ_IPSR(ipsr) __asm__ volatile ("mrs %0, ipsr" : "=r" (ipsr))
+#endif
+
 usb_queue_t* endpoint_queues[NUM_USB_CONTROLLERS][12] = {};
 
+const uint32_t usb_queue_latency_bucket_limits[USB_QUEUE_LATENCY_BUCKETS] = {
+	64, 256, 1024, 4096, 16384, 65536, 262144, UINT32_MAX
+};
+
 #define USB_ENDPOINT_INDEX(endpoint_address) (((endpoint_address & 0xF) * 2) + ((endpoint_address >> 7) & 1))
 
 static usb_queue_t* endpoint_queue(
@@ -36,6 +59,29 @@ static usb_queue_t* endpoint_queue(
 		return endpoint_queues[endpoint->device->controller][index];
 }
 
+/* Places the queue's transfers, from first_index onwards, in its free list.
+ * The remaining transfers are left for the caller's use.
+ */
+static void usb_queue_build_free_list(
+		usb_queue_t* const queue,
+		const unsigned int first_index
+) {
+		if (first_index >= queue->pool_size) {
+			queue->free_transfers = NULL;
+			return;
+		}
+
+		usb_transfer_t* t = &queue->pool[first_index];
+		for (unsigned int i = first_index; i < queue->pool_size - 1; i++, t++) {
+				t->next = t+1;
+				t->queue = queue;
+		}
+		t->next = NULL;
+		t->queue = queue;
+
+		queue->free_transfers = &queue->pool[first_index];
+}
+
 void usb_queue_init(
 		usb_queue_t* const queue
 ) {
@@ -44,15 +90,25 @@ void usb_queue_init(
 			pr_error("usb error: could not initialize queue for endpoint %d!", queue->endpoint->address);
 			return;
 		}
+		// Queues not created with USB_DEFINE_QUEUE may only provide their transfer array as the
+		// initial free list; if so, that's our pool.
+		if (queue->pool == NULL) {
+			queue->pool = queue->free_transfers;
+		}
+		if (queue->pool == NULL) {
+			pr_error("usb error: queue for endpoint %d has no transfers!", queue->endpoint->address);
+			return;
+		}
+
 		endpoint_queues[queue->endpoint->device->controller][index] = queue;
 
-		usb_transfer_t* t = queue->free_transfers;
-		for (unsigned int i=0; i < queue->pool_size - 1; i++, t++) {
-				t->next = t+1;
-				t->queue = queue;
-		}
-		t->next = NULL;
-		t->queue = queue;
+		queue->active = NULL;
+		queue->tail = NULL;
+		queue->active_count = 0;
+		queue->ring = NULL;
+		memset(&queue->statistics, 0, sizeof(queue->statistics));
+
+		usb_queue_build_free_list(queue, 0);
 }
 
 /* Allocate a transfer */
@@ -82,46 +138,135 @@ static void free_transfer(usb_transfer_t* const transfer)
 				transfer->next = (void *) __ldrex((uint32_t *) &queue->free_transfers);
 				aborted = __strex((uint32_t) transfer, (uint32_t *) &queue->free_transfers);
 		} while (aborted);
+
+		// Wake anyone sleeping in usb_transfer_schedule_wait.
+		USB_QUEUE_SEND_EVENT();
 }
 
 /* Add a transfer to the end of an endpoint's queue. Returns the old
- * tail or NULL is the queue was empty
+ * tail or NULL is the queue was empty. Must be called with interrupts disabled.
  */
 static usb_transfer_t* endpoint_queue_transfer(
 		usb_transfer_t* const transfer
 ) {
 		usb_queue_t* const queue = transfer->queue;
+		usb_transfer_t* const tail = queue->tail;
+
 		transfer->next = NULL;
-		if (queue->active != NULL) {
-			usb_transfer_t* t = queue->active;
-			while (t->next != NULL) t = t->next;
-			t->next = transfer;
-			return t;
+		if (tail != NULL) {
+			tail->next = transfer;
 		} else {
 			queue->active = transfer;
-			return NULL;
 		}
+
+		queue->tail = transfer;
+		queue->active_count++;
+
+		// Track when this was scheduled, and how deep the queue has grown.
+		transfer->scheduled_time = get_time();
+		queue->statistics.scheduled++;
+		if (queue->active_count > queue->statistics.max_depth) {
+			queue->statistics.max_depth = queue->active_count;
+		}
+
+		return tail;
 }
 
-int usb_transfer_schedule(
-	const usb_endpoint_t* const endpoint,
-	void* const data,
-	const uint32_t maximum_length,
+/* Records a successfully-completed transfer in its queue's latency histogram. */
+static void usb_queue_record_latency(
+		usb_queue_t* const queue,
+		usb_transfer_t* const transfer
+) {
+		uint32_t latency = get_time_since(transfer->scheduled_time);
+		unsigned int bucket = 0;
+
+		while ((bucket < USB_QUEUE_LATENCY_BUCKETS - 1) && (latency >= usb_queue_latency_bucket_limits[bucket])) {
+			++bucket;
+		}
+
+		queue->statistics.completed++;
+		queue->statistics.latency_histogram[bucket]++;
+}
+
+/**
+ * Reads the running statistics for the queue on a given endpoint.
+ *
+ * @param controller The USB controller that owns the endpoint.
+ * @param endpoint_address The endpoint's address, including its direction bit.
+ * @param statistics Out; receives a snapshot of the queue's statistics.
+ * @param depth Out; receives the number of transfers currently queued.
+ * @param clear If true, the queue's statistics are reset once they've been read.
+ *
+ * @return 0 on success, or ENOENT if the endpoint doesn't have a queue.
+ */
+int usb_queue_read_statistics(
+	const uint8_t controller,
+	const uint8_t endpoint_address,
+	usb_queue_statistics_t* const statistics,
+	unsigned int* const depth,
+	const bool clear
+)
+{
+		const unsigned int index = USB_ENDPOINT_INDEX(endpoint_address);
+		const unsigned int queues_per_controller = sizeof(endpoint_queues[0]) / sizeof(endpoint_queues[0][0]);
+
+		// The endpoint address comes from the host; so ensure it names a queue we could actually have.
+		if ((controller >= NUM_USB_CONTROLLERS) || (endpoint_address & 0x70) || (index >= queues_per_controller)) {
+			return ENOENT;
+		}
+
+		usb_queue_t* const queue = endpoint_queues[controller][index];
+		if (queue == NULL) {
+			return ENOENT;
+		}
+
+		// Take a consistent snapshot; the completion path updates these from interrupt context.
+		cm_disable_interrupts();
+		*statistics = queue->statistics;
+		*depth = queue->active_count;
+		if (clear) {
+			memset(&queue->statistics, 0, sizeof(queue->statistics));
+		}
+		cm_enable_interrupts();
+
+		return 0;
+}
+
+/* Returns true iff the given buffer fits within the five page pointers of a single transfer descriptor. */
+static bool usb_transfer_fits(
+		const void* const data,
+		const uint32_t length
+) {
+		uint32_t page_offset = (uint32_t)data & 0xfff;
+		return (page_offset + length) <= 0x5000;
+}
+
+/* Returns the number of bytes a completed (or retired) transfer actually moved. */
+static unsigned int usb_transfer_bytes_transferred(
+		usb_transfer_t* const transfer
+) {
+		unsigned int total_bytes = (transfer->td.total_bytes & USB_TD_DTD_TOKEN_TOTAL_BYTES_MASK) >> USB_TD_DTD_TOKEN_TOTAL_BYTES_SHIFT;
+		return transfer->maximum_length - total_bytes;
+}
+
+/* Fill in a transfer, and its transfer descriptor, for the given buffer.
+ * Only transfers that interrupt on completion will have their completion callback invoked.
+ */
+static void usb_transfer_prepare(
+		usb_transfer_t* const transfer,
+		void* const data,
+		const uint32_t maximum_length,
+		const bool interrupt_on_completion,
 		const transfer_completion_cb completion_cb,
 		void* const user_data
 ) {
-		usb_queue_t* const queue = endpoint_queue(endpoint);
-		usb_transfer_t* const transfer = allocate_transfer(queue);
-		if (transfer == NULL)
-			return ENOSPC;
-
 		usb_transfer_descriptor_t* const td = &transfer->td;
 
 	// Configure the transfer descriptor
 		td->next_dtd_pointer = USB_TD_NEXT_DTD_POINTER_TERMINATE;
 	td->total_bytes =
 		  USB_TD_DTD_TOKEN_TOTAL_BYTES(maximum_length)
-		| USB_TD_DTD_TOKEN_IOC
+		| (interrupt_on_completion ? USB_TD_DTD_TOKEN_IOC : 0)
 		| USB_TD_DTD_TOKEN_MULTO(0)
 		| USB_TD_DTD_TOKEN_STATUS_ACTIVE ;
 	td->buffer_pointer_page[0] =  (uint32_t)data;
@@ -132,10 +277,19 @@ int usb_transfer_schedule(
 
 		// Fill in transfer fields
 		transfer->maximum_length = maximum_length;
-		transfer->completion_cb = completion_cb;
+		transfer->completion_cb = interrupt_on_completion ? completion_cb : NULL;
 		transfer->user_data = user_data;
+		transfer->chained = false;
+		transfer->chain_transferred = 0;
+}
 
-		cm_disable_interrupts();
+/* Add a prepared transfer to its queue, and hand it to the controller.
+ * Must be called with interrupts disabled.
+ */
+static void usb_queue_submit_transfer(
+		usb_queue_t* const queue,
+		usb_transfer_t* const transfer
+) {
 		usb_transfer_t* tail = endpoint_queue_transfer(transfer);
 		if (tail == NULL) {
 				// The queue is currently empty, we need to re-prime
@@ -144,34 +298,219 @@ int usb_transfer_schedule(
 				// The queue is currently running, try to append
 				usb_endpoint_schedule_append(queue->endpoint, &tail->td, &transfer->td);
 		}
+}
+
+int usb_transfer_schedule(
+	const usb_endpoint_t* const endpoint,
+	void* const data,
+	const uint32_t maximum_length,
+		const transfer_completion_cb completion_cb,
+		void* const user_data
+) {
+		usb_queue_t* const queue = endpoint_queue(endpoint);
+		usb_transfer_t* const transfer = allocate_transfer(queue);
+		if (transfer == NULL)
+			return ENOSPC;
+
+		usb_transfer_prepare(transfer, data, maximum_length, true, completion_cb, user_data);
+
+		cm_disable_interrupts();
+		usb_queue_submit_transfer(queue, transfer);
 		cm_enable_interrupts();
 		return 0;
 }
 
-int usb_transfer_schedule_wait(
+/**
+ * Schedules a scatter-gather transfer: a list of buffers that are moved as though they were a single
+ * transfer. The segments are placed in a chain of linked transfer descriptors, which is handed to the
+ * controller all at once; only the final descriptor interrupts on completion.
+ *
+ * @param segments The buffers to be transferred, in order.
+ * @param segment_count The number of segments; each requires one of the queue's transfers.
+ * @param completion_cb Called once the final segment completes, with the total bytes transferred.
+ *
+ * @return 0 on success; EINVAL if a segment can't fit in a transfer descriptor, or ENOSPC if there
+ *	aren't enough free transfers to hold the whole chain. Nothing is scheduled on failure.
+ */
+int usb_transfer_schedule_segments(
+	const usb_endpoint_t* const endpoint,
+	const usb_transfer_segment_t* const segments,
+	const unsigned int segment_count,
+	const transfer_completion_cb completion_cb,
+	void* const user_data
+)
+{
+		usb_queue_t* const queue = endpoint_queue(endpoint);
+		usb_transfer_t* first = NULL;
+		usb_transfer_t* previous = NULL;
+
+		if (segment_count == 0) {
+			return EINVAL;
+		}
+
+		// Each segment must fit within the five page pointers of a single transfer descriptor.
+		for (unsigned int i = 0; i < segment_count; ++i) {
+			if (!usb_transfer_fits(segments[i].data, segments[i].length)) {
+				return EINVAL;
+			}
+		}
+
+		// Build the chain. We allocate every transfer before scheduling any, so a chain is never partially queued.
+		for (unsigned int i = 0; i < segment_count; ++i) {
+			bool last = (i == segment_count - 1);
+			usb_transfer_t* const transfer = allocate_transfer(queue);
+
+			if (transfer == NULL) {
+				while (first != NULL) {
+					usb_transfer_t* const next = first->chained ? first->next : NULL;
+					free_transfer(first);
+					first = next;
+				}
+				return ENOSPC;
+			}
+
+			usb_transfer_prepare(transfer, segments[i].data, segments[i].length, last, completion_cb, user_data);
+
+			if (previous) {
+				previous->chained = true;
+				previous->next = transfer;
+				previous->td.next_dtd_pointer = &transfer->td;
+			} else {
+				first = transfer;
+			}
+			previous = transfer;
+		}
+
+		cm_disable_interrupts();
+
+		// Add each transfer to the endpoint's queue, noting what preceded the chain. Queueing a transfer
+		// resets its next pointer, so grab the following segment first.
+		usb_transfer_t* tail = NULL;
+		usb_transfer_t* transfer = first;
+		bool more_segments;
+		do {
+			usb_transfer_t* const next = transfer->next;
+			usb_transfer_t* const old_tail = endpoint_queue_transfer(transfer);
+
+			if (transfer == first) {
+				tail = old_tail;
+			}
+
+			more_segments = transfer->chained;
+			transfer = next;
+		} while (more_segments);
+
+		if (tail == NULL) {
+				// The queue is currently empty; prime the endpoint with the whole chain. We can't use
+				// usb_endpoint_schedule_wait, as it would terminate the chain after its first descriptor.
+				while (usb_endpoint_is_ready(queue->endpoint));
+				usb_endpoint_prime(queue->endpoint, &first->td);
+		} else {
+				// The queue is currently running, try to append
+				usb_endpoint_schedule_append(queue->endpoint, &tail->td, &first->td);
+		}
+		cm_enable_interrupts();
+		return 0;
+}
+
+/* Returns true iff we're currently executing an exception handler, rather than thread code. */
+static inline bool usb_queue_in_interrupt_context(void)
+{
+		uint32_t ipsr;
+		USB_QUEUE_READ_IPSR(ipsr);
+		return ipsr != 0;
+}
+
+/* Waits for a chance that one of the queue's transfers has been freed, without monopolizing the core;
+ * returning no later than the given deadline, in get_time() microseconds. If yield is set, other tasks
+ * may be run in the meantime.
+ */
+static void usb_queue_wait_for_free_transfer(
+		usb_queue_t* const queue,
+		const uint32_t deadline,
+		const bool yield
+) {
+		// In interrupt context, the completion path can't run until we return, and tasks can't safely
+		// be run; so the best we can do is to keep polling.
+		if (usb_queue_in_interrupt_context()) {
+			return;
+		}
+
+		// If our caller's happy for other tasks to run, and we have a scheduler, let them make progress while we wait.
+		if (yield && scheduler_yield) {
+			scheduler_yield();
+			return;
+		}
+
+		// Otherwise, sleep until something happens. free_transfer() signals an event whenever it frees a
+		// transfer, so a transfer freed since we last looked ends this immediately. We only sleep while the
+		// queue has transfers in flight, whose completion interrupts normally wake us. The host may stop
+		// servicing the endpoint, though; so we also need the timer to wake us by our deadline. If it can't,
+		// we poll.
+		if ((queue->active != NULL) && schedule_wakeup(deadline)) {
+			USB_QUEUE_WAIT_FOR_EVENT();
+		}
+}
+
+static int usb_transfer_schedule_wait_for_slot(
 	const usb_endpoint_t* const endpoint,
 	void* const data,
 	const uint32_t maximum_length,
 	const transfer_completion_cb completion_cb,
 	void* const user_data,
-	uint32_t timeout
+	const uint32_t timeout,
+	const bool yield
 )
 {
+		usb_queue_t* const queue = endpoint_queue(endpoint);
 		uint32_t time_base = get_time();
-		int ret = -1;
 
-		while (ret) {
+		while (true) {
 
 			// Repeatedly try to schedule a transfer until one succeeds or we time out.
-			ret = usb_transfer_schedule(endpoint,
+			int ret = usb_transfer_schedule(endpoint,
 					data, maximum_length, completion_cb, user_data);
+			if (!ret) {
+				return 0;
+			}
 
 			// And enforce our timeout.
 			if (get_time_since(time_base) > timeout) {
 				return ETIMEDOUT;
 			}
+
+			usb_queue_wait_for_free_transfer(queue, time_base + timeout, yield);
 		}
-		return 0;
+}
+
+int usb_transfer_schedule_wait(
+	const usb_endpoint_t* const endpoint,
+	void* const data,
+	const uint32_t maximum_length,
+	const transfer_completion_cb completion_cb,
+	void* const user_data,
+	uint32_t timeout
+)
+{
+		return usb_transfer_schedule_wait_for_slot(endpoint, data, maximum_length,
+				completion_cb, user_data, timeout, false);
+}
+
+/**
+ * Variant of usb_transfer_schedule_wait() that runs the scheduler's other tasks while it waits, if the
+ * scheduler is linked in. Only for use from tasks that can tolerate the other tasks running re-entrantly.
+ */
+int usb_transfer_schedule_wait_yielding(
+	const usb_endpoint_t* const endpoint,
+	void* const data,
+	const uint32_t maximum_length,
+	const transfer_completion_cb completion_cb,
+	void* const user_data,
+	uint32_t timeout
+)
+{
+		return usb_transfer_schedule_wait_for_slot(endpoint, data, maximum_length,
+				completion_cb, user_data, timeout, true);
 }
 
 
@@ -195,6 +534,219 @@ int usb_transfer_schedule_ack(
 
 
 
+/* Returns the transfer permanently bound to the given ring chunk. */
+static usb_transfer_t* usb_ring_transfer(
+		usb_ring_t* const ring,
+		const unsigned int chunk
+) {
+		return &ring->queue->pool[chunk % ring->chunk_count];
+}
+
+/* Returns a pointer to the data for the given ring chunk. */
+static uint8_t* usb_ring_chunk_data(
+		usb_ring_t* const ring,
+		const unsigned int chunk
+) {
+		return ring->buffer + ((chunk % ring->chunk_count) * ring->chunk_size);
+}
+
+/* Hands every chunk that the application doesn't hold to the controller.
+ * Must be called with interrupts disabled.
+ */
+static void usb_ring_arm_pending(
+		usb_ring_t* const ring
+) {
+		// OUT chunks belong to the controller until they've been filled; IN chunks once they've been committed.
+		unsigned int limit = ring->is_in ? ring->returned : ring->returned + ring->chunk_count;
+
+		while (ring->armed != limit) {
+				usb_transfer_t* const transfer = usb_ring_transfer(ring, ring->armed);
+				uint32_t length = ring->is_in ? transfer->maximum_length : ring->chunk_size;
+
+				usb_transfer_prepare(transfer, usb_ring_chunk_data(ring, ring->armed), length, true, NULL, NULL);
+				usb_queue_submit_transfer(ring->queue, transfer);
+				ring->armed++;
+		}
+}
+
+/* Called from the completion path as each of a ring's chunks is retired.
+ * Chunks the controller didn't finish are marked as discarded, so they're never handed to the application as data.
+ */
+static void usb_ring_chunk_complete(
+		usb_ring_t* const ring,
+		usb_transfer_t* const transfer,
+		const bool finished,
+		const bool rearm
+) {
+		unsigned int transferred = usb_transfer_bytes_transferred(transfer);
+
+		transfer->discarded = !finished;
+		ring->completed++;
+
+		if (ring->chunk_cb) {
+				ring->chunk_cb(ring->user_data, transferred);
+		}
+
+		// Keep the controller fed; any chunk released while this one was in flight can now be re-armed.
+		if (rearm) {
+				usb_ring_arm_pending(ring);
+		}
+}
+
+/**
+ * Places an endpoint in ring-streaming mode. The buffer is split into chunk_count chunks of
+ * chunk_size bytes, each of which is bound to one of the endpoint queue's transfers for as long
+ * as the ring runs. OUT rings start with every chunk armed to receive; IN rings start empty,
+ * and transmit each chunk once it's committed with usb_ring_advance().
+ *
+ * @param chunk_cb Optional; called from the completion path as each chunk completes.
+ * @return 0 on success; EINVAL if the ring doesn't fit the endpoint's queue or a chunk doesn't fit a
+ *	transfer descriptor; or EBUSY if the endpoint has transfers in flight or is already streaming.
+ */
+int usb_ring_start(
+	usb_ring_t* const ring,
+	const usb_endpoint_t* const endpoint,
+	void* const buffer,
+	const uint32_t chunk_size,
+	const unsigned int chunk_count,
+	const transfer_completion_cb chunk_cb,
+	void* const user_data
+)
+{
+		usb_queue_t* const queue = endpoint_queue(endpoint);
+
+		if ((queue == NULL) || (chunk_count == 0) || (chunk_count > queue->pool_size)) {
+			return EINVAL;
+		}
+		for (unsigned int i = 0; i < chunk_count; ++i) {
+			if (!usb_transfer_fits((uint8_t *)buffer + (i * chunk_size), chunk_size)) {
+				return EINVAL;
+			}
+		}
+
+		cm_disable_interrupts();
+
+		if (queue->active || queue->ring) {
+			cm_enable_interrupts();
+			return EBUSY;
+		}
+
+		ring->queue = queue;
+		ring->buffer = buffer;
+		ring->chunk_size = chunk_size;
+		ring->chunk_count = chunk_count;
+		ring->is_in = (endpoint->address & 0x80) != 0;
+		ring->armed = 0;
+		ring->completed = 0;
+		ring->returned = 0;
+		ring->chunk_cb = chunk_cb;
+		ring->user_data = user_data;
+
+		// The ring owns the endpoint while it runs; so claim every transfer, leaving none for usb_transfer_schedule.
+		usb_queue_build_free_list(queue, queue->pool_size);
+		queue->ring = ring;
+
+		usb_ring_arm_pending(ring);
+		cm_enable_interrupts();
+
+		return 0;
+}
+
+/**
+ * Stops a ring, discarding any chunks in flight, and returns its endpoint to normal operation.
+ */
+void usb_ring_stop(
+	usb_ring_t* const ring
+)
+{
+		usb_queue_t* const queue = ring->queue;
+
+		usb_endpoint_flush(queue->endpoint);
+
+		cm_disable_interrupts();
+		queue->ring = NULL;
+		usb_queue_build_free_list(queue, 0);
+		cm_enable_interrupts();
+}
+
+/**
+ * @return The number of chunks the application can currently use: filled chunks waiting to be read,
+ *	for OUT rings; or empty chunks waiting to be filled, for IN rings. For OUT rings, this includes
+ *	any chunks discarded by a flush, which usb_ring_current_chunk() skips.
+ */
+unsigned int usb_ring_chunks_available(
+	usb_ring_t* const ring
+)
+{
+		if (ring->is_in) {
+			return ring->chunk_count - (ring->returned - ring->completed);
+		} else {
+			return ring->completed - ring->returned;
+		}
+}
+
+/**
+ * Fetches the next chunk the application should read (OUT) or fill (IN).
+ *
+ * OUT chunks that were discarded by a flush (or aborted by an error) before the controller filled them
+ * hold no data; they're released back to the ring rather than returned.
+ *
+ * @param length Out; receives the number of bytes received into the chunk (OUT), or the chunk's size (IN).
+ * @return The chunk's data, or NULL if no chunk is currently available.
+ */
+void* usb_ring_current_chunk(
+	usb_ring_t* const ring,
+	uint32_t* const length
+)
+{
+		if (!ring->is_in) {
+			while (usb_ring_chunks_available(ring) && usb_ring_transfer(ring, ring->returned)->discarded) {
+				cm_disable_interrupts();
+				ring->returned++;
+				usb_ring_arm_pending(ring);
+				cm_enable_interrupts();
+			}
+		}
+
+		if (!usb_ring_chunks_available(ring)) {
+			return NULL;
+		}
+
+		if (length) {
+			*length = ring->is_in ? ring->chunk_size :
+				usb_transfer_bytes_transferred(usb_ring_transfer(ring, ring->returned));
+		}
+
+		return usb_ring_chunk_data(ring, ring->returned);
+}
+
+/**
+ * Hands the current chunk back to the ring: releasing it to be re-filled (OUT), or committing it
+ * for transmission (IN).
+ *
+ * @param length The number of bytes to transmit from the chunk; ignored for OUT rings.
+ */
+void usb_ring_advance(
+	usb_ring_t* const ring,
+	const uint32_t length
+)
+{
+		if (!usb_ring_chunks_available(ring)) {
+			return;
+		}
+
+		if (ring->is_in) {
+			usb_ring_transfer(ring, ring->returned)->maximum_length =
+				(length < ring->chunk_size) ? length : ring->chunk_size;
+		}
+
+		cm_disable_interrupts();
+		ring->returned++;
+		usb_ring_arm_pending(ring);
+		cm_enable_interrupts();
+}
+
+
 /* Called when an endpoint might have completed a transfer */
 static void usb_queue_clean_up_transfers(usb_endpoint_t const * endpoint, bool include_active)
 {
@@ -205,6 +757,9 @@ static void usb_queue_clean_up_transfers(usb_endpoint_t const * endpoint, bool i
 
 		usb_transfer_t* transfer = queue->active;
 
+		// Let completion callbacks tell transfers we're discarding from ones the controller finished.
+		queue->flushing = include_active;
+
 		while (transfer != NULL) {
 				uint8_t status = transfer->td.total_bytes;
 				bool aborting = false;
@@ -214,14 +769,17 @@ static void usb_queue_clean_up_transfers(usb_endpoint_t const * endpoint, bool i
 				// Check for failures
 				if (status & USB_TD_DTD_TOKEN_STATUS_HALTED) {
 					pr_error("usb error:transaction reports halted status! aborting.\n");
+					queue->statistics.halted_errors++;
 					aborting = true;
 				}
 				if (status & USB_TD_DTD_TOKEN_STATUS_BUFFER_ERROR) {
 					pr_error("usb error:transaction reports buffer error! aborting.\n");
+					queue->statistics.buffer_errors++;
 					aborting = true;
 				}
 				if (status & USB_TD_DTD_TOKEN_STATUS_TRANSACTION_ERROR) {
 					pr_error("usb error:transaction reports transaction error! aborting.\n");
+					queue->statistics.transaction_errors++;
 					aborting = true;
 				}
 
@@ -249,14 +807,37 @@ static void usb_queue_clean_up_transfers(usb_endpoint_t const * endpoint, bool i
 				// FIXME: add in an error callback, which should do the below instead of us
 				// in the event of an error!
 
+				// Only transfers the controller actually finished count towards our completion statistics.
+				bool finished = !aborting && !td_is_active;
+				if (finished) {
+					usb_queue_record_latency(queue, transfer);
+				}
+
 				// Advance the head. We need to do this before invoking the completion
 				// callback as it might attempt to schedule a new transfer
 				queue->active = transfer->next;
 				usb_transfer_t* next = transfer->next;
+				if (next == NULL) {
+					queue->tail = NULL;
+				}
+				queue->active_count--;
+
+				// Ring transfers belong to their chunk for good; hand them back to the ring rather than freeing them.
+				// Transfers retired by a flush aren't re-armed; the ring resumes when the application next advances it.
+				if (queue->ring) {
+						usb_ring_chunk_complete(queue->ring, transfer, finished, !include_active);
+						transfer = next;
+						continue;
+				}
 
 				// Invoke completion callback
-				unsigned int total_bytes = (transfer->td.total_bytes & USB_TD_DTD_TOKEN_TOTAL_BYTES_MASK) >> USB_TD_DTD_TOKEN_TOTAL_BYTES_SHIFT;
-				unsigned int transferred = transfer->maximum_length - total_bytes;
+				unsigned int transferred = transfer->chain_transferred + usb_transfer_bytes_transferred(transfer);
+
+				// If this is part of a scatter-gather chain, carry our progress forward; the chain's
+				// final transfer reports the total.
+				if (transfer->chained && next)
+						next->chain_transferred = transferred;
+
 				if (transfer->completion_cb)
 						transfer->completion_cb(transfer->user_data, transferred);
 
@@ -264,6 +845,8 @@ static void usb_queue_clean_up_transfers(usb_endpoint_t const * endpoint, bool i
 				free_transfer(transfer);
 				transfer = next;
 		}
+
+		queue->flushing = false;
 }
 
 
@@ -279,3 +862,13 @@ void usb_queue_flush_endpoint(const usb_endpoint_t* const endpoint)
 		cm_enable_interrupts();
 }
 
+/**
+ * @return True iff the endpoint's transfers are currently being discarded by a flush; for use from
+ *	completion callbacks, which are also invoked for discarded transfers.
+ */
+bool usb_queue_flushing(const usb_endpoint_t* const endpoint)
+{
+		usb_queue_t* const queue = endpoint_queue(endpoint);
+		return queue && queue->flushing;
+}
+
@@ -143,6 +143,18 @@ void platform_timer_enable(timer_t *timer);
 uint32_t platform_timer_get_value(timer_t *timer);
 
 
+/**
+ * Arranges for the given timer to raise a one-shot interrupt once its counter reaches the given value;
+ * which wakes the core, if it's sleeping. Arming a wakeup replaces any the timer already had pending.
+ *
+ * @param timer The timer to be used.
+ * @param value The counter value at which the wakeup should occur.
+ *
+ * @return 0 on success, or an error number on failure
+ */
+int platform_timer_schedule_wakeup(timer_t *timer, uint32_t value);
+
+
 /**
  * @returns A reference to the system's platform timer -- initializing the relevant timer, if needed.
  */
@@ -7,12 +7,55 @@
 #ifndef __LIBGREAT_COMMS_BACKEND_H__
 #define __LIBGREAT_COMMS_BACKEND_H__
 
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <drivers/usb/usb_type.h>
+#include <drivers/usb/usb_request.h>
+
 // FIXME: move me
 #define LIBGREAT_USB_COMMAND_REQUEST 0x65
 
 usb_request_status_t libgreat_comms_vendor_request_handler(
 	usb_endpoint_t* const endpoint, const usb_transfer_stage_t stage);
 
+/**
+ * Selects whether commands are executed directly from the USB interrupt (the default),
+ * or deferred to a scheduler task.
+ *
+ * In deferred mode, the interrupt only captures each command; the host's request for the
+ * response is NAK'd until the command has run. This keeps long-running verbs from stalling
+ * other USB traffic and interrupts, but requires the firmware to run the scheduler.
+ *
+ * @param enabled True iff commands should be executed from the scheduler.
+ */
+void libgreat_comms_set_deferred_execution(bool enabled);
+
+
+/**
+ * Attaches a registered comms pipe to a pair of USB bulk endpoints, which will carry its data.
+ * Each endpoint should have a queue initialized with usb_queue_init().
+ *
+ * @param pipe_number The number of the pipe to be attached; see comms_register_pipe().
+ * @param in_endpoint The endpoint used to send data to the host; or NULL for a receive-only pipe.
+ * @param out_endpoint The endpoint used to receive data from the host; or NULL for a transmit-only pipe.
+ * @param receive_buffer The buffer into which data from the host will be received; passed to the pipe's
+ *		handle_data_in operation. Must remain valid as long as the pipe is in use, and be no larger than a
+ *		single transfer descriptor can address (16KiB, if page-aligned).
+ * @param receive_buffer_size The size of the receive buffer, in bytes.
+ *
+ * @return 0 on success, or an error number on failure
+ */
+int libgreat_comms_attach_usb_pipe(uint32_t pipe_number, usb_endpoint_t *in_endpoint,
+	usb_endpoint_t *out_endpoint, void *receive_buffer, uint32_t receive_buffer_size);
+
+
+/**
+ * Starts communication on each of the pipes attached to USB. Should be called each time
+ * the pipes' endpoints are (re-)initialized; e.g. once the host has configured the device.
+ */
+void libgreat_comms_start_usb_pipes(void);
+
 #endif
 
 
@@ -11,8 +11,48 @@
 
 typedef struct _usb_transfer_t usb_transfer_t;
 typedef struct _usb_queue_t usb_queue_t;
+typedef struct _usb_ring_t usb_ring_t;
 typedef void (*transfer_completion_cb)(void*, unsigned int);
 
+/**
+ * A single buffer in a scatter-gather transfer; see usb_transfer_schedule_segments().
+ * Each segment occupies a single transfer descriptor, and so can't span more than five
+ * 4 KiB pages.
+ */
+typedef struct {
+	void* data;
+	uint32_t length;
+} usb_transfer_segment_t;
+
+/**
+ * The number of buckets in each queue's latency histogram. Bucket N counts transfers that completed
+ * within (64 << 2N) microseconds of being scheduled; the final bucket counts everything slower.
+ * See usb_queue_latency_bucket_limits.
+ */
+#define USB_QUEUE_LATENCY_BUCKETS (8)
+
+/**
+ * Running statistics for an endpoint's queue; see usb_queue_read_statistics().
+ */
+typedef struct {
+	uint32_t scheduled;
+	uint32_t completed;
+	uint32_t max_depth;
+
+	// Transfers retired with each of the controller's error statuses.
+	uint32_t halted_errors;
+	uint32_t buffer_errors;
+	uint32_t transaction_errors;
+
+	// Transfers that completed successfully, by time from scheduling to completion.
+	uint32_t latency_histogram[USB_QUEUE_LATENCY_BUCKETS];
+} usb_queue_statistics_t;
+
+/**
+ * The upper bound of each latency histogram bucket, in microseconds.
+ */
+extern const uint32_t usb_queue_latency_bucket_limits[USB_QUEUE_LATENCY_BUCKETS];
+
 // This is an opaque datatype. Thou shall not touch these members.
 struct _usb_transfer_t {
         struct _usb_transfer_t* next;
@@ -21,28 +61,83 @@ struct _usb_transfer_t {
         struct _usb_queue_t* queue;
         transfer_completion_cb completion_cb;
         void* user_data;
+
+        // Set if this transfer is followed by the remaining segments of a scatter-gather
+        // chain; and the number of bytes the chain had moved before this transfer.
+        bool chained;
+        unsigned int chain_transferred;
+
+        // The time at which the transfer was queued; for the queue's latency statistics.
+        uint32_t scheduled_time;
+
+        // Set on ring transfers retired without being finished by the controller -- discarded by a flush,
+        // or aborted by an error -- whose chunks hold no valid data; see usb_ring_current_chunk().
+        bool discarded;
 };
 
 // This is an opaque datatype. Thou shall not touch these members.
 struct _usb_queue_t {
         struct usb_endpoint_t* endpoint;
         const unsigned int pool_size;
+        usb_transfer_t* pool;
         usb_transfer_t* volatile free_transfers;
         usb_transfer_t* volatile active;
+
+        // The last transfer in the active list, and the number of transfers in it;
+        // tracked so transfers can be appended without walking the list.
+        usb_transfer_t* volatile tail;
+        volatile unsigned int active_count;
+
+        // The ring this queue is streaming, if it's in ring mode; see usb_ring_start().
+        usb_ring_t* volatile ring;
+
+        // Set while the queue's transfers are being discarded by a flush; see usb_queue_flushing().
+        volatile bool flushing;
+
+        usb_queue_statistics_t statistics;
 };
 
+/**
+ * State for an endpoint in ring-streaming mode. A circular buffer is split into equal chunks, each
+ * permanently bound to one of the endpoint queue's transfers. Every chunk the application isn't
+ * using is kept armed, and chunks are re-armed from the completion path; so the controller always
+ * has descriptors queued, and data streams without gaps or per-chunk allocation.
+ *
+ * All counts increase monotonically (and wrap); chunk N lives at index (N % chunk_count).
+ * This is an opaque datatype. Thou shall not touch these members.
+ */
+struct _usb_ring_t {
+        usb_queue_t* queue;
+        uint8_t* buffer;
+        uint32_t chunk_size;
+        unsigned int chunk_count;
+        bool is_in;
+
+        // Chunks handed to the controller; chunks the controller has finished with; and chunks the
+        // application has handed back -- released after reading (OUT) or committed after filling (IN).
+        volatile unsigned int armed;
+        volatile unsigned int completed;
+        volatile unsigned int returned;
+
+        // Optional callback, invoked from the completion path as each chunk completes.
+        transfer_completion_cb chunk_cb;
+        void* user_data;
+};
 #define USB_DECLARE_QUEUE(endpoint_name)                                \
         struct _usb_queue_t endpoint_name##_queue;
 #define USB_DEFINE_QUEUE(endpoint_name, _pool_size)                     \
         struct _usb_transfer_t endpoint_name##_transfers[_pool_size];   \
         struct _usb_queue_t endpoint_name##_queue = {                   \
                 .endpoint = &endpoint_name,                             \
+                .pool = endpoint_name##_transfers,                      \
                 .free_transfers = endpoint_name##_transfers,            \
                 .pool_size = _pool_size                                 \
         };
 
 void usb_queue_flush_endpoint(const usb_endpoint_t* const endpoint);
 
+bool usb_queue_flushing(const usb_endpoint_t* const endpoint);
+
 int usb_transfer_schedule(
 	const usb_endpoint_t* const endpoint,
 	void* const data,
@@ -51,6 +146,14 @@ int usb_transfer_schedule(
         void* const user_data
 );
 
+int usb_transfer_schedule_segments(
+	const usb_endpoint_t* const endpoint,
+	const usb_transfer_segment_t* const segments,
+	const unsigned int segment_count,
+	const transfer_completion_cb completion_cb,
+	void* const user_data
+);
+
 int usb_transfer_schedule_block(
 	const usb_endpoint_t* const endpoint,
 	void* const data,
@@ -68,10 +171,59 @@ int usb_transfer_schedule_wait(
 	uint32_t timeout
 );
 
+/**
+ * As usb_transfer_schedule_wait(); but runs the scheduler's other tasks while waiting, if the scheduler
+ * is linked in. Only for use from tasks that can tolerate the other tasks running in the meantime.
+ */
+int usb_transfer_schedule_wait_yielding(
+	const usb_endpoint_t* const endpoint,
+	void* const data,
+	const uint32_t maximum_length,
+	const transfer_completion_cb completion_cb,
+	void* const user_data,
+	uint32_t timeout
+);
+
 int usb_transfer_schedule_ack(
 	const usb_endpoint_t* const endpoint
 );
 
+int usb_ring_start(
+	usb_ring_t* const ring,
+	const usb_endpoint_t* const endpoint,
+	void* const buffer,
+	const uint32_t chunk_size,
+	const unsigned int chunk_count,
+	const transfer_completion_cb chunk_cb,
+	void* const user_data
+);
+
+void usb_ring_stop(
+	usb_ring_t* const ring
+);
+
+unsigned int usb_ring_chunks_available(
+	usb_ring_t* const ring
+);
+
+void* usb_ring_current_chunk(
+	usb_ring_t* const ring,
+	uint32_t* const length
+);
+
+void usb_ring_advance(
+	usb_ring_t* const ring,
+	const uint32_t length
+);
+
+int usb_queue_read_statistics(
+	const uint8_t controller,
+	const uint8_t endpoint_address,
+	usb_queue_statistics_t* const statistics,
+	unsigned int* const depth,
+	const bool clear
+);
+
 void usb_queue_init(
         usb_queue_t* const queue
 );
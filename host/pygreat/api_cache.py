@@ -0,0 +1,176 @@
+#
+# This file is part of libgreat
+#
+
+"""
+On-disk cache of the API descriptions read from libgreat devices; which allows reconnecting to a
+device running firmware we've seen before to skip autoenumeration entirely.
+"""
+
+from __future__ import absolute_import
+
+import os
+import sys
+import json
+import hashlib
+import tempfile
+
+from .comms import CommsClassDescription, CommsVerbDescription
+
+
+class CommsApiCache(object):
+    """
+    Class representing a directory of cached API descriptions.
+
+    Each entry holds the CommsClassDescriptions produced by autoenumerating a device; and is keyed
+    by the device's board ID and firmware version string. Devices that report the same board ID and
+    version string are assumed to expose the same API -- unless the device can report a hash of its
+    API (see CommsBackend.read_api_hash), in which case the hash must match as well.
+    """
+
+    """ Environment variable that overrides the cache directory. Setting it to an empty string disables caching. """
+    DIRECTORY_VARIABLE = "PYGREAT_API_CACHE_DIR"
+
+    """ Revision of the on-disk format; entries written in any other format are ignored. """
+    CACHE_FORMAT_REVISION = 2
+
+
+    @classmethod
+    def default(cls):
+        """ Returns the default API cache for the current user; or None if caching has been disabled. """
+
+        directory = os.environ.get(cls.DIRECTORY_VARIABLE)
+
+        if directory is None:
+            directory = cls._default_directory()
+        if not directory:
+            return None
+
+        return cls(directory)
+
+
+    @staticmethod
+    def _default_directory():
+        """ Returns the platform's conventional location for per-user cache files. """
+
+        if sys.platform == 'win32':
+            base = os.environ.get('LOCALAPPDATA', os.path.expanduser('~'))
+        elif sys.platform == 'darwin':
+            base = os.path.expanduser('~/Library/Caches')
+        else:
+            base = os.environ.get('XDG_CACHE_HOME') or os.path.expanduser('~/.cache')
+
+        return os.path.join(base, 'pygreat', 'apis')
+
+
+    def __init__(self, directory):
+        """
+        Args:
+            directory -- The directory that holds the cache's entries. Created when the first entry is stored.
+        """
+        self.directory = directory
+
+
+    def _path_for(self, board_id, version):
+        """ Returns the path of the entry for the given board ID and version string. """
+
+        # Version strings are free-form; so name entries after a digest of the version rather than the string itself.
+        digest = hashlib.sha1(version.encode('utf-8')).hexdigest()[:16]
+        return os.path.join(self.directory, "board-{:08x}-{}.json".format(board_id, digest))
+
+
+    def load(self, board_id, version, api_hash=None):
+        """ Fetches the API descriptions cached for the given board ID and firmware version.
+
+        Args:
+            api_hash -- The hash of the device's current API, if it can provide one. If provided,
+                entries are only used if they were stored with the same hash.
+
+        Returns a list of CommsClassDescription; or None if no usable entry exists.
+        """
+
+        try:
+            with open(self._path_for(board_id, version), 'r') as f:
+                entry = json.load(f)
+
+            # Ensure the entry is one we can read, and that it wasn't produced for a version whose digest collides.
+            if (entry['revision'] != self.CACHE_FORMAT_REVISION) or (entry['board_id'] != board_id) or \
+                    (entry['version'] != version):
+                return None
+
+            # If we know the device's API hash, don't trust entries that describe a different API; e.g. from a
+            # development build that didn't bump its version string.
+            if (api_hash is not None) and (entry.get('api_hash') != api_hash):
+                return None
+
+            return [self._description_from_dict(description) for description in entry['classes']]
+
+        # A missing, unreadable or corrupt entry is just a cache miss; we'll enumerate the device instead.
+        except (IOError, OSError, ValueError, KeyError, TypeError):
+            return None
+
+
+    def store(self, board_id, version, descriptions, api_hash=None):
+        """ Caches the API descriptions for the given board ID and firmware version; and, optionally,
+        the hash of the API they describe.
+
+        Returns true iff the descriptions were stored. Failures to write the cache aren't fatal;
+        the device will just be enumerated again next time.
+        """
+
+        entry = {
+            'revision': self.CACHE_FORMAT_REVISION,
+            'board_id': board_id,
+            'version':  version,
+            'api_hash': api_hash,
+            'classes':  [self._description_to_dict(description) for description in descriptions],
+        }
+
+        try:
+            if not os.path.isdir(self.directory):
+                os.makedirs(self.directory)
+
+            # Write the entry to a temporary file, and then move it into place; so anyone else reading the cache
+            # (e.g. another process connecting to an identical board) never sees a partial entry.
+            handle, temporary_path = tempfile.mkstemp(dir=self.directory, suffix='.tmp')
+            try:
+                with os.fdopen(handle, 'w') as f:
+                    json.dump(entry, f)
+
+                # os.replace is atomic and overwrites on every platform; but python2 only has os.rename.
+                getattr(os, 'replace', os.rename)(temporary_path, self._path_for(board_id, version))
+            except:
+                os.remove(temporary_path)
+                raise
+
+        except (IOError, OSError):
+            return False
+
+        return True
+
+
+    def invalidate(self, board_id, version):
+        """ Removes any cached API descriptions for the given board ID and firmware version. """
+
+        try:
+            os.remove(self._path_for(board_id, version))
+        except (IOError, OSError):
+            pass
+
+
+    @staticmethod
+    def _description_to_dict(description):
+        """ Converts a CommsClassDescription into a form that can be stored as JSON. """
+
+        result = dict(description._asdict())
+        result['verbs'] = [dict(verb._asdict()) for verb in description.verbs]
+
+        return result
+
+
+    @staticmethod
+    def _description_from_dict(description):
+        """ Converts a stored class description back into a CommsClassDescription. """
+
+        verbs = [CommsVerbDescription(**verb) for verb in description['verbs']]
+        return CommsClassDescription(description['number'], description['name'], description['doc'], verbs)
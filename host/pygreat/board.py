@@ -8,11 +8,14 @@ Module containing the core definitions for a libgreat-driven board.
 
 # FIXME: remove dependencies
 import usb
+import zlib
 import future
 import time
+import collections
 
 # Use the GreatFET comms API, and the standard (core) API.
 from pygreat.comms import CommsBackend
+from pygreat.api_cache import CommsApiCache
 
 from .errors import DeviceNotFoundError
 
@@ -24,6 +27,17 @@ RECONNECT_DELAY = 3
 # FIXME: remove
 LIBUSB_PIPE_ERROR = 32
 
+
+UsbQueueStatistics = collections.namedtuple('UsbQueueStatistics',
+        'depth max_depth scheduled completed halted_errors buffer_errors transaction_errors latency_histogram')
+UsbQueueStatistics.__doc__ = \
+    """ Statistics for one of a board's USB endpoint queues; see GreatBoard.read_usb_queue_statistics.
+
+    The latency histogram is a list of (limit_us, count) tuples: each counts the transfers that completed
+    within limit_us microseconds of being scheduled, but not within the previous bucket's limit. The final
+    bucket's limit is None; it counts every slower transfer.
+    """
+
 class GreatBoard(object):
     """
     Class representing a USB-connected GreatFET device.
@@ -52,6 +66,13 @@ class GreatBoard(object):
     RESET_REQUEST_MAINTAIN_ALWAYS_ON_DOMAIN = 2
     RESET_REQUEST_POST_FIRMWARE_FLASH = 3
 
+    """
+    The cache used to skip autoenumeration when reconnecting to a board whose firmware we've seen
+    before; see CommsApiCache. If None, the current user's default cache is used; set this to False
+    to always enumerate.
+    """
+    api_cache = None
+
     @classmethod
     def autodetect(cls, **device_identifiers):
         """
@@ -95,6 +116,45 @@ class GreatBoard(object):
         Returns a list of GreatFET devices, which may be empty if none are found.
         """
 
+        devices = cls._find_all_devices(**device_identifiers)
+
+        # Ensure each device has its comms objects fully populated.
+        for device in devices:
+            device.initialize_apis()
+
+        # Return the list of all subclasses.
+        return devices
+
+
+    @classmethod
+    def autodetect_fleet(cls, max_workers=None, **device_identifiers):
+        """
+        Connects to every board present on the system -- as autodetect_all does -- but initializes
+        their APIs in parallel, and returns them as a GreatBoardFleet; which can issue commands to
+        each of them in parallel.
+
+        Accepts the same arguments as pyusb's usb.find() method, allowing narrowing
+        to a more specific set of boards.
+
+        Args:
+            max_workers -- The maximum number of boards to initialize at once; or None for all of them.
+        """
+
+        from .fleet import GreatBoardFleet
+
+        fleet = GreatBoardFleet(cls._find_all_devices(**device_identifiers))
+        fleet.initialize_apis(max_workers=max_workers)
+
+        return fleet
+
+
+    @classmethod
+    def _find_all_devices(cls, **device_identifiers):
+        """
+        Creates an instance of the most applicable GreatBoard subclass for each board present on the
+        system; without initializing their APIs. See autodetect_all.
+        """
+
         devices = []
 
         # Iterate over each subclass of GreatFETBoard until we find a board
@@ -110,11 +170,6 @@ class GreatBoard(object):
             # things are USB connected.
             devices.extend(subclass_devices)
 
-        # Ensure each device has its comms objects fully populated.
-        for device in devices:
-            device.initialize_apis()
-
-        # Return the list of all subclasses.
         return devices
 
 
@@ -260,8 +315,28 @@ class GreatBoard(object):
             we have comms up and running and auto-enumeration is complete.
         """
 
-        # Run the auto-enumeration.
-        self.comms.run_autoenumeration()
+        cache = CommsApiCache.default() if self.api_cache is None else self.api_cache
+
+        if not cache:
+            self.comms.run_autoenumeration()
+            return
+
+        # Boards with the same ID and firmware version expose the same API; so if we've seen this
+        # combination before, recreate its API objects from the cache rather than enumerating them.
+        board_id = self.board_id()
+        version = self.firmware_version()
+        api_hash = self.comms.read_api_hash()
+
+        descriptions = cache.load(board_id, version, api_hash)
+        if descriptions is not None:
+            self.comms.generate_apis_from_descriptions(descriptions)
+            return
+
+        # Otherwise, describe the device's whole API, so we can remember it for next time. Its classes
+        # are still only generated as they're used.
+        descriptions = self.comms.read_api_descriptions()
+        self.comms.generate_apis_from_descriptions(descriptions)
+        cache.store(board_id, version, descriptions, api_hash)
 
 
     def supports_api(self, class_name):
@@ -312,6 +387,83 @@ class GreatBoard(object):
         self.__init__(**self.identifiers)
         self.initialize_apis()
 
+    def program_firmware(self, image, address=0, chunk_size=None, progress_callback=None):
+        """ Programs a firmware image into the board's flash, using the firmware API's streaming update verbs.
+
+        The image is sent in large chunks, which are queued up asynchronously; the board erases ahead of the data,
+        and programs and verifies each page on its own. Only the final digest is read back.
+
+        Args:
+            image -- The image to be programmed, as a byte-string.
+            address -- The address at which the image should be programmed; aligned to the flash's erase size.
+            chunk_size -- The amount of image data to send per command; or None to send as much as fits.
+            progress_callback -- If provided, called as progress_callback(bytes_sent, total_bytes) after each chunk.
+
+        Returns the CRC32 of the programmed image. Raises an IOError if the board's flash doesn't match the image.
+        After programming, the board should typically be reset with reset(is_post_firmware_flash=True).
+        """
+
+        firmware = self.apis.firmware
+        image = bytes(image)
+
+        page_size, _ = firmware.stream_begin(address, len(image))
+
+        # By default, send the largest whole number of pages that fits in a command: after the command's prelude
+        # and the chunk's offset.
+        if chunk_size is None:
+            chunk_size = self.comms.LIBGREAT_MAX_COMMAND_SIZE - 12
+            chunk_size = (chunk_size // page_size) * page_size or chunk_size
+
+        # Queue up each chunk at once; so the board can be programming one while we're sending the next.
+        # Chunks have no response, so we don't wait to hear whether each succeeded; if any fails, the board
+        # abandons the update, and reports the failure when we finish.
+        pending = []
+        for offset in range(0, len(image), chunk_size):
+            chunk = image[offset:offset + chunk_size]
+            pending.append((offset + len(chunk), firmware.stream_write(offset, chunk, asynchronous=True)))
+
+        for bytes_sent, future in pending:
+            future.result()
+
+            if progress_callback:
+                progress_callback(bytes_sent, len(image))
+
+        length, crc = firmware.stream_finish()
+        expected_crc = zlib.crc32(image) & 0xFFFFFFFF
+
+        if (length != len(image)) or (crc != expected_crc):
+            raise IOError("firmware verification failed: board programmed {} bytes with CRC32 {:08x}; expected {} bytes "
+                    "with CRC32 {:08x}".format(length, crc, len(image), expected_crc))
+
+        return crc
+
+
+    def read_usb_queue_statistics(self, endpoint_address, controller=0, clear=False):
+        """ Reads the statistics the board keeps for one of its USB endpoint queues: its depth, how many transfers
+        it's completed, what errors it's seen, and how long its transfers took to complete.
+
+        Args:
+            endpoint_address -- The address of the endpoint, including its direction bit; e.g. 0x81 for EP1 IN.
+            controller -- The board's USB controller that owns the endpoint.
+            clear -- If true, the board's statistics for the endpoint are reset after they're read.
+
+        Returns a UsbQueueStatistics.
+        """
+
+        if not self.supports_api('usb_statistics'):
+            raise NotImplementedError("this board's firmware doesn't keep USB queue statistics")
+
+        api = self.apis.usb_statistics
+        read = api.get_and_clear_endpoint_statistics if clear else api.get_endpoint_statistics
+
+        response = read(controller, endpoint_address)
+        counters, histogram = response[:7], response[7:]
+
+        # The final bucket has no upper bound; the board reports it as the largest possible latency.
+        limits = [(limit if limit != 0xFFFFFFFF else None) for limit in api.get_latency_bucket_limits()]
+        return UsbQueueStatistics(*counters, latency_histogram=list(zip(limits, histogram)))
+
+
     def reset(self, reconnect=True, switch_to_external_clock=False,
             is_post_firmware_flash=False, maintain_always_on_domain=False):
         """
@@ -339,6 +491,9 @@ class GreatBoard(object):
         except usb.core.USBError:
             pass
 
+        # Anything we've cached about the device's state is now stale.
+        self.comms.invalidate_response_cache()
+
         # If we're to attempt a reconnect, do so.
         if reconnect:
             time.sleep(RECONNECT_DELAY)
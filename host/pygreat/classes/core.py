@@ -3,7 +3,8 @@
 # This file is part of libgreat
 #
 
-from ..comms import CommsClass, command_rpc
+from ..comms import CommsClass, CommsFormat, CommsClassDescription, CommsVerbDescription, CommandFailureError, \
+    command_rpc
 
 
 class CoreAPI(CommsClass):
@@ -19,9 +20,19 @@ class CoreAPI(CommsClass):
     VERB_DESCRIPTOR_DOC = 2
     VERB_DESCRIPTOR_OUT_PARAM_NAMES = 3
     VERB_DESCRIPTOR_IN_PARAM_NAMES = 4
+    VERB_DESCRIPTOR_FLAGS = 5
+
+    """ Special class number that requests descriptions of every class; see read_class_descriptions. """
+    DESCRIBE_ALL_CLASSES = 0xFFFFFFFF
+
+    # Formats for the parts of a serialized class description; see get_class_description.
+    _DESCRIPTION_COUNT_FORMAT = CommsFormat("<I")
+    _DESCRIPTION_CLASS_FORMAT = CommsFormat("<I2SI")
+    _DESCRIPTION_VERB_FORMAT  = CommsFormat("<I7S")
 
     # RPC that reads the board ID
-    read_board_id = command_rpc(verb_number=0x0, out_format="<I", name="read_board_id", out_parameter_names=["id"])
+    read_board_id = command_rpc(verb_number=0x0, out_format="<I", name="read_board_id", out_parameter_names=["id"],
+            cacheable=True)
     read_board_id.__doc__ = \
         """Fetches the board's type identifier.
            A type identifiers uniquely identifies what model of board this is. 
@@ -29,10 +40,12 @@ class CoreAPI(CommsClass):
 
     # RPC that reads the version
     read_version_string = command_rpc(verb_number = 0x1, out_format="<S", 
-            name="read_version_string", out_parameter_names=["version"], doc="Fetches the board's version.")
+            name="read_version_string", out_parameter_names=["version"], doc="Fetches the board's version.",
+            cacheable=True)
 
     # RPC that reads the part ID
-    read_part_id = command_rpc(verb_number=0x2, out_format="<2I", name="read_part_id", out_parameter_names=["part_id"])
+    read_part_id = command_rpc(verb_number=0x2, out_format="<2I", name="read_part_id", out_parameter_names=["part_id"],
+            cacheable=True)
     read_part_id.__doc__ = \
         """Fetches the part ID used on the board.
         
@@ -42,7 +55,7 @@ class CoreAPI(CommsClass):
 
     # RPC that fetches the serial number
     read_serial_number = command_rpc(verb_number=0x3, out_format="<4I",
-            name="read_serial_number", out_parameter_names=["serial_number"])
+            name="read_serial_number", out_parameter_names=["serial_number"], cacheable=True)
     read_serial_number.__doc__ = \
         """Fetches the board's serial number.
         
@@ -52,17 +65,35 @@ class CoreAPI(CommsClass):
 
     # Introspection API.
     get_available_classes = command_rpc(verb_number=0x4, out_format="<*I",
-            name= "get_available_classes", out_parameter_names=["numbers"], doc="Fetches the available class numbers.")
+            name= "get_available_classes", out_parameter_names=["numbers"], doc="Fetches the available class numbers.",
+            cacheable=True)
     get_available_verbs = command_rpc(verb_number=0x5, in_format="<I", out_format="<*I", name= "get_available_verbs", 
-            in_parameter_names=["class_number"], out_parameter_names=["numbers"], doc="Fetches the available verb numbers for a given class.")
+            in_parameter_names=["class_number"], out_parameter_names=["numbers"], doc="Fetches the available verb numbers for a given class.",
+            cacheable=True)
     get_verb_name = command_rpc(verb_number=0x6, in_format="<II", out_format="<S",
-            name= "get_verb_name", out_parameter_names=["name"], doc="Fetches the string name for the given verb.")
+            name= "get_verb_name", out_parameter_names=["name"], doc="Fetches the string name for the given verb.",
+            cacheable=True)
     get_verb_descriptor = command_rpc(verb_number=0x7, in_format="<IIB", out_format="<S",
-            name= "get_verb_descriptor", out_parameter_names=["descriptor"], doc="Fetches the information about the given verb.") #FIXME: expand docstring
+            name= "get_verb_descriptor", out_parameter_names=["descriptor"], doc="Fetches the information about the given verb.", #FIXME: expand docstring
+            cacheable=True)
     get_class_name = command_rpc(verb_number=0x8, in_format="<I", out_format="<S",
-            name= "get_class_name", out_parameter_names=["name"], doc="Fetches the string name for the given class.")
+            name= "get_class_name", out_parameter_names=["name"], doc="Fetches the string name for the given class.",
+            cacheable=True)
     get_class_docs = command_rpc(verb_number=0x9, in_format="<I", out_format="<S",
-            name= "get_class_docs", out_parameter_names=["docstring"], doc="Fetches for documentation the given class.")
+            name= "get_class_docs", out_parameter_names=["docstring"], doc="Fetches for documentation the given class.",
+            cacheable=True)
+    get_available_pipes = command_rpc(verb_number=0xa, in_format="<I", out_format="<*I", name="get_available_pipes",
+            in_parameter_names=["class_number"], out_parameter_names=["numbers"], doc="Fetches the numbers of the pipes owned by a given class.")
+    get_pipe_info = command_rpc(verb_number=0xb, in_format="<I", out_format="<III", name="get_pipe_info",
+            in_parameter_names=["pipe_number"], out_parameter_names=["class_number", "flags", "address"],
+            doc="Fetches the owning class, flags, and transport-specific address for the given pipe.")
+    get_class_description = command_rpc(verb_number=0xc, in_format="<II", out_format="<I*X", name="get_class_description",
+            in_parameter_names=["class_number", "offset"], out_parameter_names=["total_length", "description"],
+            doc="Fetches part of the serialized description of a class -- or every class. See read_class_descriptions.",
+            cacheable=True)
+    get_api_hash = command_rpc(verb_number=0xd, out_format="<Q", name="get_api_hash", out_parameter_names=["hash"],
+            doc="Fetches a 64-bit hash of the device's API; which changes whenever any class or verb description does.",
+            cacheable=True)
 
     def get_verb_in_signature(self, class_number, verb_number):
         """ Fetches the given verb's in-signature. """
@@ -84,6 +115,63 @@ class CoreAPI(CommsClass):
         """ Fetches the given verb's out-param names. """
         return self.get_verb_descriptor(class_number, verb_number, self.VERB_DESCRIPTOR_OUT_PARAM_NAMES)
 
+    def get_verb_flags(self, class_number, verb_number):
+        """ Fetches the given verb's flags, as a comma-delimited string; or '*' if the device can't report them. """
+
+        # Devices that predate verb flags reject the descriptor; which just means none of their verbs have flags.
+        try:
+            return self.get_verb_descriptor(class_number, verb_number, self.VERB_DESCRIPTOR_FLAGS)
+        except CommandFailureError:
+            return "*"
+
+    def read_class_descriptions(self, class_number=None):
+        """ Fetches descriptions of a class and its verbs -- or of every class, if class_number is None --
+        in as few requests as possible.
+
+        Returns a list of CommsClassDescription.
+        """
+
+        if class_number is None:
+            class_number = self.DESCRIBE_ALL_CLASSES
+
+        raw_description = bytearray()
+
+        # Read the description a page at a time, until we have all of it.
+        while True:
+            total_length, page = self.get_class_description(class_number, len(raw_description))
+            raw_description.extend(page)
+
+            if (len(raw_description) >= total_length) or not page:
+                break
+
+        return self._parse_class_descriptions(bytes(raw_description))
+
+
+    @classmethod
+    def _parse_class_descriptions(cls, raw_description):
+        """ Parses a serialized class description; see get_class_description. """
+
+        descriptions = []
+
+        def unpack_next(format, offset):
+            fields = []
+            offset = format.unpack_from(raw_description, offset, fields)
+            return fields, offset
+
+        (class_count,), offset = unpack_next(cls._DESCRIPTION_COUNT_FORMAT, 0)
+
+        for _ in range(class_count):
+            (number, name, doc, verb_count), offset = unpack_next(cls._DESCRIPTION_CLASS_FORMAT, offset)
+
+            verbs = []
+            for _ in range(verb_count):
+                fields, offset = unpack_next(cls._DESCRIPTION_VERB_FORMAT, offset)
+                verbs.append(CommsVerbDescription(*fields))
+
+            descriptions.append(CommsClassDescription(number, name, doc, verbs))
+
+        return descriptions
+
     # TODO : move debug into this
 
     # FIXME: re-assign verb number or move out of core?
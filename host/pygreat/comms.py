@@ -12,14 +12,24 @@ from future import utils as future_utils
 
 import re
 import sys
+import array
 import struct
 import inspect
+import threading
 import collections
 
+from concurrent.futures import Future
+
 from . import errors
 
 from backports.functools_lru_cache import lru_cache as memoize_with_lru_cache
 
+# numpy is optional; if it's present, integer arrays can be returned as numpy arrays. See execute_command.
+try:
+    import numpy
+except ImportError:
+    numpy = None
+
 
 class CommsError(IOError):
     """ Generic class for libgreat communications errors. """
@@ -27,6 +37,15 @@ class CommsError(IOError):
 class CommandFailureError(CommsError):
     """ Generic class for command failures."""
 
+
+# Descriptions of a device's classes and verbs, as reported by its introspection API. Descriptors the device
+# doesn't provide are represented by the string '*'. A verb's flags are a comma-delimited list of flag names;
+# e.g. 'cacheable'.
+CommsClassDescription = collections.namedtuple('CommsClassDescription', 'number name doc verbs')
+CommsVerbDescription = collections.namedtuple('CommsVerbDescription',
+        'number name in_signature out_signature in_param_names out_param_names doc flags')
+
+
 class CommsBackend(object):
     """
     Class representing an abstract communications channel used to
@@ -36,6 +55,12 @@ class CommsBackend(object):
     """ The maximum input/output buffer size for libgreat commands. """
     LIBGREAT_MAX_COMMAND_SIZE = 4096
 
+    """ Header that precedes each command in a batch; see CommsCommandBatch. """
+    LIBGREAT_BATCH_COMMAND_HEADER = struct.Struct("<IIII")
+
+    """ Header that precedes each command's response in the response to a batch. """
+    LIBGREAT_BATCH_RESPONSE_HEADER = struct.Struct("<II")
+
     """ Regular expression that identifies special fields for .pack and .unpack. """
     _SPECIAL_FIELD_REGEX = r"((?:[\d*]*[SX])|(?:\*\w)|(?:[\d*]*\([cbB?hHiIlLqQfdspPSX]+\)))"
 
@@ -69,18 +94,33 @@ class CommsBackend(object):
 
     @classmethod
     def from_device_uri(cls, **device_uri):
-        """ Creates a CommsBackend object apporpriate for the given device_uri.  """
+        """ Creates a CommsBackend object apporpriate for the given device_uri.
+
+        The backend is selected by the 'backend' entry, which defaults to 'usb':
+            usb -- A USB-connected device; see USBCommsBackend.
+            simulator -- A host build of the firmware's communications core; see SimulatorCommsBackend.
+
+        All other entries are passed to the backend.
+        """
 
         #FIXME: implment this properly
 
         from .comms_backends.usb import USBCommsBackend
+        from .comms_backends.simulator import SimulatorCommsBackend
+
+        backends = {
+            'usb': USBCommsBackend,
+            'simulator': SimulatorCommsBackend,
+        }
 
         # TODO: handle providing board "URIs", like "usb://1234abcd/?param=value",
         # and automatic resolution to a backend?
-        # TODO: support more than USB
+        backend = device_uri.pop('backend', 'usb')
+
+        if backend not in backends:
+            raise ValueError("unknown comms backend '{}'".format(backend))
 
-        # XXX: for now, just create a USB backend, as that's all we support
-        return USBCommsBackend(**device_uri)
+        return backends[backend](**device_uri)
 
 
     def __init__(self, **device_arguments):
@@ -94,11 +134,23 @@ class CommsBackend(object):
         from pygreat.classes.core import CoreAPI
 
         # Create a dictionary that will store references to our low-level/raw board APIs.
-        self.apis = collections.OrderedDict()
+        self.apis = CommsApiDictionary()
 
         # Populate our core API, which is always present.
         self.apis['core'] = CoreAPI(self)
 
+        # Commands can be issued from both the caller's thread and from the thread that executes
+        # asynchronous commands; ensure they take turns talking to the device.
+        self._comms_lock = threading.RLock()
+        self._async_executor = None
+
+        # Whether the device can describe its API in bulk; or None if we haven't yet asked.
+        self._supports_class_descriptions = None
+        self._supports_api_hash = None
+
+        # Raw responses to cacheable commands, keyed by (class_number, verb, payload, max_response_length).
+        self._response_cache = {}
+
 
     def generate_api_object(self):
         """ Generates an object that gives us a view of all API methods
@@ -111,17 +163,99 @@ class CommsBackend(object):
         return CommsApiCollection(self.apis)
 
 
-    def run_autoenumeration(self, overwrite=False):
+    def run_autoenumeration(self, overwrite=False, lazy=True):
         """ Uses the Core Introspection API to determine the accessible APIs
             and automatically genereate RPC stubs in the .api accessor.
+
+        Args:
+            overwrite -- If true, existing class definitions will be overwritten.
+            lazy -- If true, each class's RPC stubs are only generated when the class is first used;
+                see CommsApiDictionary. If the device can't describe its API in bulk, only the class
+                names are read up front; each class is described when it's first used.
+
+        Returns the list of CommsClassDescription the stubs were generated from; which can be passed
+        to generate_apis_from_descriptions to recreate them without talking to the device. Returns
+        None if lazy enumeration left some classes undescribed.
+        """
+
+        # If the device can describe its whole API at once, use that; it takes far fewer round trips.
+        descriptions = self._read_class_descriptions()
+
+        if descriptions is None:
+
+            # If we're to describe classes as they're used, and we can't describe them all at once, defer describing them.
+            if lazy:
+                self._generate_pending_objects_for_classes(overwrite)
+                return None
+
+            descriptions = self.read_api_descriptions(overwrite)
+
+        self.generate_apis_from_descriptions(descriptions, overwrite, lazy)
+
+        return descriptions
+
+
+    def read_api_descriptions(self, overwrite=False):
+        """ Uses the Core Introspection API to describe each of the device's classes.
+
+        Args:
+            overwrite -- If false, classes that already have an object associated with them may be
+                omitted from the result, as describing them would be wasted effort.
+
+        Returns a list of CommsClassDescription.
         """
 
-        # Fetch all of the available class numbers.
+        # If the device can describe its whole API at once, use that; it takes far fewer round trips.
+        descriptions = self._read_class_descriptions()
+        if descriptions is not None:
+            return descriptions
+
+        descriptions = []
+
+        # Otherwise, fetch all of the available class numbers...
         class_numbers = self.apis['core'].get_available_classes()
 
-        # And process each one.
+        # And describe each one we don't already have an object for.
         for class_number in class_numbers:
-            self._generate_object_for_class(class_number)
+            class_name = future_utils.native_str(self.apis['core'].get_class_name(class_number))
+
+            if (class_name in self.apis) and not overwrite:
+                continue
+
+            descriptions.append(self._describe_class(class_number))
+
+        return descriptions
+
+
+    def generate_apis_from_descriptions(self, descriptions, overwrite=False, lazy=True):
+        """ Generates RPC stubs in the .api accessor from a list of CommsClassDescription;
+            e.g. as returned by run_autoenumeration.
+
+        Args:
+            lazy -- If true, each class's RPC stubs are only generated when the class is first used.
+        """
+
+        for description in descriptions:
+            self._generate_object_from_description(description, overwrite, lazy)
+
+
+    def _generate_pending_objects_for_classes(self, overwrite=False):
+        """ Registers each of the device's classes by name, deferring describing and generating
+            each class until it's first used.
+        """
+
+        core_api = self.apis['core']
+
+        for class_number in core_api.get_available_classes():
+            class_name = future_utils.native_str(core_api.get_class_name(class_number))
+
+            if (class_name in self.apis) and not overwrite:
+                continue
+
+            def generate(class_number=class_number):
+                return self._create_object_from_description(self._describe_class(class_number))
+
+            self.apis.add_pending(class_name, generate)
 
 
 
@@ -140,371 +274,275 @@ class CommsBackend(object):
             filled with RPC methods
         """
 
-        # Get the name / docstring for the given class.
-        class_name = self.apis['core'].get_class_name(class_number)
-        class_docs = self.apis['core'].get_class_docs(class_number)
+        # Get the name for the given class.
+        class_name = future_utils.native_str(self.apis['core'].get_class_name(class_number))
+
+        # If we already have an object for the given class,
+        # and we're not in overwrite mode, skip enumerating it.
+        if class_name in self.apis:
+            if not overwrite:
+                return
+
+        self._generate_object_from_description(self._describe_class(class_number), overwrite)
+
+
+    def _generate_object_from_description(self, description, overwrite=False, lazy=False):
+        """ Generates a python class containing RPCs for a libgreat class, from its CommsClassDescription.
+        See _generate_object_for_class.
+
+        Args:
+            lazy -- If true, the class is only generated when it's first used.
+        """
 
         # Ensure that the class name is a string type that can be a class name.
         # This ensures python2 compatibility.
-        class_name = future_utils.native_str(class_name)
+        class_name = future_utils.native_str(description.name)
 
         # If we already have an object for the given class,
-        # and we're not in overwrite mode, skip enumerating it.
+        # and we're not in overwrite mode, skip it.
         if class_name in self.apis:
             if not overwrite:
                 return
 
+        if lazy:
+            self.apis.add_pending(class_name, lambda: self._create_object_from_description(description))
+        else:
+            self.apis[class_name] = self._create_object_from_description(description)
+
+
+    def _create_object_from_description(self, description):
+        """ Creates an instance of a python class containing RPCs for a libgreat class, from its CommsClassDescription. """
+
+        class_name = future_utils.native_str(description.name)
+
         # Get a set of RPC verbs for the given class, which will become our
         # class's methods.
-        attrs = self._generate_rpc_verbs_for_class(class_number, class_name)
+        attrs = self._generate_rpc_verbs_from_descriptions(description.verbs, class_name)
 
         # Each comms class needs a CLASS_NUMBER attribute, and should have a
         # CLASS_NAME attribute. We'll add ours.
-        attrs['CLASS_NUMBER'] = class_number
+        attrs['CLASS_NUMBER'] = description.number
         attrs['CLASS_NAME'] = class_name
 
         # Generat a documentation string for the given class.
         attrs['__doc__'] = \
-                'Autogenerated class for the {} API class:\n{}'.format(class_name, class_docs)
+                'Autogenerated class for the {} API class:\n{}'.format(class_name, description.doc)
 
         # Generate a class around the relevant verbs.
         cls = type(class_name, (GeneratedCommsClass,), attrs)
 
-        # Finally, instantiate and store the relevant class.
-        self.apis[class_name] = cls(self)
-
-    @staticmethod
-    def _parse_rpc_param_names_string(name_string):
-        """ Parses a comma-separated command string into a list of names. """
-
-        # Special case: if we got '*', the names are too complex for us.
-        # Return None.
-        if name_string == "*":
-            return None
-
-        # Break the name into its component parts.
-        names = name_string.split(',')
-        return [name.strip() for name in names]
-
+        # Finally, instantiate the relevant class.
+        return cls(self)
 
 
-    def _generate_rpc_verbs_for_class(self, class_number, class_name = "class"):
-        """ Uses the Core Introspection API to generate RPCs for each of the verbs
-            supported by a given class.
-        Args:
-            class_number -- The class number to generate RPCs for.
+    def read_api_hash(self):
+        """ Reads a hash of the device's API, which can be used to check whether a previously enumerated
+        API (e.g. one from a CommsApiCache) still matches the device.
 
-        Returns:
-            a dictionary mapping verb names to yet-unbound method objects
+        Returns the hash as an integer; or None if the device can't provide one.
         """
 
-        rpcs = {}
-        core_api = self.apis['core']
-
-        # Get the name for the given class.
-        verb_numbers = core_api.get_available_verbs(class_number)
-
-        # Iterate over each of the verbs and build an RPC for them.
-        for verb_number in verb_numbers:
-
-            # Fetch the information necessary to build the verb RPC.
-            name            = core_api.get_verb_name(class_number, verb_number)
-            in_signature    = core_api.get_verb_in_signature(class_number, verb_number)
-            out_signature   = core_api.get_verb_out_signature(class_number, verb_number)
-            documentation   = core_api.get_verb_documentation(class_number, verb_number)
-            in_param_names  = core_api.get_verb_in_param_names(class_number, verb_number)
-            out_param_names = core_api.get_verb_out_param_names(class_number, verb_number)
-
-            # FIXME: automatically generate docs
-
-            # If the arguments are too complex for our auto-generation, or no
-            # signatures were provided, the device will respond with the special-case value '*'.
-            # We'll skip these.
-            if (in_signature == '*') or (out_signature == '*'):
-                continue
-
-            # Provide a nice disclaimer if the method is undocumented on the firmware side.
-            if documentation == '*':
-                documentation = "{undocumented on firmware side}"
-
-            # Parse any parameter names the device knows about.
-            in_param_names = self._parse_rpc_param_names_string(in_param_names)
-            out_param_names = self._parse_rpc_param_names_string(out_param_names)
-
-            # Build the relevant RPCs.
-            rpcs[name] = command_rpc(verb_number, in_signature, out_signature, name=name, class_name=class_name,
-                    doc=documentation, in_parameter_names=in_param_names, out_parameter_names=out_param_names)
+        if self._supports_api_hash is False:
+            return None
 
-        return rpcs
+        try:
+            api_hash = self.apis['core'].get_api_hash()
+        except CommandFailureError:
 
+            # As with bulk introspection, older devices won't know this verb; remember that they don't.
+            if self._supports_api_hash is None:
+                self._supports_api_hash = False
+                return None
 
-    @classmethod
-    def _split_struct_string(cls, format_string):
-        """ Splits a libgreat pack/unpack format string into groups
-            that can be passed to a subordinate handler function.
-        """
+            raise
 
-        # Split the pack string into a list of format string chunks to handle.
-        strings_to_handle = re.split(cls._SPECIAL_FIELD_REGEX, format_string)
+        self._supports_api_hash = True
+        return api_hash
 
-        # Return all of the non-empty sections.
-        return [s for s in strings_to_handle if s]
 
+    def _read_class_descriptions(self, class_number=None):
+        """ Reads the description of a class -- or of every class, if class_number is None -- in bulk.
 
-    @classmethod
-    def _is_special_format(cls, format_string):
-        """ Returns true iff the given format string represents one of
-            our extensions to struct.pack.
+        Returns a list of CommsClassDescription; or None if the device can't describe its API in bulk.
         """
-        return re.match(cls._SPECIAL_FIELD_REGEX + "$", format_string)
 
+        if self._supports_class_descriptions is False:
+            return None
 
-    @classmethod
-    def _format_string_argument_count(cls, format_string):
-        """ Returns the number of arguments that will be consumed by
-            the given format string. Format strings must not contain '*'.
-        """
+        try:
+            descriptions = self.apis['core'].read_class_descriptions(class_number)
+        except CommandFailureError:
 
-        total = 0
+            # If this is the first time we've asked, the device likely predates bulk introspection,
+            # and rejected the verb. Remember that, so we don't keep asking.
+            if self._supports_class_descriptions is None:
+                self._supports_class_descriptions = False
+                return None
 
-        # Get all of the non-padding struct arguments.
-        elements = re.findall(cls._FORMAT_FIELD_REGEX, format_string)
+            raise
 
-        # Iterate over each of the matches, and update the count accordingly.
-        for repeat_count, element_type, element_group in elements:
+        self._supports_class_descriptions = True
+        return descriptions
 
-            # Special case: if this is an string or as-is specifier,
-            # it should only consume a single argument no matter how many
-            # are grabbed.
-            will_conglomerate = element_type in "Xsp"
 
-            # If we have a repeat specifier, parse it and include it.
-            # Otherwise, this will consume only a single argument.
-            if repeat_count and not will_conglomerate:
-                total += int(count)
-            else:
-                total += 1
+    def _describe_class(self, class_number):
+        """ Uses the Core Introspection API to generate a CommsClassDescription for the given class. """
 
-        return total
+        # Prefer a bulk description, if the device can provide one.
+        descriptions = self._read_class_descriptions(class_number)
+        if descriptions:
+            return descriptions[0]
 
+        core_api = self.apis['core']
 
-    @classmethod
-    def _split_off_arguments_for_format(cls, format_string, arguments):
-        """ Splits off the number of arguments necessary to handle the
-            given format string.
+        # Otherwise, ask about each piece of information individually.
+        class_name = core_api.get_class_name(class_number)
+        class_docs = core_api.get_class_docs(class_number)
+        verbs = [self._describe_verb(class_number, verb_number) for verb_number in core_api.get_available_verbs(class_number)]
 
-            Returns:
-                a 2-tuple of args_consumed, args_remaining
-        """
+        return CommsClassDescription(class_number, class_name, class_docs, verbs)
 
-        # Special case: if the format string starts with '*',
-        # it consumes all remaining arguments.
-        if format_string.startswith('*'):
-            return arguments, []
 
-        # Determine how many arguments we'll need to consume...
-        args_to_consume = cls._format_string_argument_count(format_string)
+    def _describe_verb(self, class_number, verb_number):
+        """ Uses the Core Introspection API to generate a CommsVerbDescription for the given verb. """
 
-        # ... and split them accordingly.
-        args_consumed = arguments[0:args_to_consume]
-        args_remaining = arguments[args_to_consume:]
-        return args_consumed, args_remaining
+        core_api = self.apis['core']
 
+        return CommsVerbDescription(
+            number          = verb_number,
+            name            = core_api.get_verb_name(class_number, verb_number),
+            in_signature    = core_api.get_verb_in_signature(class_number, verb_number),
+            out_signature   = core_api.get_verb_out_signature(class_number, verb_number),
+            in_param_names  = core_api.get_verb_in_param_names(class_number, verb_number),
+            out_param_names = core_api.get_verb_out_param_names(class_number, verb_number),
+            doc             = core_api.get_verb_documentation(class_number, verb_number),
+            flags           = core_api.get_verb_flags(class_number, verb_number),
+        )
 
-    @classmethod
-    def _get_bytes_consumed_by_group_format(cls, format_string, raw_bytes):
-        """ Returns the number of bytes consumed by a given grouped
-            format string. Accepts format strings that do not begin with '*'.
 
-            Intended for use by _get_bytes_consumed_by_format.
-        """
+    @staticmethod
+    def _parse_rpc_param_names_string(name_string):
+        """ Parses a comma-separated command string into a list of names. """
 
-        total_bytes_consumed = 0
+        # Special case: if we got '*', the names are too complex for us.
+        # Return None.
+        if name_string == "*":
+            return None
 
-        # Break the group specifier into its components.
-        element_matches = re.match(cls._FORMAT_FIELD_REGEX, format_string)
-        repeat_count, element_type, element_group = element_matches.groups()
+        # Break the name into its component parts.
+        names = name_string.split(',')
+        return [name.strip() for name in names]
 
-        # Figure out the number of times this subformat will repeat.
-        if repeat_count is None:
-            repeat_count = 1
-        else:
-            repeat_count = int(repeat_count)
 
+    @staticmethod
+    def _parse_verb_flags_string(flags_string):
+        """ Parses a verb's comma-separated flags string into a set of flag names. """
 
-        # Figure out how many bytes each subgroup will take.
-        # Note that we can't simply request the length once and then
-        # multiply out, as some format strings are dependent on the
-        # data they're parsing.
-        for _ in range(repeat_count):
+        if flags_string == "*":
+            return set()
 
-            # Get the bytes consumed by this individual, non-group subformat.
-            bytes_consumed = cls._get_bytes_consumed_by_format(element_group, raw_bytes)
+        return set(flag.strip() for flag in flags_string.split(',') if flag.strip())
 
-            # And advance by the relevant number of bytes to repeat properly.
-            raw_string = raw_string[bytes_consumed:]
-            total_bytes_consumed += bytes_consumed
 
-        return total_bytes_consumed
 
+    def _generate_rpc_verbs_for_class(self, class_number, class_name = "class"):
+        """ Uses the Core Introspection API to generate RPCs for each of the verbs
+            supported by a given class.
+        Args:
+            class_number -- The class number to generate RPCs for.
 
+        Returns:
+            a dictionary mapping verb names to yet-unbound method objects
+        """
+        return self._generate_rpc_verbs_from_descriptions(self._describe_class(class_number).verbs, class_name)
 
 
+    def _generate_rpc_verbs_from_descriptions(self, verb_descriptions, class_name = "class"):
+        """ Generates RPCs for each of a class's verbs, from their CommsVerbDescriptions.
 
-    @classmethod
-    def _get_bytes_consumed_by_format(cls, format_string, raw_bytes):
-        """ Returns the number of bytes consumed by a given
-            format string.
+        Returns:
+            a dictionary mapping verb names to yet-unbound method objects
         """
 
-        # Special case: if the format string starts with a '*',
-        # we take all of the remaining bytes.
-        if format_string.startswith('*'):
-            return len(raw_bytes)
-
-        # Special case: if the format string represents a group,
-        # we'll need to handle it recursively.
-        if format_string.endswith(')'):
-            return self._get_bytes_consumed_by_group_format(format_string, raw_bytes)
-
-        # Special case: if the format string represents a string,
-        # it'll take up to the first NULL.
-        if format_string.endswith('S'):
-            null_pos = raw_bytes.find(b"\0")
+        rpcs = {}
 
-            # If we have no NULL, the whole string is to be consumed.
-            if null_pos == -1:
-                return len(raw_bytes)
-            # Otherwise, it's the length with the NULL.
-            else:
-                return null_pos + 1
+        # Iterate over each of the verbs and build an RPC for them.
+        for verb in verb_descriptions:
 
+            verb_number     = verb.number
+            name            = verb.name
+            in_signature    = verb.in_signature
+            out_signature   = verb.out_signature
+            documentation   = verb.doc
+            in_param_names  = verb.in_param_names
+            out_param_names = verb.out_param_names
+            flags           = self._parse_verb_flags_string(verb.flags)
 
-        # If this is a binary/as-is string, read the specifier
-        # as its length.
-        if format_string.endswith('X'):
+            # FIXME: automatically generate docs
 
-            # Parse the format string, extracting the relevant fields.
-            match = re.match(cls._FORMAT_FIELD_REGEX, format_string)
+            # If the arguments are too complex for our auto-generation, or no
+            # signatures were provided, the device will respond with the special-case value '*'.
+            # We'll skip these.
+            if (in_signature == '*') or (out_signature == '*'):
+                continue
 
-            # If we didn't have a prefix, this is only a byte.
-            if match[1] is None:
-                return 1
-            else:
-                return int(match[1])
+            # Provide a nice disclaimer if the method is undocumented on the firmware side.
+            if documentation == '*':
+                documentation = "{undocumented on firmware side}"
 
+            # Parse any parameter names the device knows about.
+            in_param_names = self._parse_rpc_param_names_string(in_param_names)
+            out_param_names = self._parse_rpc_param_names_string(out_param_names)
 
-        # Sanity check: this string doesn't contain a string.
-        if ('S' in format_string) or ('X' in format_string) or ('*' in format_string):
-            raise ValueError("internal consistency error -- called with a " +
-                             "type that shouldn't be possible!")
+            # Build the relevant RPCs.
+            rpcs[name] = command_rpc(verb_number, in_signature, out_signature, name=name, class_name=class_name,
+                    doc=documentation, in_parameter_names=in_param_names, out_parameter_names=out_param_names,
+                    cacheable=('cacheable' in flags))
 
-        # Otherwise, ask the format string module for how long this is,
-        # as this is as plain section.
-        return struct.calcsize(format_string)
+        return rpcs
 
 
     @classmethod
-    def _split_off_bytes_for_format(cls, format_string, raw_bytes):
-        """ Splits off the bytes necessary to handle the
-            given format string.
-
-            Returns:
-                a 2-tuple of bytes_consumed, bytes_remaining
-        """
-
-        # Figure out how many bytes are consumed by the format...
-        num_bytes_consumed = cls._get_bytes_consumed_by_format(format_string, raw_bytes)
-
-        # ... and split the bytes off accordingly.
-        bytes_consumed = raw_bytes[0:num_bytes_consumed]
-        bytes_remaining = raw_bytes[num_bytes_consumed:]
-        return bytes_consumed, bytes_remaining
+    def compile_format(cls, format_string, as_arrays=None):
+        """ Compiles a libgreat pack/unpack format string into a reusable CommsFormat codec.
 
+        Compiled formats are cached, so compiling the same format string repeatedly is cheap.
+        Already-compiled formats are returned as-is, unless as_arrays asks for a different variant.
 
-    @classmethod
-    def _pack_group(cls, format_string, args):
-        """ Handles packing of a group subformat, which groups
-            a pack string using parenthesis.
+        Args:
+            as_arrays -- If true, variable-length integer arrays (e.g. '*H') are unpacked into a single
+                array; see CommsFormat.
         """
 
-        # Break the group specifier into its components.
-        element_matches = re.match(cls._FORMAT_FIELD_REGEX, format_string)
-        repeat_count, element_type, element_group = element_matches.groups()
-
-        # If we have a repeat count, repeat this the appropriate number of times.
-        if repeat_count:
-
-            result = b""
+        if isinstance(format_string, CommsFormat):
+            if (as_arrays is None) or (format_string.as_arrays == as_arrays):
+                return format_string
 
-            # If we're not repeating infinitely, validate our count.
-            if repeat_count != '*':
-                if int(repeat_count) != len(args):
-                    raise ValueError("Unexpected number of repeated-groups provided!")
+            format_string = format_string.format_string
 
-            # For each tuple of arguments in our arg-tuple,
-            # repeat the parse.
-            for arguments in args:
-                result += cls.pack(element_group, *arguments)
+        return cls._compile_format_string(format_string, bool(as_arrays))
 
-            return result
 
-        # Otherwise, this is just a single group; consume its arguments.
-        else:
-            return cls.pack(element_group, *args)
+    @staticmethod
+    @memoize_with_lru_cache(maxsize=512)
+    def _compile_format_string(format_string, as_arrays=False):
+        """ Memoized helper for compile_format. """
+        return CommsFormat(format_string, as_arrays)
 
 
     @classmethod
-    def _unpack_group(cls, format_string, raw_bytes):
-        """ Handles packing of a group subformat, which groups
-            a pack string using parenthesis.
+    def _out_format_returning_arrays(cls, out_format):
+        """ Returns the variant of an out_format that unpacks integer arrays into arrays; see execute_command.
+            Formats that we don't parse ourselves (e.g. callables) are returned unchanged.
         """
 
-        import math
-
-        # Break the group specifier into its components.
-        element_matches = re.match(cls._FORMAT_FIELD_REGEX, format_string)
-        repeat_count, element_type, element_group = element_matches.groups()
-
-        # If we have a repeat count, repeat this the appropriate number of times.
-        if repeat_count:
-
-            result = []
-
-            # If we're not repeating infinitely, parse is as an integer and
-            # validate our count.
-            if repeat_count != '*':
-                repeat_count = int(repeat_count)
-                if repeat_count != len(args):
-                    raise ValueError("Unexpected number of repeated-groups provided!")
-            # Otherwise, use a repeat_count of infinity.
-            else:
-                repeat_count = math.inf
-
-            # While we have bytes left to parse, and we haven't consumed all
-            # of our repeats, unpack each chunk of bytes.
-            while raw_bytes and repeat_count:
-
-                # Split off the bytes for the relevant subgroup.
-                bytes_consumed, raw_bytes = \
-                        cls._split_off_bytes_for_format(element_group, raw_bytes)
-
-                # Parse the subgroup, and add it to our resultant list.
-                result.append(cls.unpack(element_group, bytes_consumed))
-
-                # And decrement our total repeat count.
-                repeat_count -= 1
+        if out_format and isinstance(out_format, (CommsFormat,) + tuple(future_utils.string_types)):
+            return cls.compile_format(out_format, as_arrays=True)
 
-
-            return result
-
-        # Otherwise, this is just a single group; consume its arguments.
-        else:
-            return cls.pack(element_group, *args)
+        return out_format
 
 
     @classmethod
-    @memoize_with_lru_cache(maxsize=128)
     def pack(cls, format_string, *args):
         """ Extended version of struct.pack() for libgreat communciations.
 
@@ -528,46 +566,13 @@ class CommsBackend(object):
             (BH) -- would accept a tuple of a uint8 and a uint16
 
         Grouped arguments are especially useful with repeat count 'prefixes'.
-        """
-
-        # Break the format string into chunks we can handle.
-        # These chunks can either be passed into struct.pack or into one
-        # of our local packing functions.
-        subformats = cls._split_struct_string(format_string)
-
-        # Build a byte-string from each sub-format.
-        result = b""
-        for subformat in subformats:
-            args_consumed, args = cls._split_off_arguments_for_format(subformat, args)
-
-            # If this is one of our special formats, handle it.
-            if cls._is_special_format(subformat):
-
-                # If this is a group, recurse and handle the subformat.
-                if subformat.endswith(')'):
-                    result += cls._pack_group(subformat, args_consumed)
-                # If this is a string subformat, handle it.
-                elif subformat.endswith('S'):
-                    result += c_string_arguments('UTF-8', *args_consumed)
-                elif subformat.endswith('X'):
-                    result += bytes(args_consumed[0])
-                else:
-                    result += int_array_arguments(subformat[-1], *args_consumed)
-
 
-            # Otherwise, it's a standard pack format; pack it.
-            else:
-                # We always pack/unpack things using standard-sized little endian.
-                if not subformat.startswith('<'):
-                    subformat = '<' + subformat
-
-                result += struct.pack(subformat, *args_consumed)
+        The format string may also be a CommsFormat, as returned by compile_format.
+        """
+        return cls.compile_format(format_string).pack(*args)
 
-        # Return the composed byte-string.
-        return result
 
     @classmethod
-    @memoize_with_lru_cache(maxsize=128)
     def unpack(cls, format_string, raw_bytes):
         """ Extended version of struct.unpack() for libgreat communciations.
 
@@ -591,52 +596,10 @@ class CommsBackend(object):
             (BH) -- would parse three bytes into a tuple of a uint8 and a uint16
 
         Grouped arguments are especially useful with repeat count 'prefixes'.
-        """
-
-        # We always pack/unpack things using standard-sized little endian.
-        # If this wasn't specified, assume it.
-        if not format_string.startswith('<'):
-            format_string = '<' + format_string
-
-        # Break the format string into chunks we can handle.
-        # These chunks can either be passed into struct.pack or into one
-        # of our local packing functions.
-        subformats = cls._split_struct_string(format_string)
-
-        # Build a byte-string from each sub-format.
-        results = []
-        for subformat in subformats:
-            bytes_consumed, raw_bytes = cls._split_off_bytes_for_format(subformat, raw_bytes)
-
-            # If this is one of our special formats, handle it.
-            if cls._is_special_format(subformat):
-
-                # If this is a group, recurse and handle the subformat.
-                if subformat.endswith(')'):
-                    results.extend(cls._unpack_group(subformat, bytes_consumed))
-
-                # If this is a string subformat, handle it.
-                elif subformat.endswith('S'):
-                    results.extend(c_string_return(bytes_consumed, 'UTF-8'))
-
-                # If this is an as-is subformat, handle it.
-                elif subformat.endswith('X'):
-                    results.append(bytes_consumed)
-
-                # Otherwise, it's an integer format.
-                else:
-                    results.extend(int_array_return(bytes_consumed, subformat[-1]))
-
-            # Otherwise, it's a standard pack format; unpack it.
-            else:
-                # We always pack/unpack things using standard-sized little endian.
-                if not subformat.startswith('<'):
-                    subformat = '<' + subformat
-
-                results.extend(struct.unpack(subformat, bytes_consumed))
 
-        # Return the generated tuple.
-        return tuple(results)
+        The format string may also be a CommsFormat, as returned by compile_format.
+        """
+        return cls.compile_format(format_string).unpack(raw_bytes)
 
 
     @classmethod
@@ -712,10 +675,18 @@ class CommsBackend(object):
             class_name -- name of the class the command belongs to; for error messages only
             rephase_errors -- true if we should be allowed to rephrase errors that happen in the backend
                 to add more detail
+            as_arrays -- If true, each variable-length integer array in the response (e.g. '*H') is returned
+                as a single array, rather than as individual integers: a read-only numpy array viewing the response,
+                if numpy is available; or an array.array otherwise. This avoids creating a python integer
+                per element; which dominates the cost of reading large sample buffers.
+            cacheable -- If true, the command is known to have no side effects, and its response won't change
+                until the device is reset. Responses are then cached, and repeated calls with the same arguments
+                are answered without contacting the device. See invalidate_response_cache.
 
         The formats used by in_format and out_format can be as follows:
             - A format string in the format accepted by struct.pack;
             - A format string in the format accepted by CommsBackend.pack;
+            - A CommsFormat, as returned by CommsBackend.compile_format;
             - A callable object, which handles the conversion between tuple
               and byte payload itself.
 
@@ -730,6 +701,8 @@ class CommsBackend(object):
         name = kwargs.pop('name', "anonymous")
         class_name = kwargs.pop('class_name', None)
         rephrase_errors = kwargs.pop('rephrase_errors', True)
+        as_arrays = kwargs.pop('as_arrays', False)
+        cacheable = kwargs.pop('cacheable', False)
 
         # Generate a pretty name, which is used in error messages.
         pretty_name = "{}.{}".format(class_name, name) if class_name else name
@@ -737,85 +710,1024 @@ class CommsBackend(object):
         if kwargs:
             raise TypeError("Unexpected keyword arguments: {}".format(kwargs.keys()))
 
-        # Pack our input arguments into a payload.
-        try:
-            if callable(in_format):
-                payload = in_format(*arguments)
-            elif in_format:
-                payload = self.pack(in_format, *arguments)
-            else:
-                payload = b""
-        except Exception as e:
-            # Wrap any exceptions that occur with a more specific method.
-            message = "invalid arguments in call to RPC `{}`; innner message: {}; format: {}".format(name, e, in_format)
-            outer_exception = type(e)(message)
-            future_utils.raise_with_traceback(outer_exception, sys.exc_info()[2])
+        if as_arrays:
+            out_format = self._out_format_returning_arrays(out_format)
+
+        # Pack our input arguments into a payload; directly behind the backend's prelude, if it uses one.
+        prelude = self._build_command_prelude(class_number, verb)
+        payload = self._pack_command_arguments(in_format, arguments, name, prelude)
 
         # If we're not reading a response (e.g. if the output format is empty, or None),
         # truncate the max_response_length to zero. This allows backends to skip waiting for a response, when they can.
         if not out_format:
             max_response_length = 0
 
+        # If we already know the response to this command, there's no need to ask the device.
+        cache_key = self._response_cache_key(class_number, verb, payload, max_response_length) if cacheable else None
+        raw_result = self._response_cache.get(cache_key) if cacheable else None
+
         # Execute the command.
-        raw_result = self.execute_raw_command(class_number, verb, payload, timeout,
-                None, max_response_length, comms_timeout, pretty_name, rephrase_errors)
+        if raw_result is None:
+            with self._comms_lock:
+                raw_result = self.execute_raw_command(class_number, verb, payload, timeout,
+                        None, max_response_length, comms_timeout, pretty_name, rephrase_errors)
+
+                if cacheable and max_response_length:
+                    self._response_cache[cache_key] = bytes(raw_result)
 
         # If a response wasn't possible, we're done!
         if not max_response_length:
             return None
 
-        # Unpack our response into a tuple of result values.
-        try:
-            if callable(out_format):
-                result = out_format(raw_result)
-            elif out_format:
-                result = self.unpack(out_format, raw_result)
-            else:
-                result = tuple()
-        except Exception as e:
+        return self._parse_command_response(raw_result, out_format, encoding, name)
+
+
+    def execute_command_async(self, class_number, verb, in_format, out_format, *arguments, **kwargs):
+        """ Starts execution of a libgreat command, without waiting for it to complete.
+
+        Accepts the same arguments as execute_command. Arguments are packed immediately, so any
+        argument errors are raised here; the command is then issued from a background thread. Commands are
+        executed in the order they're submitted. Commands that queue up while an earlier one is executing are
+        sent to the device together, as a batch, when their responses fit in a single exchange; see
+        CommsAsyncExecutor. Otherwise, commands are still executed one at a time.
+
+        Returns a concurrent.futures.Future, whose result is the command's response, as execute_command
+        would return it. Asyncio code can await the command using asyncio.wrap_future.
+
+        For example::
+
+            futures = [comms.execute_command_async(class_number, verb, "<I", "<I", i) for i in range(64)]
+            results = [future.result() for future in futures]
+        """
+
+        # Emulate python3 keyword-only arguments.
+        timeout  = kwargs.pop('timeout', 1000)
+        encoding = kwargs.pop('encoding', None)
+        max_response_length = kwargs.pop('max_response_length', 4096)
+        comms_timeout = kwargs.pop('comms_timeout', 1000)
+        name = kwargs.pop('name', "anonymous")
+        class_name = kwargs.pop('class_name', None)
+        as_arrays = kwargs.pop('as_arrays', False)
+        cacheable = kwargs.pop('cacheable', False)
+
+        pretty_name = "{}.{}".format(class_name, name) if class_name else name
+
+        if kwargs:
+            raise TypeError("Unexpected keyword arguments: {}".format(kwargs.keys()))
+
+        if as_arrays:
+            out_format = self._out_format_returning_arrays(out_format)
+
+        # Pack our arguments in the caller's thread; so it's overlapped with any commands already in flight.
+        prelude = self._build_command_prelude(class_number, verb)
+        payload = self._pack_command_arguments(in_format, arguments, name, prelude)
+
+        if not out_format:
+            max_response_length = 0
+
+        # Cacheable commands have no side effects; so if we already know a command's response, there's no need
+        # to wait behind any other commands for it. Responses to asynchronous commands aren't added to the cache.
+        if cacheable and max_response_length:
+            raw_result = self._response_cache.get(self._response_cache_key(class_number, verb, payload, max_response_length))
+
+            if raw_result is not None:
+                future = Future()
+                future.set_result(self._parse_command_response(raw_result, out_format, encoding, pretty_name))
+                return future
+
+        # Start our background executor the first time it's needed.
+        if self._async_executor is None:
+            self._async_executor = CommsAsyncExecutor(self)
+
+        return self._async_executor.submit((class_number, verb, payload, max_response_length,
+                out_format, encoding, pretty_name, timeout, comms_timeout,))
+
+
+    def wait_for_async_commands(self):
+        """ Blocks until every command started with execute_command_async has completed. """
+
+        if self._async_executor is not None:
+            self._async_executor.wait()
+
+
+    def _stop_async_executor(self):
+        """ Completes any outstanding asynchronous commands, and then stops the thread that executes them. """
+
+        if self._async_executor is not None:
+            self._async_executor.stop()
+            self._async_executor = None
+
+
+    def invalidate_response_cache(self):
+        """ Discards any cached responses to cacheable commands; see execute_command.
+
+        Cached responses are only valid until the device is reset; so this should be called whenever it is.
+        """
+        self._response_cache.clear()
+
+
+    @staticmethod
+    def _response_cache_key(class_number, verb, payload, max_response_length):
+        """ Returns the key under which the response to a cacheable command is stored. """
+        return (class_number, verb, bytes(payload), max_response_length)
+
+
+    def _build_command_prelude(self, class_number, verb):
+        """ Returns the prelude that identifies a command, which this backend sends ahead of the command's
+        arguments; or None if the backend doesn't send one.
+
+        Backends that provide a prelude receive each command's data as a CommsCommandBuffer that already
+        starts with the prelude; which lets them send it without further copying.
+        """
+        return None
+
+
+    def _pack_command_arguments(self, in_format, arguments, name="anonymous", prelude=None):
+        """ Packs a command's arguments into a payload, per the command's in_format.
+        See execute_command for a description of the accepted formats.
+
+        Args:
+            prelude -- If provided, the payload is packed into a CommsCommandBuffer, following the given prelude.
+        """
+
+        try:
+            if prelude is not None:
+                return self._pack_command_buffer(in_format, arguments, prelude)
+            elif callable(in_format):
+                return in_format(*arguments)
+            elif in_format:
+                return self.pack(in_format, *arguments)
+            else:
+                return b""
+        except Exception as e:
+            # Wrap any exceptions that occur with a more specific method.
+            message = "invalid arguments in call to RPC `{}`; innner message: {}; format: {}".format(name, e, in_format)
+            outer_exception = type(e)(message)
+            future_utils.raise_with_traceback(outer_exception, sys.exc_info()[2])
+
+
+    def _pack_command_buffer(self, in_format, arguments, prelude):
+        """ Packs a command's prelude and arguments into a single CommsCommandBuffer. """
+
+        command = CommsCommandBuffer(prelude)
+
+        if callable(in_format):
+            command.extend(in_format(*arguments))
+        elif in_format:
+            self.compile_format(in_format).pack_into(command, *arguments)
+
+        return command
+
+
+    def _parse_command_response(self, raw_result, out_format, encoding=None, name="anonymous"):
+        """ Parses the raw response to a command into its result values, per the command's out_format.
+        See execute_command for a description of the accepted formats.
+        """
+
+        # Unpack our response into a tuple of result values.
+        try:
+            if callable(out_format):
+                result = out_format(raw_result)
+            elif out_format:
+                result = self.unpack(out_format, raw_result)
+            else:
+                result = tuple()
+        except Exception as e:
             # Wrap any exceptions that occur with a more specific method.
             message = "unexpected return RPC `{}`; innner message: {}; format: {}".format(name, e, out_format)
             outer_exception = type(e)(message)
             future_utils.raise_with_traceback(outer_exception, sys.exc_info()[2])
 
-        # If we have an encoding, convert any byte arguments
-        # into a string.
-        if encoding:
+        # If we have an encoding, convert any byte arguments
+        # into a string.
+        if encoding:
+
+            # Tuples are immutable, so we'll temporarily convert
+            # the relevant result to an integer.
+            result = list(result)
+
+            for index, value in enumerate(result):
+                if isinstance(value, bytes):
+                    result[index] = value.decode(encoding, errors='ignore')
+
+            result = tuple(result)
+
+        # Return the result in a format that makes it easily
+        # intepreted as multiple return values. In most cases, a tuple is returned
+        # when multiple values are possible; and a single value is returned if only
+        # one value is possible.
+        if self._command_results_should_collapse(result, out_format):
+            return result[0]
+        else:
+            return result
+
+
+    @classmethod
+    def _command_results_should_collapse(cls, result, out_format):
+        """ Returns true if the given command result should be collapsed
+            into a single value.
+        """
+
+        # Never collapse non-formats (e.g. callables), for now.
+        if isinstance(out_format, future_utils.string_types):
+            out_format = cls.compile_format(out_format)
+        elif not isinstance(out_format, CommsFormat):
+            return False
+
+        # Collapse if the format describes a single value, and we have exactly a single result.
+        return out_format.collapses_single_result and (len(result) == 1)
+
+
+    def execute_raw_command(self, class_number, verb, data=None, timeout=1000, encoding=None,
+            max_response_length=4096, comms_timeout=1000, pretty_name="unknown", rephrase_errors=True):
+        """Executes a libgreat command.
+
+        Args:
+            class_number -- The class number for the given command.
+                See the GreatFET wiki for a list of class numbers.
+            verb -- The verb number for the given command.
+                See the GreatFET wiki for the given class.
+            data -- Data to be transmitted to the GreatFET.
+            timeout -- Maximum command execution time, in ms.
+            encoding -- If specified, the response data will attempt to be
+                decoded in the provided format.
+            max_response_length -- If less than 4096, this parameter will
+                cut off the provided response at the given length.
+            pretty_name -- String describing the RPC; used for error handling.
+            rephrase_errors -- Allow exceptions to be intercepted and rephrased with more details.
+
+        Returns any data recieved in response.
+        """
+        raise NotImplementedError()
+
+
+    def batch(self):
+        """ Creates a new CommsCommandBatch, which collects commands to be executed on the device
+        in a single exchange. See CommsCommandBatch for usage.
+        """
+        return CommsCommandBatch(self)
+
+
+    def execute_raw_batch(self, raw_batch, timeout=1000, comms_timeout=1000):
+        """ Executes a batch of commands on the device, in a single exchange.
+
+        Args:
+            raw_batch -- The packed batch to be executed; see _pack_raw_batch.
+            timeout -- Maximum execution time for the whole batch, in ms.
+            comms_timeout -- Maximum execution time for communications that do
+                not directly execute the batch.
+
+        Returns the raw response to the batch; see _parse_raw_batch_response.
+        Backends that don't support batching will raise NotImplementedError.
+        """
+        raise NotImplementedError()
+
+
+    @classmethod
+    def _pack_raw_batch(cls, commands):
+        """ Packs a collection of commands into the libgreat batch format.
+
+        Args:
+            commands -- An iterable of (class_number, verb, payload, max_response_length) tuples.
+        """
+
+        raw_batch = bytearray()
+
+        for class_number, verb, payload, max_response_length in commands:
+            raw_batch.extend(cls.LIBGREAT_BATCH_COMMAND_HEADER.pack(class_number, verb, len(payload), max_response_length))
+            raw_batch.extend(payload)
+
+            # Pad each command so the next one starts on a four-byte boundary.
+            raw_batch.extend(b"\0" * (-len(payload) % 4))
+
+        if len(raw_batch) > cls.LIBGREAT_MAX_COMMAND_SIZE:
+            raise ValueError("Batch is too long to be sent in one exchange ({} bytes)!".format(len(raw_batch)))
+
+        return bytes(raw_batch)
+
+
+    @classmethod
+    def _parse_raw_batch_response(cls, raw_response):
+        """ Splits the response to a batch into individual command results.
+
+        Returns:
+            a list of (status, raw_result) tuples; one for each command the device executed
+        """
+
+        results = []
+        header_size = cls.LIBGREAT_BATCH_RESPONSE_HEADER.size
+        position = 0
+
+        while position + header_size <= len(raw_response):
+            status, length = cls.LIBGREAT_BATCH_RESPONSE_HEADER.unpack_from(raw_response, position)
+            position += header_size
+
+            results.append((status, bytes(raw_response[position:position + length]),))
+
+            # Skip the response, and any padding that follows it.
+            position += length + (-length % 4)
+
+        return results
+
+
+    def get_pipes(self, class_number):
+        """ Returns a tuple of the numbers of each of the pipes owned by the given class. """
+        return self.apis['core'].get_available_pipes(class_number)
+
+
+    def open_pipe(self, pipe_number):
+        """ Opens one of the device's pipes, which carry bulk streams of data outside of
+        the command protocol. See get_pipes for finding the pipes owned by a given class.
+
+        Returns a CommsPipe for the given pipe. Backends that don't support pipes will
+        raise NotImplementedError.
+        """
+        raise NotImplementedError()
+
+
+    @staticmethod
+    def _strip_dmesg_timestamp(line):
+        """ Removes any timestamp prefix from a dmesg line. """
+
+        # Heuristic: the message starts after a the "] " that ends the
+        # timestamp, and thus two characters after the position of the first ']'.
+        end_of_timestamp = line.find(']') + 2
+        return line[end_of_timestamp:]
+
+
+    def _try_to_generate_error_context(self):
+        """ Attempts to generate a string providing error context. """
+
+        # The device state is a bit tentative, here. We should be able to read
+        # an error using the debug command, if it's available. We'll try, and
+        # just silently fail if anything happens.
+        try:
+
+            # Read the last non-empty line from the device's debug ring.
+            logs = self.apis['debug'].read_dmesg()
+            last_line = logs.strip().split("\n")[-1]
+
+            # Strip the last line of any timestamp.
+            return self._strip_dmesg_timestamp(last_line)
+
+        except:
+            return None
+
+
+    def _exception_for_command_failure(self, error_number=None, pretty_name=None):
+        """ Generates an CommandFailureError for a failed command.
+
+        Arguments:
+            error_number -- The libgreat error number returned during command failure.
+            pretty_name -- The pretty name of the RPC that failed, usually in class.name format.
+        """
+
+        # Generate the description of the exception.
+        if pretty_name:
+            message = "{}:".format(pretty_name)
+        else:
+            message = "rpc:"
+
+        # If possible, try to grab context from the device to make this error richer.
+        error_context = self._try_to_generate_error_context()
+        if error_context:
+
+            # Simple heuristic: if the RPC name is already in the message, don't include it a second time.
+            if pretty_name in error_context:
+                message = error_context
+            else:
+                message += " {}".format(error_context)
+
+        else:
+            message += "failed to execute"
+
+        # If we have a description of the error number, include it.
+        error_string = errors.get_error_name(error_number)
+        if error_string:
+            message += " [{}]".format(error_string)
+        elif error_number:
+            message += " [{}]".format(error_number)
+        else:
+            message += " [unknown error]"
+
+        # Finally, raise the relevant error.
+        return CommandFailureError(message)
+
+
+
+
+class CommsCommandBatch(object):
+    """ Collects a sequence of commands, which are then executed on the device in a single exchange.
+
+    This trades a little latency on the first command for far fewer round trips; which is a big win
+    when issuing many small commands. Commands are executed in order; if one fails, the commands that
+    follow it are not executed.
+
+    For example::
+
+        batch = comms.batch()
+        batch.execute_command(class_number, verb, "<I", "<I", 0x1234)
+        batch.execute_command(class_number, other_verb, "<II", "", 0x1234, 0)
+        first_result, second_result = batch.run()
+
+    Batches can also be used as context managers, in which case they're run on exit::
+
+        with comms.batch() as batch:
+            batch.execute_command(...)
+        results = batch.results
+    """
+
+    def __init__(self, comms_backend):
+        self.comms_backend = comms_backend
+        self.results = None
+
+        # Each queued command is stored as a tuple of the information needed to issue it,
+        # and the information needed to interpret its response.
+        self._commands = []
+
+
+    def __len__(self):
+        return len(self._commands)
+
+
+    def __enter__(self):
+        return self
+
+
+    def __exit__(self, exc_type, exc_value, traceback):
+
+        # Only run the batch if the code that built it completed successfully.
+        if exc_type is None:
+            self.run()
+
+
+    def execute_command(self, class_number, verb, in_format, out_format, *arguments, **kwargs):
+        """ Queues a libgreat command for execution as part of this batch.
+
+        Accepts the same arguments as CommsBackend.execute_command, except for timeouts, which
+        apply to the batch as a whole and are passed to run().
+
+        Returns the index of the command's result in the list returned by run().
+        """
+
+        # Emulate python3 keyword-only arguments.
+        encoding = kwargs.pop('encoding', None)
+        max_response_length = kwargs.pop('max_response_length', 4096)
+        name = kwargs.pop('name', "anonymous")
+        class_name = kwargs.pop('class_name', None)
+        as_arrays = kwargs.pop('as_arrays', False)
+
+        # Batched commands are always sent to the device; so their results line up with the batch's responses.
+        kwargs.pop('cacheable', None)
+
+        if kwargs:
+            raise TypeError("Unexpected keyword arguments: {}".format(kwargs.keys()))
+
+        if as_arrays:
+            out_format = self.comms_backend._out_format_returning_arrays(out_format)
+
+        # Pack our arguments now, so any argument errors are raised where the command is queued.
+        payload = self.comms_backend._pack_command_arguments(in_format, arguments, name)
+
+        if not out_format:
+            max_response_length = 0
+
+        pretty_name = "{}.{}".format(class_name, name) if class_name else name
+        self._commands.append((class_number, verb, payload, max_response_length, out_format, encoding, pretty_name,))
+
+        return len(self._commands) - 1
+
+
+    def run(self, timeout=1000, comms_timeout=1000):
+        """ Executes each of the queued commands, in a single exchange with the device.
+
+        Returns:
+            a list containing the result of each command, as execute_command would return it.
+            Commands with no out_format produce None.
+
+        Raises a CommandFailureError if any command fails; the commands after the failed command
+        are not executed.
+        """
+
+        results = []
+
+        raw_batch = self.comms_backend._pack_raw_batch(command[0:4] for command in self._commands)
+
+        with self.comms_backend._comms_lock:
+            raw_response = self.comms_backend.execute_raw_batch(raw_batch, timeout, comms_timeout)
+
+        command_results = self.comms_backend._parse_raw_batch_response(raw_response)
+
+        # Interpret each command's response.
+        for index, command in enumerate(self._commands):
+            _, _, _, max_response_length, out_format, encoding, pretty_name = command
+
+            # If the device didn't get to this command, it didn't have room in its response buffer.
+            if index >= len(command_results):
+                raise CommsError("{}: batch response was too long; command not executed".format(pretty_name))
+
+            status, raw_result = command_results[index]
+
+            # If the command failed, raise an error.
+            if status:
+                raise self.comms_backend._exception_for_command_failure(status, pretty_name)
+
+            if max_response_length:
+                results.append(self.comms_backend._parse_command_response(raw_result, out_format, encoding, pretty_name))
+            else:
+                results.append(None)
+
+        self.results = results
+        return results
+
+
+
+class CommsAsyncExecutor(object):
+    """ Issues the commands started with CommsBackend.execute_command_async, from a background thread.
+
+    Commands that queue up while the device is busy are sent together, as a single batch; so a burst of
+    small commands costs one exchange with the device, rather than one each. A command only joins a batch
+    if every command's largest response still fits in the device's response buffer; so commands that can
+    respond with a full buffer -- the default -- are still executed one at a time. So are all commands on
+    backends that can't execute batches.
+
+    Each command's future stands on its own: if a command in a batch fails, the commands behind it, which
+    the device skips, are sent again rather than failed along with it.
+    """
+
+    def __init__(self, comms_backend):
+        self.comms_backend = comms_backend
+
+        # Commands waiting to be sent, each stored as a (command, future) tuple.
+        self._pending = collections.deque()
+        self._outstanding = 0
+
+        # Assume we can batch commands until the backend tells us otherwise.
+        self._can_batch = True
+
+        self._condition = threading.Condition()
+        self._stopping = False
+
+        self._thread = threading.Thread(target=self._run, name="libgreat async commands")
+        self._thread.daemon = True
+        self._thread.start()
+
+
+    def submit(self, command):
+        """ Queues a command for execution; see CommsBackend.execute_command_async.
+
+        Args:
+            command -- A (class_number, verb, payload, max_response_length, out_format, encoding,
+                pretty_name, timeout, comms_timeout) tuple.
+
+        Returns a Future that will hold the command's result.
+        """
+
+        future = Future()
+
+        with self._condition:
+            if self._stopping:
+                raise CommsError("cannot start a command; the connection is being closed")
+
+            self._pending.append((command, future,))
+            self._outstanding += 1
+            self._condition.notify_all()
+
+        return future
+
+
+    def wait(self):
+        """ Blocks until every submitted command has completed. """
+
+        with self._condition:
+            while self._outstanding:
+                self._condition.wait()
+
+
+    def stop(self):
+        """ Completes any queued commands, and then stops the background thread. """
+
+        with self._condition:
+            self._stopping = True
+            self._condition.notify_all()
+
+        self._thread.join()
+
+
+    def _run(self):
+        """ Main loop for the background thread. """
+
+        while True:
+
+            with self._condition:
+                while not (self._pending or self._stopping):
+                    self._condition.wait()
+
+                if not self._pending:
+                    return
+
+                to_send = self._take_batch()
+
+            # Skip any commands that were cancelled before we got to them. Commands put back after an
+            # earlier batch failed are already running.
+            commands = []
+            for command, future in to_send:
+                if future.running() or future.set_running_or_notify_cancel():
+                    commands.append((command, future,))
+                else:
+                    self._mark_complete()
+
+            if len(commands) > 1:
+                self._execute_batch(commands)
+            elif commands:
+                self._execute_directly(*commands[0])
+
+
+    def _take_batch(self):
+        """ Removes as many pending commands as can be sent in a single batch; or a single command, to be
+        executed directly, if no others fit alongside it. Must be called with the condition held.
+        """
+
+        batch = [self._pending.popleft()]
+
+        if not self._can_batch:
+            return batch
+
+        command_size = self._batched_command_size(batch[0][0])
+        response_size = self._batched_response_size(batch[0][0])
+
+        while self._pending:
+            command = self._pending[0][0]
+
+            command_size += self._batched_command_size(command)
+            response_size += self._batched_response_size(command)
+
+            if max(command_size, response_size) > self.comms_backend.LIBGREAT_MAX_COMMAND_SIZE:
+                break
+
+            batch.append(self._pending.popleft())
+
+        return batch
+
+
+    def _batched_command_size(self, command):
+        """ Returns the space a command's header and arguments take up in a batch. """
+        payload = command[2]
+        return self.comms_backend.LIBGREAT_BATCH_COMMAND_HEADER.size + len(payload) + (-len(payload) % 4)
+
+
+    def _batched_response_size(self, command):
+        """ Returns the most space a command's header and response can take up in a batch's response. """
+        max_response_length = command[3]
+        return self.comms_backend.LIBGREAT_BATCH_RESPONSE_HEADER.size + max_response_length + (-max_response_length % 4)
+
+
+    def _mark_complete(self):
+        with self._condition:
+            self._outstanding -= 1
+            self._condition.notify_all()
+
+
+    def _complete(self, command, future, status, raw_result):
+        """ Hands the result of a command to its future. """
+
+        _, _, _, max_response_length, out_format, encoding, pretty_name, _, _ = command
+
+        try:
+            if status:
+                future.set_exception(self.comms_backend._exception_for_command_failure(status, pretty_name))
+            elif max_response_length:
+                future.set_result(self.comms_backend._parse_command_response(raw_result, out_format, encoding, pretty_name))
+            else:
+                future.set_result(None)
+        except Exception as e:
+            future.set_exception(e)
+
+        self._mark_complete()
+
+
+    def _execute_directly(self, command, future):
+        """ Executes a single command to completion. """
+
+        class_number, verb, payload, max_response_length, _, _, pretty_name, timeout, comms_timeout = command
+
+        try:
+            with self.comms_backend._comms_lock:
+                raw_result = self.comms_backend.execute_raw_command(class_number, verb, payload, timeout,
+                        None, max_response_length, comms_timeout, pretty_name)
+        except Exception as e:
+            future.set_exception(e)
+            self._mark_complete()
+            return
+
+        self._complete(command, future, 0, raw_result)
+
+
+    def _execute_batch(self, commands):
+        """ Executes several commands in a single exchange with the device. """
+
+        raw_batch = self.comms_backend._pack_raw_batch(command[0:4] for command, _ in commands)
+
+        # The batch gets as long to execute as its commands would have had between them.
+        timeout = sum(command[7] for command, _ in commands)
+        comms_timeout = max(command[8] for command, _ in commands)
+
+        try:
+            with self.comms_backend._comms_lock:
+                raw_response = self.comms_backend.execute_raw_batch(raw_batch, timeout, comms_timeout)
+
+        # If the backend can't execute batches, execute these commands -- and all that follow -- one at a time.
+        except NotImplementedError:
+            self._can_batch = False
+
+            for command, future in commands:
+                self._execute_directly(command, future)
+            return
+
+        except Exception as e:
+            for command, future in commands:
+                future.set_exception(e)
+                self._mark_complete()
+            return
+
+        results = self.comms_backend._parse_raw_batch_response(raw_response)
+
+        for (command, future), (status, raw_result) in zip(commands, results):
+            self._complete(command, future, status, raw_result)
+
+        # The device stops executing a batch at the first command that fails. The commands it skipped
+        # don't depend on the failed one, as they would in a CommsCommandBatch; so send them again.
+        skipped = commands[len(results):]
+        if not skipped:
+            return
+
+        if not results:
+            for command, future in skipped:
+                future.set_exception(CommsError("{}: batch response was too long; command not executed".format(command[6])))
+                self._mark_complete()
+            return
+
+        with self._condition:
+            self._pending.extendleft(reversed(skipped))
+
+
+class CommsPipe(object):
+    """ Base class for pipes, which carry bulk streams of data to and from a device outside of the
+    command/response protocol; and so can run at the full bandwidth of the underlying transport.
+
+    Pipes are created by CommsBackend.open_pipe. They can be used as context managers, in which
+    case they're closed on exit.
+    """
+
+    def __init__(self, comms_backend, pipe_number, class_number, flags):
+        self.comms_backend = comms_backend
+        self.pipe_number = pipe_number
+        self.class_number = class_number
+        self.flags = flags
+
+
+    def __enter__(self):
+        return self
+
+
+    def __exit__(self, exc_type, exc_value, traceback):
+        self.close()
+
+
+    def read(self, length=None, timeout=1000):
+        """ Reads data sent by the device on the given pipe.
+
+        Args:
+            length -- The maximum amount of data to read; or None to use a backend-appropriate default.
+            timeout -- The maximum time to wait for data, in ms.
+
+        Returns the data received, as a byte-string.
+        """
+        raise NotImplementedError()
+
+
+    def write(self, data, timeout=1000):
+        """ Sends data to the device on the given pipe.
+
+        Args:
+            data -- The data to be sent.
+            timeout -- The maximum time to wait for the device to accept the data, in ms.
+
+        Returns the number of bytes sent.
+        """
+        raise NotImplementedError()
+
+
+    def stream(self, length=None, timeout=1000):
+        """ Generator that continuously reads data from the pipe, yielding each chunk as it's received.
+
+        Accepts the same arguments as read; the stream ends when the consumer stops iterating,
+        or when a read fails (e.g. by timing out).
+        """
+        while True:
+            yield self.read(length, timeout)
+
+
+    def close(self):
+        """ Releases any resources held by the pipe. The pipe cannot be used afterwards. """
+        pass
+
+
+
+class CommsApiDictionary(collections.OrderedDict):
+    """ Dictionary of API objects, by class name; which can also hold classes whose API objects
+        are only generated when they're first looked up.
+
+        Lookups and membership tests see pending classes; iterating over the dictionary (or taking its
+        length) generates every pending class first, so the dictionary always appears complete.
+    """
+
+    def __init__(self, *args, **kwargs):
+        self._pending = collections.OrderedDict()
+        super(CommsApiDictionary, self).__init__(*args, **kwargs)
+
+
+    def add_pending(self, name, generator):
+        """ Adds a class whose API object will be created, by calling generator(), when it's first
+            looked up. Replaces any existing object with the same name.
+        """
+
+        if super(CommsApiDictionary, self).__contains__(name):
+            del self[name]
+
+        self._pending[name] = generator
+
 
-            # Tuples are immutable, so we'll temporarily convert
-            # the relevant result to an integer.
-            result = list(result)
+    def pending_names(self):
+        """ Returns the names of each class whose API object hasn't yet been generated. """
+        return list(self._pending)
 
-            for index, value in enumerate(result):
-                if isinstance(value, bytes):
-                    result[index] = value.decode(encoding, errors='ignore')
 
-            result = tuple(result)
+    def generate_all(self):
+        """ Generates the API object for each pending class. """
 
-        # Return the result in a format that makes it easily
-        # intepreted as multiple return values. In most cases, a tuple is returned
-        # when multiple values are possible; and a single value is returned if only
-        # one value is possible.
-        if self._command_results_should_collapse(result, out_format):
-            return result[0]
+        for name in self.pending_names():
+            self[name]
+
+
+    def __missing__(self, name):
+        """ Generates a pending class's API object on its first lookup. """
+
+        if name not in self._pending:
+            raise KeyError(name)
+
+        # Only stop tracking the pending class once it's generated successfully; so e.g. a communications
+        # failure while describing it doesn't lose it for good.
+        api = self._pending[name]()
+        self[name] = api
+
+        return api
+
+
+    def __setitem__(self, name, value):
+        self._pending.pop(name, None)
+        super(CommsApiDictionary, self).__setitem__(name, value)
+
+
+    def __contains__(self, name):
+        return super(CommsApiDictionary, self).__contains__(name) or (name in self._pending)
+
+
+    def get(self, name, default=None):
+        try:
+            return self[name]
+        except KeyError:
+            return default
+
+
+    def __iter__(self):
+        self.generate_all()
+        return super(CommsApiDictionary, self).__iter__()
+
+
+    def __len__(self):
+        self.generate_all()
+        return super(CommsApiDictionary, self).__len__()
+
+
+    def keys(self):
+        self.generate_all()
+        return super(CommsApiDictionary, self).keys()
+
+
+    def values(self):
+        self.generate_all()
+        return super(CommsApiDictionary, self).values()
+
+
+    def items(self):
+        self.generate_all()
+        return super(CommsApiDictionary, self).items()
+
+
+
+class CommsApiCollection(object):
+    """ Dynamically-allocated container object that is automatically
+        populated with API objects. Provides a view of our dictionary
+        of APIs that has object semantics.
+    """
+
+    def __init__(self, wrapped_dict):
+        self.__dict__ = wrapped_dict
+
+    def __getattr__(self, name):
+        """ Called for APIs that aren't yet in our dictionary; which generates any that are pending. """
+
+        try:
+            return self.__dict__[name]
+        except KeyError:
+            raise AttributeError(name)
+
+    def __dir__(self):
+        """ Lists every API; including those that haven't yet been generated. """
+
+        # Use the plain dictionary's view of our APIs; which doesn't generate pending ones.
+        names = list(dict.keys(self.__dict__))
+        pending = getattr(self.__dict__, 'pending_names', list)()
+
+        return names + pending
+
+
+class CommsFormat(object):
+    """ A libgreat pack/unpack format string, compiled into a reusable codec.
+
+    Parsing a format string is relatively expensive, and most formats are used for many calls;
+    so we split each format into its fields once, and pre-build the struct.Struct objects needed
+    to handle each. See CommsBackend.pack / CommsBackend.unpack for the format syntax; compiled
+    formats are usually created via CommsBackend.compile_format, which caches them.
+
+    Formats compiled with as_arrays set unpack each variable-length integer array (e.g. '*H') into
+    a single array -- a numpy array, if numpy is available; or an array.array -- rather than into
+    individual integers. A format consisting of only such an array then describes a single value.
+    """
+
+    def __init__(self, format_string, as_arrays=False):
+        self.format_string = format_string
+        self.as_arrays = as_arrays
+
+        # We always pack/unpack things using standard-sized little endian,
+        # so the byte-order prefix tells us nothing; strip it.
+        if format_string.startswith('<'):
+            format_string = format_string[1:]
+
+        # Break the format string into fields we can handle; each of these is either a plain
+        # struct format, or one of our extensions.
+        subformats = re.split(CommsBackend._SPECIAL_FIELD_REGEX, format_string)
+        self._fields = [self._compile_field(subformat, as_arrays) for subformat in subformats if subformat]
+
+        # Figure out up front whether results in this format represent a single value.
+        self.collapses_single_result = self._describes_single_value(format_string) or \
+                ((len(self._fields) == 1) and getattr(self._fields[0], 'as_array', False))
+
+
+    def __repr__(self):
+        return "<CommsFormat {!r}>".format(self.format_string)
+
+
+    @staticmethod
+    def _compile_field(subformat, as_arrays=False):
+        """ Creates a field codec for a single chunk of a format string. """
+
+        # If this isn't one of our special formats, it's a standard struct format.
+        if not re.match(CommsBackend._SPECIAL_FIELD_REGEX + "$", subformat):
+            return _StructFormatField(subformat)
+
+        # Break the special field into its components.
+        match = re.match(CommsBackend._FORMAT_FIELD_REGEX + "$", subformat)
+        if not match:
+            raise ValueError("unsupported format field '{}'".format(subformat))
+
+        repeat_count, element_type, element_group = match.groups()
+
+        # Parse the repeat count; None represents '*', which consumes everything that's left.
+        if repeat_count == '*':
+            count = None
         else:
-            return result
+            count = int(repeat_count) if repeat_count else 1
+
+        if element_group:
+            return _GroupFormatField(element_group, count, repeated=bool(repeat_count))
+        elif element_type == 'S':
+            return _CStringFormatField(count)
+        elif element_type == 'X':
+            return _BytesFormatField(count)
+        else:
+            return _IntArrayFormatField(element_type, as_arrays)
 
 
-    @classmethod
-    def _command_results_should_collapse(cls, result, out_format):
-        """ Returns true if the given command result should be collapsed
-            into a single value.
-        """
+    @staticmethod
+    def _describes_single_value(format_string):
+        """ Returns true iff the given format string describes exactly one value. """
 
         non_padding_formats = 0
 
-        # Never collapse non-strings, for now.
-        if not isinstance(out_format, str):
-            return False
-
         # Split the format string into its components.
-        elements = re.findall(cls._FORMAT_FIELD_REGEX, out_format)
+        elements = re.findall(CommsBackend._FORMAT_FIELD_REGEX, format_string)
         for repeat_count, element_type, element_group in elements:
 
             # Certain formats conglomerate their outputs into a single
@@ -823,7 +1735,7 @@ class CommsBackend(object):
             will_conglomerate = element_type in "Xsp"
 
             # If we have any repeat counts that aren't 1,
-            # on a non-conglomerating element, never collapse this.
+            # on a non-conglomerating element, this is never a single value.
             if repeat_count and (repeat_count != "1") and not will_conglomerate:
                 return False
 
@@ -831,121 +1743,318 @@ class CommsBackend(object):
                 non_padding_formats += 1
 
         # If we have more than one format type (discounting padding),
-        # don't collapse.
-        if non_padding_formats != 1:
-            return False
+        # this isn't a single value.
+        return non_padding_formats == 1
 
-        # Otherwise, collapse if we have exactly a single result.
-        return len(result) == 1
 
+    def pack(self, *args):
+        """ Packs the given arguments into a byte-string; see CommsBackend.pack. """
+        return bytes(self.pack_into(bytearray(), *args))
 
-    def execute_raw_command(self, class_number, verb, data=None, timeout=1000, encoding=None,
-            max_response_length=4096, comms_timeout=1000, pretty_name="unknown", rephrase_errors=True):
-        """Executes a libgreat command.
+
+    def pack_into(self, result, *args):
+        """ Packs the given arguments onto the end of an existing buffer -- a bytearray, or a
+        CommsCommandBuffer -- rather than into a new byte-string. Returns the buffer.
+        """
+
+        position = 0
+
+        for field in self._fields:
+            position = field.pack_into(result, args, position)
+
+        return result
+
+
+    def unpack(self, raw_bytes):
+        """ Unpacks a byte-string into a tuple of values; see CommsBackend.unpack. """
+
+        # Our fields need to be able to search the raw data, so ensure we have a byte-string.
+        if not isinstance(raw_bytes, (bytes, bytearray)):
+            raw_bytes = _to_byte_string(raw_bytes)
+
+        results = []
+        self.unpack_from(raw_bytes, 0, results)
+        return tuple(results)
+
+
+    def unpack_from(self, raw_bytes, offset, results):
+        """ Unpacks values from raw_bytes, starting at the given offset.
 
         Args:
-            class_number -- The class number for the given command.
-                See the GreatFET wiki for a list of class numbers.
-            verb -- The verb number for the given command.
-                See the GreatFET wiki for the given class.
-            data -- Data to be transmitted to the GreatFET.
-            timeout -- Maximum command execution time, in ms.
-            encoding -- If specified, the response data will attempt to be
-                decoded in the provided format.
-            max_response_length -- If less than 4096, this parameter will
-                cut off the provided response at the given length.
-            pretty_name -- String describing the RPC; used for error handling.
-            rephrase_errors -- Allow exceptions to be intercepted and rephrased with more details.
+            raw_bytes -- The byte-string to unpack from.
+            offset -- The position in raw_bytes to start unpacking from.
+            results -- A list to which each of the unpacked values will be appended.
 
-        Returns any data recieved in response.
+        Returns the offset just past the last byte consumed.
         """
-        raise NotImplementedError()
 
+        for field in self._fields:
+            offset = field.unpack_from(raw_bytes, offset, results)
 
-    @staticmethod
-    def _strip_dmesg_timestamp(line):
-        """ Removes any timestamp prefix from a dmesg line. """
+        return offset
 
-        # Heuristic: the message starts after a the "] " that ends the
-        # timestamp, and thus two characters after the position of the first ']'.
-        end_of_timestamp = line.find(']') + 2
-        return line[end_of_timestamp:]
 
 
-    def _try_to_generate_error_context(self):
-        """ Attempts to generate a string providing error context. """
+class CommsCommandBuffer(array.array):
+    """ Byte buffer that holds an outgoing command: the backend's prelude, followed by the command's
+    packed arguments. Arguments are packed straight into the buffer, which is then handed to the
+    transport as-is; pyusb, for example, sends array.arrays without copying them.
+    """
+
+    def __new__(cls, prelude=b""):
+        command = super(CommsCommandBuffer, cls).__new__(cls, future_utils.native_str('B'))
+        command.extend(prelude)
+
+        # The length of the prelude at the start of the buffer.
+        command.prelude_length = len(prelude)
+
+        return command
+
+
+    def extend(self, data):
+        """ Appends data to the buffer. Byte-strings are copied in en masse, rather than
+            byte-by-byte, as array.array.extend would.
+        """
 
-        # The device state is a bit tentative, here. We should be able to read
-        # an error using the debug command, if it's available. We'll try, and
-        # just silently fail if anything happens.
         try:
+            if hasattr(self, 'frombytes'):
+                self.frombytes(data)
+            else:
+                self.fromstring(bytes(data))
+        except TypeError:
+            super(CommsCommandBuffer, self).extend(data)
 
-            # Read the last non-empty line from the device's debug ring.
-            logs = self.apis['debug'].read_dmesg()
-            last_line = logs.strip().split("\n")[-1]
 
-            # Strip the last line of any timestamp.
-            return self._strip_dmesg_timestamp(last_line)
 
-        except:
-            return None
+class _StructFormatField(object):
+    """ Compiled format field for a chunk of plain struct.pack format. """
 
+    def __init__(self, subformat):
+        self.struct = struct.Struct('<' + subformat)
 
-    def _exception_for_command_failure(self, error_number=None, pretty_name=None):
-        """ Generates an CommandFailureError for a failed command.
+        # Figure out how many values this chunk packs; which isn't trivially derivable from
+        # the format string, as e.g. string and padding types don't take one value per byte.
+        self.argument_count = len(self.struct.unpack(b"\0" * self.struct.size))
 
-        Arguments:
-            error_number -- The libgreat error number returned during command failure.
-            pretty_name -- The pretty name of the RPC that failed, usually in class.name format.
-        """
 
-        # Generate the description of the exception.
-        if pretty_name:
-            message = "{}:".format(pretty_name)
-        else:
-            message = "rpc:"
+    def pack_into(self, result, args, position):
+        end = position + self.argument_count
+        result.extend(self.struct.pack(*args[position:end]))
+        return end
 
-        # If possible, try to grab context from the device to make this error richer.
-        error_context = self._try_to_generate_error_context()
-        if error_context:
 
-            # Simple heuristic: if the RPC name is already in the message, don't include it a second time.
-            if pretty_name in error_context:
-                message = error_context
-            else:
-                message += " {}".format(error_context)
+    def unpack_from(self, raw_bytes, offset, results):
+        results.extend(self.struct.unpack_from(raw_bytes, offset))
+        return offset + self.struct.size
 
-        else:
-            message += "failed to execute"
 
-        # If we have a description of the error number, include it.
-        error_string = errors.get_error_name(error_number)
-        if error_string:
-            message += " [{}]".format(error_string)
-        elif error_number:
-            message += " [{}]".format(error_number)
-        else:
-            message += " [unknown error]"
 
-        # Finally, raise the relevant error.
-        return CommandFailureError(message)
+class _CStringFormatField(object):
+    """ Compiled format field for UTF-8, null-terminated strings ('S'). """
 
+    def __init__(self, count):
+        # The number of strings handled; or None to handle all that remain.
+        self.count = count
 
 
+    def pack_into(self, result, args, position):
+        end = len(args) if self.count is None else position + self.count
 
-class CommsApiCollection(object):
-    """ Dynamically-allocated container object that is automatically
-        populated with API objects. Provides a view of our dictionary
-        of APIs that has object semantics.
+        for string in args[position:end]:
+            result.extend(string.encode('UTF-8'))
+            result.append(0)
+
+        return end
+
+
+    def unpack_from(self, raw_bytes, offset, results):
+
+        # If we're consuming all remaining strings, split them all at once.
+        if self.count is None:
+            results.extend(c_string_return(raw_bytes[offset:], 'UTF-8'))
+            return len(raw_bytes)
+
+        # Otherwise, read each string up to (and including) its terminating NULL;
+        # if we have no NULL, the remainder of the data is the string.
+        for _ in range(self.count):
+            null_pos = raw_bytes.find(b"\0", offset)
+            end = len(raw_bytes) if null_pos == -1 else null_pos
+
+            results.append(raw_bytes[offset:end].decode('UTF-8', errors='ignore'))
+            offset = min(end + 1, len(raw_bytes))
+
+        return offset
+
+
+
+class _BytesFormatField(object):
+    """ Compiled format field for as-is byte strings ('X'). """
+
+    def __init__(self, length):
+        # The number of bytes handled; or None to handle all that remain.
+        self.length = length
+
+
+    def pack_into(self, result, args, position):
+
+        # A '*X' field squishes all remaining arguments together; but is usually given
+        # a single byte-string, which we take as-is.
+        if (self.length is None) and (len(args) - position != 1):
+            result.extend(bytearray(args[position:]))
+            return len(args)
+
+        result.extend(args[position])
+        return position + 1
+
+
+    def unpack_from(self, raw_bytes, offset, results):
+        end = len(raw_bytes) if self.length is None else offset + self.length
+        results.append(bytes(raw_bytes[offset:end]))
+        return min(end, len(raw_bytes))
+
+
+
+def _to_byte_string(raw_bytes):
+    """ Converts a response (e.g. the array.array produced by pyusb) into a byte-string, in a single copy. """
+
+    if isinstance(raw_bytes, array.array):
+        return raw_bytes.tobytes() if hasattr(raw_bytes, 'tobytes') else raw_bytes.tostring()
+
+    return bytes(bytearray(raw_bytes))
+
+
+def _array_typecodes_for_specifier(specifier):
+    """ Returns the (numpy dtype, array.array typecode) that hold elements of the given struct specifier,
+        as sent by libgreat: standard-sized and little endian. Either is None if no such type exists.
     """
 
-    def __init__(self, wrapped_dict):
-        self.__dict__ = wrapped_dict
+    size = struct.calcsize('<' + specifier)
+
+    if specifier in 'fd':
+        kind, candidates = 'f', specifier
+    elif specifier == '?':
+        kind, candidates = 'b', 'B'
+    elif specifier in 'bhilq':
+        kind, candidates = 'i', 'bhilq'
+    elif specifier in 'BHILQ':
+        kind, candidates = 'u', 'BHILQ'
+    else:
+        return None, None
+
+    # Find the array.array type with the same element size; its sizes are platform-dependent.
+    typecode = None
+    for candidate in candidates:
+        try:
+            if array.array(future_utils.native_str(candidate)).itemsize == size:
+                typecode = future_utils.native_str(candidate)
+                break
+        except (ValueError, TypeError):
+            continue
 
-    def __getattr__(self, name):
-        """ Trivial definition of __getattr_. Makes linters happy. """
+    dtype = numpy.dtype(future_utils.native_str('<{}{}'.format(kind, size))) if numpy else None
+    return dtype, typecode
+
+
+def _unpack_int_array(raw_bytes, offset, count, dtype, typecode):
+    """ Unpacks count integers from raw_bytes into a single array; see _IntArrayFormatField. """
+
+    # If we have numpy, create an array that views the response directly; without copying it.
+    if dtype is not None:
+        return numpy.frombuffer(raw_bytes, dtype=dtype, count=count, offset=offset)
+
+    # Otherwise, copy the elements en masse into an array.array; which holds them in native byte order.
+    result = array.array(typecode)
+    data = raw_bytes[offset:offset + (count * result.itemsize)]
+
+    if hasattr(result, 'frombytes'):
+        result.frombytes(data)
+    else:
+        result.fromstring(bytes(data))
+
+    if sys.byteorder != 'little':
+        result.byteswap()
+
+    return result
+
+
+class _IntArrayFormatField(object):
+    """ Compiled format field for variable-length integer arrays (e.g. '*I'). """
+
+    def __init__(self, specifier, as_array=False):
+        self.specifier = specifier
+        self.element_size = struct.calcsize('<' + specifier)
+
+        # If we're to unpack into an array, figure out the array's type; elements that don't have
+        # an array type (e.g. characters) are unpacked individually, as usual.
+        self.dtype, self.typecode = _array_typecodes_for_specifier(specifier) if as_array else (None, None)
+        self.as_array = (self.dtype is not None) or (self.typecode is not None)
+
+
+    def pack_into(self, result, args, position):
+        count = len(args) - position
+        result.extend(struct.pack('<{}{}'.format(count, self.specifier), *args[position:]))
+        return len(args)
+
+
+    def unpack_from(self, raw_bytes, offset, results):
+        count, remainder = divmod(len(raw_bytes) - offset, self.element_size)
+
+        if remainder:
+            raise struct.error("trailing {} bytes don't form a whole '{}' element".format(remainder, self.specifier))
+
+        if self.as_array:
+            results.append(_unpack_int_array(raw_bytes, offset, count, self.dtype, self.typecode))
+        else:
+            results.extend(struct.unpack_from('<{}{}'.format(count, self.specifier), raw_bytes, offset))
+
+        return len(raw_bytes)
+
+
+
+class _GroupFormatField(object):
+    """ Compiled format field for parenthesized groups, which pack from / unpack into tuples. """
+
+    def __init__(self, group_format, count, repeated):
+        self.format = CommsFormat(group_format)
+
+        # The number of groups handled, or None to handle all that remain. Unrepeated
+        # groups consume a single tuple; repeated ones consume one tuple per group.
+        self.count = count
+        self.repeated = repeated
+
+
+    def pack_into(self, result, args, position):
+
+        if not self.repeated:
+            result.extend(self.format.pack(*args[position]))
+            return position + 1
+
+        end = len(args) if self.count is None else position + self.count
+        groups = args[position:end]
+
+        if (self.count is not None) and (len(groups) != self.count):
+            raise ValueError("Unexpected number of repeated-groups provided!")
+
+        for group in groups:
+            result.extend(self.format.pack(*group))
+
+        return end
+
+
+    def unpack_from(self, raw_bytes, offset, results):
+        groups_parsed = 0
+
+        # While we have bytes left to parse, and we haven't consumed all
+        # of our repeats, unpack each group.
+        while (offset < len(raw_bytes)) and ((self.count is None) or (groups_parsed < self.count)):
+            group = []
+            offset = self.format.unpack_from(raw_bytes, offset, group)
+
+            results.append(tuple(group))
+            groups_parsed += 1
+
+        return offset
 
-        return self.__dict__[name]
 
 
 def _generate_command_in_signature(in_format, in_names):
@@ -1048,13 +2157,15 @@ def _generate_command_rpc_signature(in_format, in_names, out_format, out_names):
 
 
 def command_rpc(verb_number, in_format="", out_format="", name="function", class_name="class",
-        doc="undocumented, generated function", in_parameter_names=None, out_parameter_names=None):
+        doc="undocumented, generated function", in_parameter_names=None, out_parameter_names=None, cacheable=False):
     """ Convenience function that creates an RPC method for a given verb.
 
     Args:
         verb_number -- The verb number for the RPC to be created.
         in_format -- The format of the arguments accepted.  Defined the same way as CommsBackend.pack.
         out_format -- The format of the return value accepted.  Defined the same way as struct.unpack.
+        cacheable -- True iff the verb has no side effects, and its response doesn't change until the device
+            is reset; in which case repeated calls are answered from a cache. See CommsBackend.execute_command.
 
     This function can be used to quickly define methods that issue libgreat
     commands, transparently packing and unpacking arguments to handle the RPC.
@@ -1075,17 +2186,40 @@ def command_rpc(verb_number, in_format="", out_format="", name="function", class
         y = x.read_a_thing(1, 2)
 
         # If successful, y should contian an integer!
+
+    Passing ``asynchronous=True`` starts the command without waiting for it; and returns
+    a Future that will hold its result, as with CommsBackend.execute_command_async::
+
+        futures = [x.read_a_thing(i, 2, asynchronous=True) for i in range(16)]
+        ys = [future.result() for future in futures]
+
+    Passing ``as_arrays=True`` returns variable-length integer arrays as arrays; see
+    CommsBackend.execute_command.
     """
 
 
+    # Compile our format strings once, up front, rather than re-parsing them on every call.
+    def compile_if_format_string(format_string):
+        if format_string and isinstance(format_string, future_utils.string_types):
+            return CommsBackend.compile_format(format_string)
+        else:
+            return format_string
+
+    compiled_in_format = compile_if_format_string(in_format)
+    compiled_out_format = compile_if_format_string(out_format)
+
     # Create a partially bound method that's closed over the variables we want to store.
     def method(self, *arguments, **kwargs):
         encoding = kwargs.pop('encoding', None)
         timeout  = kwargs.pop('timeout', 1000)
         max_response_length = kwargs.pop('max_response_length', 4096)
+        asynchronous = kwargs.pop('asynchronous', False)
+        as_arrays = kwargs.pop('as_arrays', False)
 
-        return self.execute_command(verb_number, in_format, out_format, name=name, class_name=class_name,
-                timeout=timeout, max_response_length=max_response_length, encoding=encoding, *arguments)
+        execute = self.execute_command_async if asynchronous else self.execute_command
+        return execute(verb_number, compiled_in_format, compiled_out_format, name=name, class_name=class_name,
+                timeout=timeout, max_response_length=max_response_length, encoding=encoding, as_arrays=as_arrays,
+                cacheable=cacheable, *arguments)
 
     # Apply our known documentation to the given command.
     method.__name__ = future_utils.native_str(name)
@@ -1157,7 +2291,7 @@ def int_array_arguments(specifier='I', *integers):
     return payload
 
 
-def int_array_return(raw_bytes, specifier='I'):
+def int_array_return(raw_bytes, specifier='I', as_array=False):
     """ Convenience function that splits a command return into a tuple of
         evenly-spaced arguments.
 
@@ -1165,28 +2299,26 @@ def int_array_return(raw_bytes, specifier='I'):
         specifier -- A single letter specifying the way the integer is to be
                      encoded. Should be one of the format letters that can be
                      provided to struct.pack()
+        as_array -- If true, the integers are returned as a single array rather than a list;
+                    see CommsBackend.execute_command's as_arrays.
     """
 
-    # from the python itertools recipes section
-    def break_into_chunks(size, string):
-        """ Iterates over a byte-string, chunking it into groups of length size"""
-
-        chunks = []
+    if not isinstance(raw_bytes, (bytes, bytearray)):
+        raw_bytes = _to_byte_string(raw_bytes)
 
-        while string:
-            chunks.append(string[0:size])
-            string = string[size:]
+    size = struct.calcsize('<' + specifier)
+    count, remainder = divmod(len(raw_bytes), size)
 
-        return chunks
+    if remainder:
+        raise struct.error("trailing {} bytes don't form a whole '{}' element".format(remainder, specifier))
 
+    if as_array:
+        dtype, typecode = _array_typecodes_for_specifier(specifier)
+        if (dtype is not None) or (typecode is not None):
+            return _unpack_int_array(raw_bytes, 0, count, dtype, typecode)
 
-    def parse_bytes(b):
-        """ Parses each our collection of integers. """
-        return struct.unpack('<' + specifier, b)[0]
-
-    # Break the array into integers.
-    size = struct.calcsize(specifier)
-    return [parse_bytes(b) for b in break_into_chunks(size, raw_bytes)]
+    # Break the array into integers, all at once.
+    return list(struct.unpack('<{}{}'.format(count, specifier), raw_bytes))
 
 
 
@@ -1243,6 +2375,16 @@ class CommsClass(object):
                 out_format, *arguments, **kwargs)
 
 
+    def execute_command_async(self, verb, in_format, out_format, *arguments, **kwargs):
+        """ Starts execution of a libgreat command, without waiting for it to complete.
+
+        Accepts the same arguments as execute_command; returns a Future that will hold
+        the command's result. See CommsBackend.execute_command_async.
+        """
+        return self.comms_backend.execute_command_async(self.CLASS_NUMBER, verb, in_format,
+                out_format, *arguments, **kwargs)
+
+
     def execute_raw_command(self, class_number, verb, data=None, timeout=1000, encoding=None,
             max_response_length=4096, comms_timeout=1000, pretty_name="unknown", rephrase_errors=True):
         """Executes a libgreat command.
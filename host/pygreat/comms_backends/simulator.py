@@ -0,0 +1,139 @@
+#
+# This file is part of libgreat
+#
+
+"""
+Simulator backend for libgreat communications -- runs commands against the libgreat
+firmware's communications core, built for the host as a shared library.
+"""
+
+from __future__ import absolute_import
+
+import os
+import ctypes
+import threading
+import ctypes.util
+
+from ..comms import CommsBackend
+from ..errors import DeviceNotFoundError
+
+
+class SimulatorCommsBackend(CommsBackend):
+    """
+    Class representing a connection to an in-process simulation of a libgreat device.
+
+    The simulation executes commands with the firmware's own communications core, built by
+    firmware/platform/host. This allows autoenumeration, RPC stubs and the like to be exercised --
+    and host-side overhead benchmarked -- without any hardware attached.
+    """
+
+    """ The name of the simulator's shared library (libgreat_simulator), and the variable that can override its path. """
+    LIBRARY_NAME = "great_simulator"
+    LIBRARY_PATH_VARIABLE = "LIBGREAT_SIMULATOR_LIBRARY"
+
+    """
+    Every simulated device in a process shares the library, and so its command buffers; and ctypes releases
+    the GIL while the simulation runs. Ensure only one simulated command runs at a time.
+    """
+    _simulation_lock = threading.Lock()
+
+
+    def __init__(self, library_path=None, **device_identifiers):
+        """
+        Loads the simulator library, creating a new simulated device.
+
+        Args:
+            library_path -- The path to the simulator's shared library. If not provided, the path
+                is taken from the LIBGREAT_SIMULATOR_LIBRARY environment variable; or the library
+                is searched for on the system's library path.
+
+        Other device identifiers are accepted for compatibility with other backends, but ignored.
+        """
+
+        if library_path is None:
+            library_path = os.environ.get(self.LIBRARY_PATH_VARIABLE)
+        if library_path is None:
+            library_path = ctypes.util.find_library(self.LIBRARY_NAME)
+        if library_path is None:
+            raise DeviceNotFoundError("couldn't find the libgreat simulator library; set {} to its path".format(
+                self.LIBRARY_PATH_VARIABLE))
+
+        try:
+            self.library = ctypes.CDLL(library_path)
+        except OSError as e:
+            raise DeviceNotFoundError("couldn't load the libgreat simulator library: {}".format(e))
+
+        # Describe the simulator's entry points; see firmware/platform/host/include/simulator.h.
+        arguments = (ctypes.c_uint32, ctypes.c_uint32, ctypes.c_char_p, ctypes.c_uint32,
+            ctypes.c_void_p, ctypes.c_uint32, ctypes.POINTER(ctypes.c_uint32))
+
+        self._execute_command = self.library.libgreat_simulator_execute_command
+        self._execute_command.argtypes = arguments
+        self._execute_command.restype = ctypes.c_int
+
+        self._execute_batch = self.library.libgreat_simulator_execute_batch
+        self._execute_batch.argtypes = arguments[2:]
+        self._execute_batch.restype = ctypes.c_int
+
+        # Create buffers that will accept the simulation's responses.
+        self._response_buffer = ctypes.create_string_buffer(self.LIBGREAT_MAX_COMMAND_SIZE)
+        self._response_length = ctypes.c_uint32()
+
+        # Run the parent initialization.
+        super(SimulatorCommsBackend, self).__init__(**device_identifiers)
+
+
+    def _run_command(self, class_number, verb, data, max_response_length):
+        """ Executes a command in the simulation; returns a (status, raw_response) tuple. """
+
+        data = bytes(data) if data else b""
+        max_response_length = min(max_response_length, self.LIBGREAT_MAX_COMMAND_SIZE)
+
+        if len(data) > self.LIBGREAT_MAX_COMMAND_SIZE:
+            raise ValueError("Command payload is too long!")
+
+        with self._simulation_lock:
+            status = self._execute_command(class_number, verb, data, len(data),
+                    self._response_buffer, max_response_length, ctypes.byref(self._response_length))
+
+        return status, self._response_buffer.raw[:self._response_length.value]
+
+
+    def execute_raw_command(self, class_number, verb, data=None, timeout=1000, encoding=None,
+            max_response_length=4096, comms_timeout=1000, pretty_name="unknown", rephrase_errors=True):
+        """ Executes a libgreat command; see CommsBackend.execute_raw_command. """
+
+        status, response = self._run_command(class_number, verb, data, max_response_length)
+
+        if status:
+            raise self._exception_for_command_failure(status, pretty_name)
+
+        if encoding and response:
+            response = response.decode(encoding, errors='ignore')
+
+        return response
+
+
+    def execute_raw_batch(self, raw_batch, timeout=1000, comms_timeout=1000):
+        """ Executes a batch of commands; see CommsBackend.execute_raw_batch. """
+
+        raw_batch = bytes(raw_batch)
+
+        with self._simulation_lock:
+            status = self._execute_batch(raw_batch, len(raw_batch), self._response_buffer,
+                    self.LIBGREAT_MAX_COMMAND_SIZE, ctypes.byref(self._response_length))
+
+        if status:
+            raise self._exception_for_command_failure(status, "batch")
+
+        return self._response_buffer.raw[:self._response_length.value]
+
+
+    def abort_command(self, timeout=1000, retry_delay=1):
+        """ The simulator never has a command underway; so there's nothing to cancel. """
+        return 0
+
+
+    def close(self):
+        """ Disposes of the simulation. This connection will no longer be usable. """
+        self._stop_async_executor()
@@ -14,7 +14,7 @@ import usb
 import time
 import struct
 
-from ..comms import CommsBackend
+from ..comms import CommsBackend, CommsPipe, CommsError, CommsCommandBuffer
 from ..errors import DeviceNotFoundError
 
 
@@ -32,6 +32,9 @@ class USBCommsBackend(CommsBackend):
     """ The request number for issuing vendor-request encapsulated libgreat commands. """
     LIBGREAT_REQUEST_NUMBER = 0x65
 
+    """ The prelude that precedes each command's arguments, which identifies the command: its class and verb numbers. """
+    LIBGREAT_COMMAND_PRELUDE = struct.Struct("<II")
+
     """
     Constant value provided to libgreat vendor requests to indicate that the command
     should execute normally.
@@ -44,6 +47,12 @@ class USBCommsBackend(CommsBackend):
     """
     LIBGREAT_VALUE_CANCEL = 0xDEAD
 
+    """
+    Constant value provided to the libgreat vendor requests to ask how many recent commands the device
+    can repeat; see _probe_repeat_slots.
+    """
+    LIBGREAT_VALUE_QUERY_REPEAT_SLOTS = 0xDEAE
+
     """
     Constant size of errors returned by libgreat commands on failure.
     """
@@ -64,6 +73,26 @@ class USBCommsBackend(CommsBackend):
     LIBGREAT_FLAG_REPEAT_LAST = (1 << 1)
 
 
+    """
+    Position of the repeat slot in the request's index. Each command is recorded in the repeat slot its request
+    selects; and requests with LIBGREAT_FLAG_REPEAT_LAST re-issue the command recorded in the slot they select.
+    """
+    LIBGREAT_REPEAT_SLOT_SHIFT = 8
+
+
+    """
+    The most repeat slots the request's index can select.
+    """
+    LIBGREAT_MAX_REPEAT_SLOTS = 16
+
+
+    """
+    A flag passed to command execution that indicates that the request contains a batch of commands,
+    rather than a single command. See execute_raw_batch.
+    """
+    LIBGREAT_FLAG_BATCH = (1 << 2)
+
+
     # TODO: handle providing board "URIs", like "usb;serial_number=0x123",
     # and automatic resolution to a backend?
 
@@ -101,8 +130,13 @@ class USBCommsBackend(CommsBackend):
         # can accept the first configuration provided.
         self.device.set_configuration()
 
-        # Start off with no knowledge of the device's state.
-        self._last_command_arguments = None
+        # Start off with no knowledge of the device's state. Until we've asked, assume the device can
+        # only repeat the command it most recently received.
+        self._repeat_slots = [None]
+        self._repeat_slot_order = [0]
+        self._repeat_slot_size = None
+        self._repeat_slot_in_buffer = None
+        self._repeat_slots_probed = False
 
         # Run the parent initialization.
         super(USBCommsBackend, self).__init__(**device_identifiers)
@@ -171,12 +205,31 @@ class USBCommsBackend(CommsBackend):
             index=index, length_or_data=data, timeout=timeout)
 
 
-    @staticmethod
-    def _build_command_prelude(class_number, verb):
+    def _build_command_prelude(self, class_number, verb):
         """Builds a libgreat command prelude, which identifies the command
         being executed to libgreat.
         """
-        return struct.pack("<II", class_number, verb)
+        return self.LIBGREAT_COMMAND_PRELUDE.pack(class_number, verb)
+
+
+    def _build_command_data(self, class_number, verb, data):
+        """ Builds the data sent to execute a command: its prelude, followed by its arguments.
+
+        Commands packed by execute_command arrive as CommsCommandBuffers that already start with their prelude;
+        these are sent as-is. Anything else is copied in behind a new prelude.
+        """
+
+        if isinstance(data, CommsCommandBuffer) and data.prelude_length:
+            to_send = data
+        elif data:
+            to_send = self._build_command_prelude(class_number, verb) + bytes(data)
+        else:
+            to_send = self._build_command_prelude(class_number, verb)
+
+        if len(to_send) > self.LIBGREAT_MAX_COMMAND_SIZE:
+            raise ValueError("Command payload is too long!")
+
+        return to_send
 
 
     def _usb_serial_number(self):
@@ -184,24 +237,110 @@ class USBCommsBackend(CommsBackend):
         return self.device.serial_number
 
 
-    def _check_for_repeat(self, class_number, verb, data):
-        """ Check to see if the class_number, verb, and data are the same as the immediately
-            preceeding call to this function. This is used to detemrine when we can perform a repeat-optimization,
-            which is documented in execute_raw_command.
+    def _check_for_repeat(self, class_number, verb, data, argument_length):
+        """ Check to see if the class_number, verb, and data are the same as those of a recent call to this
+            function, which the device still has recorded in one of its repeat slots. This is used to determine
+            when we can perform a repeat-optimization, which is documented in execute_raw_command.
+
+        Returns:
+            a (use_repeat, slot) tuple; where use_repeat is true iff the command can be repeated, and slot is
+            the repeat slot that holds -- or should record -- the command
         """
 
         # Compile the in-arguments into a simple container.
         data_set = (class_number, verb, data,)
+        slot = None
 
-        # If this data set matches our most recent arguments,
+        # If this data set matches a recent command's arguments,
         # we can use our repeat optimization!
-        if data_set == self._last_command_arguments:
+        for index, recorded in enumerate(self._repeat_slots):
+            if recorded == data_set:
+                if self._can_repeat_slot(index, argument_length):
+                    self._mark_repeat_slot_used(index)
+                    return True, index
+
+                # The device has lost this command's arguments; just send it again, into the same slot.
+                slot = index
+                break
+
+        # Otherwise, pick a slot to record the command in, and report that we can't.
+        if slot is None:
+            slot = self._allocate_repeat_slot()
+
+        self._repeat_slots[slot] = data_set
+        self._mark_repeat_slot_used(slot)
+        return False, slot
+
+
+    def _can_repeat_slot(self, slot, argument_length):
+        """ Returns true iff the device can still repeat the command recorded in the given slot. """
+
+        # The device can always repeat the command whose arguments are still in its receive buffer. It only keeps
+        # copies of shorter arguments; so other commands can only be repeated if their arguments fit in a slot.
+        if slot == self._repeat_slot_in_buffer:
             return True
 
-        # Otherwise, mark the data to be used and report that we can't.
-        else:
-            self._last_command_arguments = data_set
-            return False
+        return (self._repeat_slot_size is not None) and (argument_length <= self._repeat_slot_size)
+
+
+    def _mark_repeat_slot_used(self, slot):
+        """ Notes that the given slot holds the most recently issued command; whose arguments are now in the
+        device's receive buffer. """
+
+        self._repeat_slot_order.remove(slot)
+        self._repeat_slot_order.append(slot)
+        self._repeat_slot_in_buffer = slot
+
+
+    def _allocate_repeat_slot(self):
+        """ Picks a repeat slot to record a new command in: a free slot, if there is one; or the least recently used. """
+
+        # Once our slots are all in use, find out if the device has more; but only ask once.
+        if (None not in self._repeat_slots) and not self._repeat_slots_probed:
+            self._probe_repeat_slots()
+
+        if None in self._repeat_slots:
+            return self._repeat_slots.index(None)
+
+        return self._repeat_slot_order[0]
+
+
+    def _probe_repeat_slots(self):
+        """ Asks the device how many recent commands it can repeat, and how long their arguments can be. """
+
+        self._repeat_slots_probed = True
+
+        try:
+            response = self.device.ctrl_transfer(
+                usb.ENDPOINT_IN | usb.TYPE_VENDOR | usb.RECIP_ENDPOINT,
+                self.LIBGREAT_REQUEST_NUMBER, self.LIBGREAT_VALUE_QUERY_REPEAT_SLOTS, 0, 8, 1000)
+            slot_count, slot_size = struct.unpack("<II", bytes(bytearray(response)))
+
+        # Devices that predate repeat slots stall the query; they can only repeat the command they most recently received.
+        except (usb.core.USBError, struct.error):
+            return
+
+        slot_count = max(1, min(slot_count, self.LIBGREAT_MAX_REPEAT_SLOTS))
+
+        self._repeat_slot_order.extend(range(len(self._repeat_slots), slot_count))
+        self._repeat_slots.extend([None] * (slot_count - len(self._repeat_slots)))
+        self._repeat_slot_size = slot_size
+
+
+    def _forget_repeat_slots(self):
+        """ Forgets which commands the device has recorded; e.g. once an error leaves its state uncertain. """
+
+        self._repeat_slots = [None] * len(self._repeat_slots)
+        self._repeat_slot_in_buffer = None
+
+
+    def invalidate_response_cache(self):
+        """ Discards any cached responses; see CommsBackend.invalidate_response_cache.
+
+        Resetting the device also clears its repeat slots; so forget those, too.
+        """
+        super(USBCommsBackend, self).invalidate_response_cache()
+        self._forget_repeat_slots()
 
 
 
@@ -229,35 +368,27 @@ class USBCommsBackend(CommsBackend):
         Returns any data recieved in response.
         """
 
-        # Build the command header, which identifies the command to be executed.
-        prelude = self._build_command_prelude(class_number, verb)
-
-        # If we have data, build it into our request.
-        if data:
-            to_send = prelude + bytes(data)
-
-            if len(to_send) > self.LIBGREAT_MAX_COMMAND_SIZE:
-                raise ArgumentError("Command payload is too long!")
-
-        # Otherwise, just send the prelude.
-        else:
-            to_send = prelude
+        # Build our request: the command header, which identifies the command to be executed, and its data.
+        to_send = self._build_command_data(class_number, verb, data)
 
         # If our max response is zero, never bother reading a response.
         skip_reading_response = (max_response_length == 0)
 
         # To save on the overall number of command transactions, the backend provides an optimization
-        # that allows us to skip the "send" phase if the class, verb, and data are the same as the immediately
-        # preceeding call. Check to see if we can use that optimization.
-        use_repeat_optimization = self._check_for_repeat(class_number, verb, data)
+        # that allows us to skip the "send" phase if the class, verb, and data are the same as a recent call,
+        # which the device has kept in one of its repeat slots. Check to see if we can use that optimization.
+        argument_length = len(to_send) - self.LIBGREAT_COMMAND_PRELUDE.size
+        use_repeat_optimization, repeat_slot = self._check_for_repeat(class_number, verb, data, argument_length)
+        slot_flags = repeat_slot << self.LIBGREAT_REPEAT_SLOT_SHIFT
 
-        # TODO: upgrade this to be able to not block?
+        # This call blocks; see CommsBackend.execute_command_async for issuing commands without blocking.
         try:
             # If we're not using the repeat-optimization, send the in-arguments to the device.
             if not use_repeat_optimization:
 
                 # Set the FLAG_SKIP_RESPONSE flag if we don't expect a response back from the device.
                 flags = self.LIBGREAT_FLAG_SKIP_RESPONSE if skip_reading_response else 0
+                flags |= slot_flags
 
                 self.device.ctrl_transfer(
                     usb.ENDPOINT_OUT | usb.TYPE_VENDOR | usb.RECIP_ENDPOINT,
@@ -270,6 +401,7 @@ class USBCommsBackend(CommsBackend):
 
             # Set the FLAG_REPEAT_LAST if we're using our repeat-last optimization.
             flags = self.LIBGREAT_FLAG_REPEAT_LAST if use_repeat_optimization else 0
+            flags |= slot_flags
 
             # Truncate our maximum, if necessary.
             if max_response_length > 4096:
@@ -304,6 +436,65 @@ class USBCommsBackend(CommsBackend):
                 raise
 
 
+    def execute_raw_batch(self, raw_batch, timeout=1000, comms_timeout=1000):
+        """ Executes a batch of commands on the device, in a single exchange.
+
+        Args:
+            raw_batch -- The packed batch to be executed; see CommsBackend._pack_raw_batch.
+            timeout -- Maximum execution time for the whole batch, in ms.
+            comms_timeout -- Maximum execution time for communications that do
+                not directly execute the batch.
+
+        Returns the raw response to the batch.
+        """
+
+        # The batch overwrites the arguments of the last command executed; so unless the device has kept
+        # its own copy, the next command can't use the repeat-optimization.
+        self._repeat_slot_in_buffer = None
+
+        try:
+            # Send the whole batch in a single request...
+            self.device.ctrl_transfer(
+                usb.ENDPOINT_OUT | usb.TYPE_VENDOR | usb.RECIP_ENDPOINT,
+                self.LIBGREAT_REQUEST_NUMBER, self.LIBGREAT_VALUE_EXECUTE, self.LIBGREAT_FLAG_BATCH, raw_batch, timeout)
+
+            # ... and read back all of the responses at once.
+            response = self.device.ctrl_transfer(
+                usb.ENDPOINT_IN | usb.TYPE_VENDOR | usb.RECIP_ENDPOINT,
+                self.LIBGREAT_REQUEST_NUMBER, self.LIBGREAT_VALUE_EXECUTE, 0, self.LIBGREAT_MAX_COMMAND_SIZE, comms_timeout)
+
+            return bytes(bytearray(response))
+
+        except Exception as e:
+
+            # Abort the batch, and grab the last error number, if possible.
+            error_number = self.abort_command()
+
+            # Errors from individual commands are reported in the batch response; so a signaled
+            # error here means the device couldn't make sense of the batch itself.
+            is_signaled_error = \
+              isinstance(e, usb.core.USBError) and (e.errno == LIBUSB_PIPE_ERROR)
+
+            if is_signaled_error:
+                future_utils.raise_from(self._exception_for_command_failure(error_number, "batch"), None)
+            else:
+                raise
+
+
+    def open_pipe(self, pipe_number):
+        """ Opens one of the device's pipes, which are carried by USB bulk endpoints.
+        See CommsBackend.open_pipe.
+        """
+
+        # Ask the device which class owns the pipe, and which endpoints carry it.
+        class_number, flags, address = self.apis['core'].get_pipe_info(pipe_number)
+
+        in_endpoint = address & 0xFF
+        out_endpoint = (address >> 8) & 0xFF
+
+        return USBCommsPipe(self, pipe_number, class_number, flags, in_endpoint, out_endpoint)
+
+
     def abort_command(self, timeout=1000, retry_delay=1):
         """ Aborts execution of a current libgreat command. Used for error handling.
 
@@ -312,7 +503,7 @@ class USBCommsBackend(CommsBackend):
         """
 
         # Invalidate any existing knowledge of the device's state.
-        self._last_command_arguments = None
+        self._forget_repeat_slots()
 
         # Create a quick function to issue the abort request.
         execute_abort = lambda device : device.ctrl_transfer(
@@ -338,5 +529,66 @@ class USBCommsBackend(CommsBackend):
         Dispose resources allocated by this connection.  This connection
         will no longer be usable.
         """
+        self._stop_async_executor()
         usb.util.dispose_resources(self.device)
 
+
+
+class USBCommsPipe(CommsPipe):
+    """ A pipe carried by a pair of USB bulk endpoints. See CommsPipe. """
+
+    """
+    The default maximum length for reads. Reading many packets at once lets libusb keep the
+    endpoint busy, which is necessary to reach full bulk bandwidth.
+    """
+    DEFAULT_READ_LENGTH = 16384
+
+
+    def __init__(self, comms_backend, pipe_number, class_number, flags, in_endpoint, out_endpoint):
+        """
+        Args:
+            in_endpoint -- The address of the endpoint on which the device sends data; or 0 if none.
+            out_endpoint -- The address of the endpoint on which the device receives data; or 0 if none.
+        """
+        super(USBCommsPipe, self).__init__(comms_backend, pipe_number, class_number, flags)
+
+        self.in_endpoint = in_endpoint
+        self.out_endpoint = out_endpoint
+
+
+    def read(self, length=None, timeout=1000):
+        """ Reads data sent by the device on the given pipe. See CommsPipe.read. """
+
+        if not self.in_endpoint:
+            raise CommsError("pipe {} can't receive data from the device".format(self.pipe_number))
+
+        if length is None:
+            length = self.DEFAULT_READ_LENGTH
+
+        response = self.comms_backend.device.read(self.in_endpoint, length, timeout)
+        return bytes(bytearray(response))
+
+
+    def read_into(self, buffer, timeout=1000):
+        """ Reads data sent by the device directly into a pre-allocated buffer, avoiding a copy.
+
+        Args:
+            buffer -- An array.array('B') to be filled with data; reads at most len(buffer) bytes.
+            timeout -- The maximum time to wait for data, in ms.
+
+        Returns the number of bytes read.
+        """
+
+        if not self.in_endpoint:
+            raise CommsError("pipe {} can't receive data from the device".format(self.pipe_number))
+
+        return self.comms_backend.device.read(self.in_endpoint, buffer, timeout)
+
+
+    def write(self, data, timeout=1000):
+        """ Sends data to the device on the given pipe. See CommsPipe.write. """
+
+        if not self.out_endpoint:
+            raise CommsError("pipe {} can't send data to the device".format(self.pipe_number))
+
+        return self.comms_backend.device.write(self.out_endpoint, data, timeout)
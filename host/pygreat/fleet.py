@@ -0,0 +1,254 @@
+#
+# This file is part of libgreat
+#
+
+"""
+Support for driving many libgreat boards at once -- e.g. on a production rig -- from a single host.
+"""
+
+from __future__ import absolute_import
+
+import time
+
+from concurrent.futures import ThreadPoolExecutor
+
+
+# Use the highest-resolution clock available; python2 lacks perf_counter.
+_current_time = getattr(time, 'perf_counter', time.time)
+
+
+class GreatBoardFleet(object):
+    """
+    Class representing a set of boards that are driven together.
+
+    Each board is given its own worker thread; so operations on different boards run in parallel, while
+    operations on any one board run one at a time, in the order they were issued. Each operation that
+    spans the fleet returns a GreatBoardFleetResult, which reports each board's result and latency, and
+    the fleet's aggregate throughput.
+    """
+
+    def __init__(self, boards):
+        """
+        Args:
+            boards -- The GreatBoard objects that make up the fleet.
+        """
+
+        self.boards = list(boards)
+        self._workers = [ThreadPoolExecutor(max_workers=1) for _ in self.boards]
+
+
+    def __len__(self):
+        return len(self.boards)
+
+    def __iter__(self):
+        return iter(self.boards)
+
+    def __getitem__(self, index):
+        return self.boards[index]
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, exc_type, exc_value, traceback):
+        self.close()
+
+
+    def initialize_apis(self, max_workers=None):
+        """ Initializes each board's APIs -- see GreatBoard.initialize_apis -- for several boards at once.
+
+        Args:
+            max_workers -- The maximum number of boards to initialize at once; or None for all of them.
+        """
+
+        # Enumeration is mostly spent waiting on the boards; so initialize as many at once as we're allowed.
+        max_workers = max_workers or len(self.boards) or 1
+
+        with ThreadPoolExecutor(max_workers=max_workers) as executor:
+            for future in [executor.submit(board.initialize_apis) for board in self.boards]:
+                future.result()
+
+
+    def run(self, function, *arguments, **kwargs):
+        """ Calls function(board, *arguments, **kwargs) for each board, in parallel.
+
+        Args:
+            return_exceptions -- If true, failures are reported in the result's exceptions, rather than raised.
+                Must be passed by keyword.
+
+        Returns a GreatBoardFleetResult holding each call's return value.
+        """
+
+        return_exceptions = kwargs.pop('return_exceptions', False)
+
+        calls = [(lambda board=board: function(board, *arguments, **kwargs)) for board in self.boards]
+        return self._execute(calls, return_exceptions)
+
+
+    def broadcast(self, api_name, verb_name, *arguments, **kwargs):
+        """ Issues the same RPC to each board, in parallel.
+
+        Args:
+            api_name -- The name of the API class that holds the RPC; e.g. 'core'.
+            verb_name -- The name of the RPC; e.g. 'read_board_id'.
+            *arguments -- The arguments to the RPC.
+            return_exceptions -- As for run().
+
+        Other keyword arguments are passed to the RPC. Returns a GreatBoardFleetResult.
+        """
+
+        return_exceptions = kwargs.pop('return_exceptions', False)
+
+        calls = [self._rpc_call(board, api_name, verb_name, arguments, kwargs) for board in self.boards]
+        return self._execute(calls, return_exceptions)
+
+
+    def scatter(self, api_name, verb_name, argument_lists, **kwargs):
+        """ Issues an RPC to each board, in parallel, with different arguments for each board.
+
+        Args:
+            api_name, verb_name -- As for broadcast().
+            argument_lists -- A sequence containing the arguments for each board, in the same order as
+                the fleet's boards. Each entry can be a tuple of arguments, or a single argument.
+            return_exceptions -- As for run().
+
+        Other keyword arguments are passed to each RPC. Returns a GreatBoardFleetResult.
+        """
+
+        return_exceptions = kwargs.pop('return_exceptions', False)
+        argument_lists = list(argument_lists)
+
+        if len(argument_lists) != len(self.boards):
+            raise ValueError("expected arguments for {} boards, but got {}".format(len(self.boards), len(argument_lists)))
+
+        calls = []
+        for board, arguments in zip(self.boards, argument_lists):
+            if not isinstance(arguments, tuple):
+                arguments = (arguments,)
+
+            calls.append(self._rpc_call(board, api_name, verb_name, arguments, kwargs))
+
+        return self._execute(calls, return_exceptions)
+
+
+    def close(self):
+        """ Stops the fleet's worker threads, and closes each board's connection. """
+
+        for worker in self._workers:
+            worker.shutdown(wait=True)
+
+        for board in self.boards:
+            board.close()
+
+
+    @staticmethod
+    def _rpc_call(board, api_name, verb_name, arguments, kwargs):
+        """ Returns a callable that issues the given RPC to the given board. """
+
+        def call():
+            rpc = getattr(getattr(board.apis, api_name), verb_name)
+            return rpc(*arguments, **kwargs)
+
+        return call
+
+
+    def _execute(self, calls, return_exceptions=False):
+        """ Executes one call on each board's worker, and gathers their results. """
+
+        def timed(call):
+            start = _current_time()
+            try:
+                return call(), None, _current_time() - start
+            except Exception as e:
+                return None, e, _current_time() - start
+
+        start = _current_time()
+        futures = [worker.submit(timed, call) for worker, call in zip(self._workers, calls)]
+        outcomes = [future.result() for future in futures]
+        elapsed = _current_time() - start
+
+        results, exceptions, latencies = zip(*outcomes) if outcomes else ((), (), ())
+        result = GreatBoardFleetResult(self.boards, list(results), list(exceptions), list(latencies), elapsed)
+
+        if not return_exceptions:
+            result.raise_first_exception()
+
+        return result
+
+
+
+class GreatBoardFleetResult(object):
+    """
+    Class representing the outcome of an operation that spanned a fleet. Iterating over the result
+    (or indexing it) provides each board's result, in the same order as the fleet's boards.
+
+    Attributes:
+        boards -- The boards the operation ran on.
+        results -- Each board's result; or None, if the operation failed on that board.
+        exceptions -- The exception raised on each board; or None, if the operation succeeded on that board.
+        latencies -- The time each board took to complete the operation, in seconds.
+        elapsed -- The time the fleet took to complete the operation, in seconds.
+    """
+
+    def __init__(self, boards, results, exceptions, latencies, elapsed):
+        self.boards = boards
+        self.results = results
+        self.exceptions = exceptions
+        self.latencies = latencies
+        self.elapsed = elapsed
+
+
+    def __len__(self):
+        return len(self.results)
+
+    def __iter__(self):
+        return iter(self.results)
+
+    def __getitem__(self, index):
+        return self.results[index]
+
+
+    @property
+    def succeeded(self):
+        """ The number of boards on which the operation succeeded. """
+        return sum(1 for exception in self.exceptions if exception is None)
+
+
+    @property
+    def throughput(self):
+        """ The aggregate throughput of the fleet, in successful operations per second. """
+        return (self.succeeded / self.elapsed) if self.elapsed else 0.0
+
+
+    @property
+    def mean_latency(self):
+        """ The mean time each board took to complete the operation, in seconds. """
+        return (sum(self.latencies) / len(self.latencies)) if self.latencies else 0.0
+
+
+    @property
+    def max_latency(self):
+        """ The time the slowest board took to complete the operation, in seconds. """
+        return max(self.latencies) if self.latencies else 0.0
+
+
+    def raise_first_exception(self):
+        """ Raises the first exception raised by any board, if there was one. """
+
+        for exception in self.exceptions:
+            if exception is not None:
+                raise exception
+
+
+    def summary(self):
+        """ Returns a human-readable summary of the operation's per-board latencies and aggregate throughput. """
+
+        lines = []
+
+        for index, (board, exception, latency) in enumerate(zip(self.boards, self.exceptions, self.latencies)):
+            status = "ok" if exception is None else "failed: {}".format(exception)
+            lines.append("{:>3}: {:<32} {:10.3f} ms  {}".format(index, board.board_name(), latency * 1000, status))
+
+        lines.append("{} of {} boards succeeded in {:.3f} ms; {:.1f} operations/s".format(
+            self.succeeded, len(self.results), self.elapsed * 1000, self.throughput))
+
+        return "\n".join(lines)
@@ -32,7 +32,7 @@ setup(
     author='Katherine J. Temkin',
     author_email='ktemkin@greatscottgadgets.com',
     tests_require=[''],
-    install_requires=['pyusb', 'future', 'backports.functools_lru_cache'],
+    install_requires=['pyusb', 'future', 'backports.functools_lru_cache', 'futures; python_version < "3"'],
     description='Python library for talking with libGreat devices',
     long_description=read('../README.md'),
     packages=find_packages(),
@@ -51,6 +51,6 @@ setup(
         'Topic :: Scientific/Engineering',
         'Topic :: Security',
         ],
-    extras_require={},
+    extras_require={'numpy': ['numpy']},
     **setup_options
 )